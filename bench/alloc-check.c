@@ -0,0 +1,291 @@
+/*
+ *  Copyright (C) 2019 David Lazar <dlazar@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Checks that the update loop allocates nothing once it's warmed up.
+ * Replaces malloc() and friends with versions that count the calls, reads
+ * the counters of synthetic devices laid out like /sys/class/net, with the
+ * packet counters, and fails if netdev_probe_read(), traffic_update_list()
+ * or traffic_update_stats(), which calls netdev_update(), allocated
+ * anything.  With --system, reads the interfaces of the running system
+ * instead, through rtnetlink when it's enabled.  Run by `make check'. */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "netdev.h"
+#include "sampler.h"
+#include "traffic.h"
+
+#define N_DEVS		100
+#define HIST_LEN	128
+#define WARMUP_TICKS	(2 * 3600 + HIST_LEN)  /* Fills the hour tier too. */
+#define CHECK_TICKS	1000
+
+/* The allocator of glibc, which the replacements below call. */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+extern void __libc_free(void *ptr);
+
+/* Only counted while `counting`, from the main thread. */
+static gboolean counting = FALSE;
+static guint64 allocations = 0;
+
+typedef struct {
+	gchar *root;  /* NULL when reading the running system. */
+	GPtrArray *probes;
+	SamplerSnapshot snapshot;
+	Traffic *traffic;
+	guint64 bytes;  /* Written to the synthetic counters. */
+	guint n_writes;
+} Check;
+
+static void check_init(Check *check, gboolean system);
+static void check_free(Check *check);
+static gchar *make_sysfs(void);
+static void write_attr(const gchar *root, const gchar *dev, const gchar *attr,
+		       guint64 value);
+static void write_counters(Check *check);
+static void tick(Check *check);
+static void remove_tree(const gchar *path);
+
+
+// Allow variable declarations at the first use.
+#pragma GCC diagnostic ignored "-Wdeclaration-after-statement"
+
+
+void *malloc(size_t size)
+{
+	if (counting) allocations++;
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	if (counting) allocations++;
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	if (counting) allocations++;
+	return __libc_realloc(ptr, size);
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+	if (counting) allocations++;
+	return __libc_memalign(alignment, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+	return memalign(alignment, size);
+}
+
+int posix_memalign(void **ptr, size_t alignment, size_t size)
+{
+	void *mem = memalign(alignment, size);
+	if (!mem) return ENOMEM;
+	*ptr = mem;
+	return 0;
+}
+
+void free(void *ptr)
+{
+	__libc_free(ptr);
+}
+
+int main(int argc, char **argv)
+{
+	gboolean system = (argc > 1 && g_strcmp0(argv[1], "--system") == 0);
+
+	Check check;
+	check_init(&check, system);
+	if (check.probes->len == 0) {
+		fprintf(stderr, "No interfaces to read.\n");
+		check_free(&check);
+		return 77;  /* Skipped, for `make check'. */
+	}
+
+	for (guint i = 0; i < WARMUP_TICKS; i++) {
+		write_counters(&check);
+		tick(&check);
+	}
+
+	guint64 total = 0;
+	for (guint i = 0; i < CHECK_TICKS; i++) {
+		write_counters(&check);
+
+		allocations = 0;
+		counting = TRUE;
+		tick(&check);
+		counting = FALSE;
+		total += allocations;
+	}
+
+	printf("%u interfaces, %u updates: %" G_GUINT64_FORMAT " allocations\n",
+	       check.probes->len, CHECK_TICKS, total);
+
+	/* Without traffic, most of the update would be skipped. */
+	gboolean idle = (check.root && history_max(check.traffic->agg_rx) == 0);
+	if (idle) fprintf(stderr, "The synthetic counters were never read.\n");
+	check_free(&check);
+
+	return (total || idle) ? 1 : 0;
+}
+
+static void check_init(Check *check, gboolean system)
+{
+	memset(check, 0, sizeof(*check));
+	check->root = system ? NULL : make_sysfs();
+	if (check->root) netdev_set_sysfs_root(check->root);
+
+	netdev_refresh();
+	g_autoptr(GPtrArray) names = netdev_enumerate();
+
+	check->probes = g_ptr_array_new_with_free_func((GDestroyNotify)netdev_probe_free);
+	for (guint i = 0; names && i < names->len; i++) {
+		NetdevProbe *probe = netdev_probe_new(g_ptr_array_index(names, i));
+		netdev_probe_set_counters(probe, TRUE);
+		g_ptr_array_add(check->probes, probe);
+	}
+
+	SamplerSnapshot *snapshot = &check->snapshot;
+	snapshot->entries = g_new0(SamplerEntry, MAX(check->probes->len, 1));
+	snapshot->n_entries = snapshot->n_alloc = check->probes->len;
+	snapshot->ticks = 1;
+
+	check->traffic = traffic_new();
+	check->traffic->interval = 1000;
+	traffic_resize(check->traffic, HIST_LEN);
+	traffic_count_packets(check->traffic, TRUE);
+}
+
+static void check_free(Check *check)
+{
+	traffic_free(check->traffic);
+	g_free(check->snapshot.entries);
+	g_ptr_array_free(check->probes, TRUE);
+	if (check->root) {
+		remove_tree(check->root);
+		g_free(check->root);
+	}
+}
+
+/* Lays out N_DEVS devices that are up, in a temporary directory. */
+static gchar *make_sysfs(void)
+{
+	g_autoptr(GError) error = NULL;
+	gchar *root = g_dir_make_tmp("netgraph-alloc-XXXXXX", &error);
+	if (!root) g_error("Can't create the sysfs tree: %s", error->message);
+
+	for (guint i = 0; i < N_DEVS; i++) {
+		gchar dev[16];
+		g_snprintf(dev, sizeof(dev), "veth%04u", i);
+
+		g_autofree gchar *stats = g_build_filename(root, dev, "statistics", NULL);
+		g_mkdir_with_parents(stats, 0755);
+
+		g_autofree gchar *operstate = g_build_filename(root, dev, "operstate", NULL);
+		g_file_set_contents(operstate, "up\n", -1, NULL);
+		write_attr(root, dev, "ifindex", i + 2);
+		write_attr(root, dev, "statistics/rx_bytes", 0);
+		write_attr(root, dev, "statistics/tx_bytes", 0);
+		write_attr(root, dev, "statistics/rx_packets", 0);
+		write_attr(root, dev, "statistics/tx_packets", 0);
+		write_attr(root, dev, "statistics/rx_dropped", 0);
+		write_attr(root, dev, "statistics/rx_errors", 0);
+		write_attr(root, dev, "statistics/tx_errors", 0);
+		write_attr(root, dev, "statistics/rx_missed_errors", 0);
+	}
+
+	return root;
+}
+
+/* Rewrites the file in place, unlike g_file_set_contents(), which replaces
+ * it, since the probes keep reading the files they opened. */
+static void write_attr(const gchar *root, const gchar *dev, const gchar *attr,
+		       guint64 value)
+{
+	g_autofree gchar *path = g_build_filename(root, dev, attr, NULL);
+	gchar contents[32];
+	gint len = g_snprintf(contents, sizeof(contents), "%" G_GUINT64_FORMAT "\n", value);
+
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0 || write(fd, contents, len) != len)
+		g_error("Can't write %s.", path);
+	close(fd);
+}
+
+/* Moves the byte counters of the synthetic devices, by a varying amount so
+ * that the maxima and the quantiles move too, outside of the counted
+ * ticks. */
+static void write_counters(Check *check)
+{
+	if (!check->root) return;
+
+	check->bytes += 1500 * (1 + check->n_writes++ % 16);
+	for (guint i = 0; i < check->probes->len; i++) {
+		const NetdevProbe *probe = g_ptr_array_index(check->probes, i);
+		write_attr(check->root, probe->name, "statistics/rx_bytes", check->bytes);
+		write_attr(check->root, probe->name, "statistics/tx_bytes", check->bytes / 2);
+	}
+}
+
+/* One update, as the sampler and the plugin do it, one second apart. */
+static void tick(Check *check)
+{
+	SamplerSnapshot *snapshot = &check->snapshot;
+	snapshot->time.monotonic += G_USEC_PER_SEC;
+
+	netdev_refresh();
+	for (guint i = 0; i < check->probes->len; i++) {
+		NetdevProbe *probe = g_ptr_array_index(check->probes, i);
+		SamplerEntry *entry = &snapshot->entries[i];
+		netdev_probe_read(probe, &entry->stats);
+		entry->ifindex = probe->ifindex;
+		g_strlcpy(entry->name, probe->name, sizeof(entry->name));
+		entry->stats.time = snapshot->time;
+	}
+
+	traffic_update_list(check->traffic, snapshot);
+	traffic_update_stats(check->traffic, snapshot, TRUE);
+}
+
+static void remove_tree(const gchar *path)
+{
+	g_autoptr(GDir) dir = g_dir_open(path, 0, NULL);
+	const gchar *name;
+	while (dir && (name = g_dir_read_name(dir)) != NULL) {
+		g_autofree gchar *child = g_build_filename(path, name, NULL);
+		if (g_file_test(child, G_FILE_TEST_IS_DIR)) {
+			remove_tree(child);
+		} else {
+			g_unlink(child);
+		}
+	}
+	g_rmdir(path);
+}
@@ -0,0 +1,164 @@
+/*
+ *  Copyright (C) 2019 David Lazar <dlazar@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Compares the full and the compact histories, for windows from 128 to
+ * 8192 samples, of 256 synthetic devices.  Prints one tab-separated line
+ * per mode and length, with the memory of one history, and of the
+ * consolidated archive that goes with it, the time to read
+ * every column of every device, as drawing them all would, the time to
+ * push a sample into every device, and the largest relative error of the
+ * compact samples. */
+
+#include <stdio.h>
+#include <glib.h>
+
+#include "history.h"
+#include "rrd.h"
+
+#define N_DEVS		256
+#define MIN_LEN		128
+#define MAX_LEN		8192
+#define MIN_DURATION	(G_USEC_PER_SEC / 4)
+
+static guint64 random_rate(GRand *rand);
+static gdouble time_reads(History **hists, gsize len);
+static gdouble time_pushes(History **hists, GRand *rand);
+static gsize history_bytes(const History *hist);
+static gsize rrd_bytes(gsize len, gboolean compact);
+
+
+// Allow variable declarations at the first use.
+#pragma GCC diagnostic ignored "-Wdeclaration-after-statement"
+
+
+int main(int argc, char **argv)
+{
+	GRand *rand = g_rand_new_with_seed(1);
+	History *full[N_DEVS];
+	History *compact[N_DEVS];
+
+	printf("# mode\tlength\tbytes_per_history\tbytes_per_rrd\tns_per_draw\tns_per_tick\tmax_error\n");
+	for (gsize len = MIN_LEN; len <= MAX_LEN; len *= 2) {
+		for (guint i = 0; i < N_DEVS; i++) {
+			full[i] = history_new(len);
+			compact[i] = history_new(len);
+			history_set_compact(compact[i], TRUE);
+			for (gsize j = 0; j < len; j++) {
+				guint64 rate = random_rate(rand);
+				history_push(full[i], rate);
+				history_push(compact[i], rate);
+			}
+		}
+
+		gdouble max_error = 0;
+		for (guint i = 0; i < N_DEVS; i++) {
+			for (gsize age = 0; age < len; age++) {
+				guint64 exact = history_get(full[i], age);
+				guint64 rounded = history_get(compact[i], age);
+				if (exact) max_error = MAX(max_error, (gdouble)(exact - rounded) / exact);
+			}
+		}
+
+		printf("full\t%zu\t%zu\t%zu\t%.0f\t%.0f\t0\n", len,
+		       history_bytes(full[0]), rrd_bytes(len, FALSE),
+		       time_reads(full, len), time_pushes(full, rand));
+		printf("compact\t%zu\t%zu\t%zu\t%.0f\t%.0f\t%.3g\n", len,
+		       history_bytes(compact[0]), rrd_bytes(len, TRUE),
+		       time_reads(compact, len), time_pushes(compact, rand), max_error);
+
+		for (guint i = 0; i < N_DEVS; i++) {
+			history_free(compact[i]);
+			history_free(full[i]);
+		}
+	}
+
+	g_rand_free(rand);
+
+	return 0;
+}
+
+/* Mostly idle, with bursts from kilobytes to gigabytes per second. */
+static guint64 random_rate(GRand *rand)
+{
+	if (g_rand_int_range(rand, 0, 4)) return g_rand_int_range(rand, 0, 2000);
+
+	return (guint64)g_rand_int(rand) << g_rand_int_range(rand, 0, 8);
+}
+
+/* Returns the average time to read all the samples, in nanoseconds. */
+static gdouble time_reads(History **hists, gsize len)
+{
+	guint64 frames = 0;
+	volatile guint64 sink = 0;
+	gint64 start = g_get_monotonic_time();
+	gint64 elapsed;
+	do {
+		guint64 sum = 0;
+		for (guint i = 0; i < N_DEVS; i++) {
+			for (gsize age = 0; age < len; age++) {
+				sum += history_get(hists[i], age);
+			}
+		}
+		sink += sum;
+		frames++;
+		elapsed = g_get_monotonic_time() - start;
+	} while (elapsed < MIN_DURATION);
+
+	return elapsed * 1000.0 / frames;
+}
+
+/* Returns the average time to add a sample to every history, in
+ * nanoseconds. */
+static gdouble time_pushes(History **hists, GRand *rand)
+{
+	guint64 ticks = 0;
+	gint64 start = g_get_monotonic_time();
+	gint64 elapsed;
+	do {
+		for (guint i = 0; i < N_DEVS; i++) {
+			history_push(hists[i], random_rate(rand));
+		}
+		ticks++;
+		elapsed = g_get_monotonic_time() - start;
+	} while (elapsed < MIN_DURATION);
+
+	return elapsed * 1000.0 / ticks;
+}
+
+/* The samples, and the positions of the max. */
+static gsize history_bytes(const History *hist)
+{
+	gsize sample_size = hist->codes ? sizeof(guint32) : sizeof(guint64);
+	return hist->len * (sample_size + sizeof(*hist->maxq));
+}
+
+/* The points of all the tiers. */
+static gsize rrd_bytes(gsize len, gboolean compact)
+{
+	Rrd *rrd = rrd_new(len);
+	rrd_set_compact(rrd, compact);
+
+	gsize bytes = 0;
+	for (gint i = 0; i < RRD_N_TIERS; i++) {
+		const RrdTier *tier = &rrd->tiers[i];
+		bytes += tier->len * (tier->codes ? sizeof(RrdCode) : sizeof(RrdPoint));
+	}
+
+	rrd_free(rrd);
+	return bytes;
+}
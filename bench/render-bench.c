@@ -0,0 +1,148 @@
+/*
+ *  Copyright (C) 2019 David Lazar <dlazar@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Compares the cairo and the pixel-buffer graph renderers, for graphs from
+ * 32x32 to 1024x1024 pixels, without and with the drop overlay.  Prints one
+ * tab-separated line per renderer and size, with the time per full repaint
+ * and the number of pixels that differ between the two renderers. */
+
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+#include <cairo.h>
+#include <gdk/gdk.h>
+
+#include "render.h"
+
+#define MIN_SIZE	32
+#define MAX_SIZE	1024
+#define MIN_DURATION	(G_USEC_PER_SEC / 4)
+
+typedef void (*RenderFunc)(cairo_surface_t *surface, const RenderStyle *style,
+			   const guint32 *rx_seg, const guint32 *tx_seg,
+			   const guint32 *drop_seg, guint x0, guint x1);
+
+static gdouble time_renderer(RenderFunc render, cairo_surface_t *surface,
+			     const RenderStyle *style, const guint32 *rx_seg,
+			     const guint32 *tx_seg, const guint32 *drop_seg, guint w);
+static guint count_mismatches(cairo_surface_t *a, cairo_surface_t *b);
+
+
+// Allow variable declarations at the first use.
+#pragma GCC diagnostic ignored "-Wdeclaration-after-statement"
+
+
+int main(int argc, char **argv)
+{
+	/* A translucent background and download color, to exercise the
+	 * blending. */
+	GdkRGBA bg_color, rx_color, tx_color, drop_color;
+	gdk_rgba_parse(&bg_color, "rgba(40,40,40,0.5)");
+	gdk_rgba_parse(&rx_color, "rgba(16,80,73,0.8)");
+	gdk_rgba_parse(&tx_color, "rgb(170,83,8)");
+	gdk_rgba_parse(&drop_color, "rgba(200,0,0,0.9)");
+
+	RenderStyle style;
+	render_style_init(&style, &bg_color, &rx_color, &tx_color, &drop_color);
+
+	GRand *rand = g_rand_new_with_seed(1);
+
+	printf("# renderer\twidth\theight\tns_per_frame\tmismatched_pixels\n");
+	for (guint size = MIN_SIZE; size <= MAX_SIZE; size *= 2) {
+		guint w = size, h = size;
+
+		/* Random bars, which overlap in some of the columns. */
+		guint32 *rx_seg = g_new(guint32, w);
+		guint32 *tx_seg = g_new(guint32, w);
+		guint32 *drop_seg = g_new(guint32, w);
+		for (guint x = 0; x < w; x++) {
+			rx_seg[x] = g_rand_int_range(rand, 0, h + 1);
+			tx_seg[x] = g_rand_int_range(rand, 0, h + 1 - rx_seg[x] / 2);
+			drop_seg[x] = g_rand_int_range(rand, 0, rx_seg[x] / 4 + 1);
+		}
+
+		cairo_surface_t *cairo_out = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, w, h);
+		cairo_surface_t *pixels_out = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, w, h);
+
+		for (gint drops = 0; drops < 2; drops++) {
+			const guint32 *drops_seg = drops ? drop_seg : NULL;
+			const gchar *suffix = drops ? "+drops" : "";
+
+			gdouble cairo_ns = time_renderer(render_columns_cairo, cairo_out,
+							 &style, rx_seg, tx_seg, drops_seg, w);
+			gdouble pixels_ns = time_renderer(render_columns_pixels, pixels_out,
+							  &style, rx_seg, tx_seg, drops_seg, w);
+			guint mismatches = count_mismatches(cairo_out, pixels_out);
+
+			printf("cairo%s\t%u\t%u\t%.0f\t%u\n", suffix, w, h, cairo_ns, mismatches);
+			printf("pixels%s\t%u\t%u\t%.0f\t%u\n", suffix, w, h, pixels_ns, mismatches);
+		}
+
+		cairo_surface_destroy(pixels_out);
+		cairo_surface_destroy(cairo_out);
+		g_free(drop_seg);
+		g_free(tx_seg);
+		g_free(rx_seg);
+	}
+
+	g_rand_free(rand);
+
+	return 0;
+}
+
+/* Returns the average time of a full repaint, in nanoseconds. */
+static gdouble time_renderer(RenderFunc render, cairo_surface_t *surface,
+			     const RenderStyle *style, const guint32 *rx_seg,
+			     const guint32 *tx_seg, const guint32 *drop_seg, guint w)
+{
+	/* Warm up the caches first. */
+	render(surface, style, rx_seg, tx_seg, drop_seg, 0, w);
+
+	guint64 frames = 0;
+	gint64 start = g_get_monotonic_time();
+	gint64 elapsed;
+	do {
+		render(surface, style, rx_seg, tx_seg, drop_seg, 0, w);
+		cairo_surface_flush(surface);
+		frames++;
+		elapsed = g_get_monotonic_time() - start;
+	} while (elapsed < MIN_DURATION);
+
+	return elapsed * 1000.0 / frames;
+}
+
+static guint count_mismatches(cairo_surface_t *a, cairo_surface_t *b)
+{
+	cairo_surface_flush(a);
+	cairo_surface_flush(b);
+
+	guint w = cairo_image_surface_get_width(a);
+	guint h = cairo_image_surface_get_height(a);
+	guint mismatches = 0;
+	for (guint y = 0; y < h; y++) {
+		const guint32 *row_a = (const guint32 *)(cairo_image_surface_get_data(a)
+			+ y * cairo_image_surface_get_stride(a));
+		const guint32 *row_b = (const guint32 *)(cairo_image_surface_get_data(b)
+			+ y * cairo_image_surface_get_stride(b));
+		for (guint x = 0; x < w; x++) {
+			if (row_a[x] != row_b[x]) mismatches++;
+		}
+	}
+
+	return mismatches;
+}
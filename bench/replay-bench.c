@@ -0,0 +1,189 @@
+/*
+ *  Copyright (C) 2019 David Lazar <dlazar@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Measures the CPU time the plugin spends on each update, against a trace
+ * recorded with trace-record, so that runs see the same traffic every
+ * time:
+ *
+ *	replay-bench FILE [WIDTH]
+ *
+ * The trace is played back one sample per update, as fast as possible,
+ * through the same steps as the sampler and the panel plugin, counting
+ * packets too if the trace has their counters.  Prints one tab-separated
+ * line per step, with the CPU time per update. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <glib.h>
+#include <cairo.h>
+#include <gdk/gdk.h>
+
+#include "graph.h"
+#include "netdev.h"
+#include "sampler.h"
+#include "tooltip.h"
+#include "trace.h"
+#include "traffic.h"
+
+#define DEFAULT_WIDTH	128
+#define HEIGHT		32
+
+typedef enum {
+	STEP_SAMPLE,
+	STEP_UPDATE,
+	STEP_TOOLTIP,
+	STEP_DRAW,
+	N_STEPS
+} Step;
+
+static const gchar *step_names[N_STEPS] = {
+	"sample", "update", "tooltip", "draw",
+};
+
+static void take_snapshot(GHashTable *probes, SamplerSnapshot *snapshot);
+static gint64 cpu_time(void);
+
+
+// Allow variable declarations at the first use.
+#pragma GCC diagnostic ignored "-Wdeclaration-after-statement"
+
+
+int main(int argc, char **argv)
+{
+	if (argc < 2 || argc > 3) {
+		fprintf(stderr, "Usage: %s FILE [WIDTH]\n", argv[0]);
+		return 2;
+	}
+
+	guint w = (argc > 2) ? strtoul(argv[2], NULL, 10) : DEFAULT_WIDTH;
+	if (w == 0) w = DEFAULT_WIDTH;
+
+	/* Only to know how many samples there are. */
+	Trace *trace = trace_load(argv[1]);
+	if (!trace || !netdev_set_replay(argv[1], 0.0)) return 1;
+	guint n_samples = trace->frames->len;
+	trace_free(trace);
+
+	Traffic *traffic = traffic_new();
+	traffic->interval = 1000;
+	traffic_resize(traffic, w);
+	traffic_count_packets(traffic, TRUE);
+
+	Graph *graph = graph_new(traffic);
+	gdk_rgba_parse(&graph->bg_color, "rgba(0,0,0,0)");
+	gdk_rgba_parse(&graph->rx_color, "rgb(16,80,73)");
+	gdk_rgba_parse(&graph->tx_color, "rgb(170,83,8)");
+	gdk_rgba_parse(&graph->drop_color, "rgb(200,0,0)");
+
+	cairo_surface_t *target = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, w, HEIGHT);
+	cairo_t *cr = cairo_create(target);
+
+	GHashTable *probes = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+						   (GDestroyNotify)netdev_probe_free);
+	SamplerSnapshot snapshot = { .ticks = 1 };
+	GString *tooltip = g_string_new("");
+	gint64 cpu[N_STEPS] = { 0 };
+	guint max_devs = 0;
+
+	for (guint n = 0; n < n_samples; n++) {
+		gint64 start = cpu_time();
+		take_snapshot(probes, &snapshot);
+		gint64 sampled = cpu_time();
+
+		traffic_update_list(traffic, &snapshot);
+		traffic_update_stats(traffic, &snapshot, TRUE);
+		graph_update_scale(graph);
+		gint64 updated = cpu_time();
+
+		tooltip_format(tooltip, graph, FALSE);
+		gint64 formatted = cpu_time();
+
+		if (graph_changed(graph, w, HEIGHT)) graph_scroll(graph, w, HEIGHT);
+		graph_draw(graph, cr, w, HEIGHT);
+		cairo_surface_flush(target);
+		gint64 drawn = cpu_time();
+
+		cpu[STEP_SAMPLE] += sampled - start;
+		cpu[STEP_UPDATE] += updated - sampled;
+		cpu[STEP_TOOLTIP] += formatted - updated;
+		cpu[STEP_DRAW] += drawn - formatted;
+		max_devs = MAX(max_devs, traffic->devs->len);
+	}
+
+	printf("# step\tsamples\tdevices\tcpu_ns_per_update\n");
+	for (Step step = 0; step < N_STEPS; step++) {
+		printf("%s\t%u\t%u\t%.0f\n", step_names[step], n_samples, max_devs,
+		       (gdouble)cpu[step] / MAX(n_samples, 1));
+	}
+
+	g_string_free(tooltip, TRUE);
+	g_free(snapshot.entries);
+	g_hash_table_destroy(probes);
+	cairo_destroy(cr);
+	cairo_surface_destroy(target);
+	graph_free(graph);
+	traffic_free(traffic);
+
+	return 0;
+}
+
+/* Does what the sampler does on every tick, without the thread. */
+static void take_snapshot(GHashTable *probes, SamplerSnapshot *snapshot)
+{
+	netdev_refresh();
+
+	GPtrArray *names = netdev_enumerate();
+	for (guint i = 0; names && i < names->len; i++) {
+		const gchar *name = g_ptr_array_index(names, i);
+		if (g_hash_table_contains(probes, name)) continue;
+
+		NetdevProbe *probe = netdev_probe_new(name);
+		netdev_probe_set_counters(probe, TRUE);
+		g_hash_table_insert(probes, probe->name, probe);
+	}
+	if (names) g_ptr_array_free(names, TRUE);
+
+	guint n = g_hash_table_size(probes);
+	if (n > snapshot->n_alloc) {
+		snapshot->entries = g_renew(SamplerEntry, snapshot->entries, n);
+		snapshot->n_alloc = n;
+	}
+
+	netdev_get_time(&snapshot->time);
+	snapshot->n_entries = 0;
+
+	GHashTableIter iter;
+	NetdevProbe *probe;
+	g_hash_table_iter_init(&iter, probes);
+	while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&probe)) {
+		SamplerEntry *entry = &snapshot->entries[snapshot->n_entries++];
+		entry->ifindex = probe->ifindex;
+		g_strlcpy(entry->name, probe->name, sizeof(entry->name));
+		netdev_probe_read(probe, &entry->stats);
+	}
+}
+
+/* Returns the CPU time used by the process, in nanoseconds. */
+static gint64 cpu_time(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return ts.tv_sec * (gint64)1000000000 + ts.tv_nsec;
+}
@@ -0,0 +1,257 @@
+/*
+ *  Copyright (C) 2019 David Lazar <dlazar@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Measures the work done on every update, with 1 to 2000 synthetic
+ * devices, and drawing the graph into an offscreen surface, from 16 to 2048
+ * pixels wide, with the total or 50 stacked devices.  Prints one tab-separated line per function and size, with
+ * the time per tick, so that runs can be compared over time. */
+
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+#include <cairo.h>
+#include <gdk/gdk.h>
+
+#include "graph.h"
+#include "netdev.h"
+#include "sampler.h"
+#include "tooltip.h"
+#include "traffic.h"
+
+#define LIST_WIDTH	128	/* pixels, for the per-device functions */
+#define DRAW_DEVS	10	/* devices, for the drawing functions */
+#define STACK_DEVS	50	/* devices, for the stacked graph */
+#define MIN_WIDTH	16
+#define MAX_WIDTH	2048
+#define HEIGHT		32
+#define MIN_DURATION	(G_USEC_PER_SEC / 4)
+
+static const guint dev_counts[] = { 1, 10, 100, 1000, 2000 };
+
+typedef struct {
+	Traffic *traffic;
+	Graph *graph;
+	SamplerSnapshot snapshot;
+	GString *tooltip;
+	GRand *rand;
+	cairo_surface_t *target;  /* Stands in for the panel window. */
+	cairo_t *cr;
+	guint w;
+} Bench;
+
+typedef void (*TickFunc)(Bench *bench);
+
+static Bench *bench_new(guint n_devs, guint w);
+static void bench_free(Bench *bench);
+static void advance(Bench *bench);
+static gdouble time_ticks(TickFunc tick, Bench *bench);
+static void tick_netdev_update(Bench *bench);
+static void tick_update_list(Bench *bench);
+static void tick_update_stats(Bench *bench);
+static void tick_tooltip(Bench *bench);
+static void tick_draw(Bench *bench);
+static void tick_scroll(Bench *bench);
+
+
+// Allow variable declarations at the first use.
+#pragma GCC diagnostic ignored "-Wdeclaration-after-statement"
+
+
+int main(int argc, char **argv)
+{
+	printf("# function\tdevices\twidth\tns_per_tick\n");
+
+	for (gsize i = 0; i < G_N_ELEMENTS(dev_counts); i++) {
+		guint n = dev_counts[i];
+		Bench *bench = bench_new(n, LIST_WIDTH);
+
+		printf("netdev_update\t%u\t%u\t%.0f\n", n, LIST_WIDTH,
+		       time_ticks(tick_netdev_update, bench));
+		printf("traffic_update_list\t%u\t%u\t%.0f\n", n, LIST_WIDTH,
+		       time_ticks(tick_update_list, bench));
+		printf("traffic_update_stats\t%u\t%u\t%.0f\n", n, LIST_WIDTH,
+		       time_ticks(tick_update_stats, bench));
+		printf("tooltip_format\t%u\t%u\t%.0f\n", n, LIST_WIDTH,
+		       time_ticks(tick_tooltip, bench));
+
+		bench_free(bench);
+	}
+
+	for (guint w = MIN_WIDTH; w <= MAX_WIDTH; w *= 2) {
+		Bench *bench = bench_new(DRAW_DEVS, w);
+
+		printf("graph_draw\t%u\t%u\t%.0f\n", DRAW_DEVS, w,
+		       time_ticks(tick_draw, bench));
+		printf("graph_scroll\t%u\t%u\t%.0f\n", DRAW_DEVS, w,
+		       time_ticks(tick_scroll, bench));
+
+		bench_free(bench);
+	}
+
+	/* The running totals of the stacked graph are only summed for the
+	 * new points, so a repaint just maps them to pixels. */
+	for (guint w = MIN_WIDTH; w <= MAX_WIDTH; w *= 2) {
+		Bench *bench = bench_new(STACK_DEVS, w);
+		bench->graph->stacked = TRUE;
+
+		printf("graph_draw_stacked\t%u\t%u\t%.0f\n", STACK_DEVS, w,
+		       time_ticks(tick_draw, bench));
+		printf("graph_scroll_stacked\t%u\t%u\t%.0f\n", STACK_DEVS, w,
+		       time_ticks(tick_scroll, bench));
+
+		bench_free(bench);
+	}
+
+	return 0;
+}
+
+/* Sets up `n_devs` devices, with a full history of random traffic. */
+static Bench *bench_new(guint n_devs, guint w)
+{
+	Bench *bench = g_new0(Bench, 1);
+	bench->rand = g_rand_new_with_seed(1);
+	bench->tooltip = g_string_new("");
+	bench->w = w;
+
+	bench->traffic = traffic_new();
+	bench->traffic->interval = 1000;
+	traffic_resize(bench->traffic, w);
+
+	bench->graph = graph_new(bench->traffic);
+	gdk_rgba_parse(&bench->graph->bg_color, "rgba(0,0,0,0)");
+	gdk_rgba_parse(&bench->graph->rx_color, "rgb(16,80,73)");
+	gdk_rgba_parse(&bench->graph->tx_color, "rgb(170,83,8)");
+	gdk_rgba_parse(&bench->graph->drop_color, "rgb(200,0,0)");
+
+	SamplerSnapshot *snapshot = &bench->snapshot;
+	snapshot->entries = g_new0(SamplerEntry, n_devs);
+	snapshot->n_entries = snapshot->n_alloc = n_devs;
+	snapshot->ticks = 1;
+	for (guint i = 0; i < n_devs; i++) {
+		SamplerEntry *entry = &snapshot->entries[i];
+		entry->ifindex = i + 1;
+		g_snprintf(entry->name, sizeof(entry->name), "veth%04u", i);
+		entry->stats.is_up = TRUE;
+	}
+
+	traffic_update_list(bench->traffic, snapshot);
+	for (guint i = 0; i <= w; i++) {
+		advance(bench);
+		traffic_update_stats(bench->traffic, snapshot, TRUE);
+	}
+	graph_update_scale(bench->graph);
+
+	bench->target = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, w, HEIGHT);
+	bench->cr = cairo_create(bench->target);
+
+	return bench;
+}
+
+static void bench_free(Bench *bench)
+{
+	cairo_destroy(bench->cr);
+	cairo_surface_destroy(bench->target);
+	graph_free(bench->graph);
+	traffic_free(bench->traffic);
+	g_free(bench->snapshot.entries);
+	g_string_free(bench->tooltip, TRUE);
+	g_rand_free(bench->rand);
+	g_free(bench);
+}
+
+/* Moves the snapshot one second ahead, with some random traffic. */
+static void advance(Bench *bench)
+{
+	SamplerSnapshot *snapshot = &bench->snapshot;
+	snapshot->time.monotonic += G_USEC_PER_SEC;
+
+	for (guint i = 0; i < snapshot->n_entries; i++) {
+		NetdevStats *stats = &snapshot->entries[i].stats;
+		stats->rx_bytes += g_rand_int_range(bench->rand, 0, 1 << 20);
+		stats->tx_bytes += g_rand_int_range(bench->rand, 0, 1 << 18);
+		stats->time = snapshot->time;
+	}
+}
+
+/* Returns the average time of a tick, in nanoseconds. */
+static gdouble time_ticks(TickFunc tick, Bench *bench)
+{
+	/* Warm up the caches first. */
+	tick(bench);
+
+	guint64 ticks = 0;
+	gint64 start = g_get_monotonic_time();
+	gint64 elapsed;
+	do {
+		tick(bench);
+		ticks++;
+		elapsed = g_get_monotonic_time() - start;
+	} while (elapsed < MIN_DURATION);
+
+	return elapsed * 1000.0 / ticks;
+}
+
+static void tick_netdev_update(Bench *bench)
+{
+	GPtrArray *devs = bench->traffic->devs;
+	SamplerSnapshot *snapshot = &bench->snapshot;
+
+	advance(bench);
+	guint64 now = snapshot->time.monotonic / 1000;
+	for (guint i = 0; i < devs->len; i++) {
+		netdev_update(g_ptr_array_index(devs, i), &snapshot->entries[i].stats,
+			      now, 1000, 1);
+	}
+}
+
+static void tick_update_list(Bench *bench)
+{
+	traffic_update_list(bench->traffic, &bench->snapshot);
+}
+
+static void tick_update_stats(Bench *bench)
+{
+	advance(bench);
+	traffic_update_stats(bench->traffic, &bench->snapshot, TRUE);
+}
+
+static void tick_tooltip(Bench *bench)
+{
+	tooltip_format(bench->tooltip, bench->graph, FALSE);
+}
+
+/* A full repaint, as after a change of the scale or the settings. */
+static void tick_draw(Bench *bench)
+{
+	graph_invalidate(bench->graph);
+	graph_draw(bench->graph, bench->cr, bench->w, HEIGHT);
+	cairo_surface_flush(bench->target);
+}
+
+/* A whole update, as the plugin does it while the graph is shown. */
+static void tick_scroll(Bench *bench)
+{
+	advance(bench);
+	traffic_update_stats(bench->traffic, &bench->snapshot, TRUE);
+	graph_update_scale(bench->graph);
+	if (graph_changed(bench->graph, bench->w, HEIGHT)) {
+		graph_scroll(bench->graph, bench->w, HEIGHT);
+		graph_draw(bench->graph, bench->cr, bench->w, HEIGHT);
+		cairo_surface_flush(bench->target);
+	}
+}
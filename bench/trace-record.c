@@ -0,0 +1,104 @@
+/*
+ *  Copyright (C) 2019 David Lazar <dlazar@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Records the counters and link states of the interfaces of the running
+ * system into a trace, for netdev_set_replay():
+ *
+ *	trace-record FILE [INTERVAL_MS [SAMPLES]]
+ *
+ * Samples every second by default, until interrupted.  Every sample is
+ * flushed, so that the trace is usable whenever recording is stopped. */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <glib.h>
+
+#include "netdev.h"
+#include "trace.h"
+
+#define DEFAULT_INTERVAL	1000	/* ms */
+
+
+// Allow variable declarations at the first use.
+#pragma GCC diagnostic ignored "-Wdeclaration-after-statement"
+
+
+int main(int argc, char **argv)
+{
+	if (argc < 2 || argc > 4) {
+		fprintf(stderr, "Usage: %s FILE [INTERVAL_MS [SAMPLES]]\n", argv[0]);
+		return 2;
+	}
+
+	guint interval = (argc > 2) ? strtoul(argv[2], NULL, 10) : DEFAULT_INTERVAL;
+	guint samples = (argc > 3) ? strtoul(argv[3], NULL, 10) : 0;
+	if (interval == 0) interval = DEFAULT_INTERVAL;
+
+	FILE *out = fopen(argv[1], "w");
+	if (!out) {
+		fprintf(stderr, "Could not open %s: %s.\n", argv[1], g_strerror(errno));
+		return 1;
+	}
+	trace_write_header(out);
+
+	/* Interfaces that went down or away are still recorded, so that the
+	 * replay sees them change state. */
+	GHashTable *probes = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+						   (GDestroyNotify)netdev_probe_free);
+
+	for (guint n = 0; samples == 0 || n < samples; n++) {
+		if (n > 0) g_usleep(interval * 1000);
+
+		netdev_refresh();
+
+		GPtrArray *names = netdev_enumerate();
+		for (guint i = 0; names && i < names->len; i++) {
+			const gchar *name = g_ptr_array_index(names, i);
+			if (g_hash_table_contains(probes, name)) continue;
+
+			NetdevProbe *probe = netdev_probe_new(name);
+			netdev_probe_set_counters(probe, TRUE);
+			g_hash_table_insert(probes, probe->name, probe);
+		}
+		if (names) g_ptr_array_free(names, TRUE);
+
+		NetdevTime time;
+		netdev_get_time(&time);
+		trace_write_time(out, &time);
+
+		GHashTableIter iter;
+		NetdevProbe *probe;
+		g_hash_table_iter_init(&iter, probes);
+		while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&probe)) {
+			NetdevStats stats;
+			netdev_probe_read(probe, &stats);
+			trace_write_link(out, probe->ifindex, probe->name, &stats);
+		}
+
+		if (fflush(out) != 0) {
+			fprintf(stderr, "Could not write %s: %s.\n", argv[1], g_strerror(errno));
+			return 1;
+		}
+	}
+
+	g_hash_table_destroy(probes);
+	fclose(out);
+
+	return 0;
+}
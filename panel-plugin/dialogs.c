@@ -51,8 +51,20 @@ static void on_has_border_changed(GtkWidget *widget, NetgraphPlugin *this);
 static void on_bg_color_changed(GtkWidget *widget, NetgraphPlugin *this);
 static void on_rx_color_changed(GtkWidget *widget, NetgraphPlugin *this);
 static void on_tx_color_changed(GtkWidget *widget, NetgraphPlugin *this);
+static void on_drop_color_changed(GtkWidget *widget, NetgraphPlugin *this);
+static void on_stacked_changed(GtkWidget *widget, NetgraphPlugin *this);
+static void on_dev_colors_changed(GtkWidget *widget, NetgraphPlugin *this);
 static void on_update_interval_changed(GtkWidget *widget, NetgraphPlugin *this);
+static void on_adaptive_interval_changed(GtkWidget *widget, NetgraphPlugin *this);
 static void on_min_scale_changed(GtkWidget *widget, NetgraphPlugin *this);
+static void on_autoscale_changed(GtkWidget *widget, NetgraphPlugin *this);
+static void on_scale_mode_changed(GtkWidget *widget, NetgraphPlugin *this);
+static void on_graph_tier_changed(GtkWidget *widget, NetgraphPlugin *this);
+static void on_persist_history_changed(GtkWidget *widget, NetgraphPlugin *this);
+static void on_count_packets_changed(GtkWidget *widget, NetgraphPlugin *this);
+static void on_show_packets_changed(GtkWidget *widget, NetgraphPlugin *this);
+static void on_export_metrics_changed(GtkWidget *widget, NetgraphPlugin *this);
+static void on_compact_history_changed(GtkWidget *widget, NetgraphPlugin *this);
 static void on_monitor_devs_changed(GtkWidget *widget, NetgraphPlugin *this);
 static void on_dev_names_changed(GtkWidget *widget, NetgraphPlugin *this);
 static gboolean on_dev_names_timeout(NetgraphPlugin *this);
@@ -122,27 +134,85 @@ void netgraph_configure(XfcePanelPlugin *plugin, NetgraphPlugin *this)
 	g_signal_connect(object, "toggled", G_CALLBACK(on_has_border_changed), this);
 
 	object = gtk_builder_get_object(builder, "bg-color");
-	gtk_color_chooser_set_rgba(GTK_COLOR_CHOOSER(object), &this->bg_color);
+	gtk_color_chooser_set_rgba(GTK_COLOR_CHOOSER(object), &this->graph->bg_color);
 	g_signal_connect(object, "color-set", G_CALLBACK(on_bg_color_changed), this);
 
 	object = gtk_builder_get_object(builder, "rx-color");
-	gtk_color_chooser_set_rgba(GTK_COLOR_CHOOSER(object), &this->rx_color);
+	gtk_color_chooser_set_rgba(GTK_COLOR_CHOOSER(object), &this->graph->rx_color);
 	g_signal_connect(object, "color-set", G_CALLBACK(on_rx_color_changed), this);
 
 	object = gtk_builder_get_object(builder, "tx-color");
-	gtk_color_chooser_set_rgba(GTK_COLOR_CHOOSER(object), &this->tx_color);
+	gtk_color_chooser_set_rgba(GTK_COLOR_CHOOSER(object), &this->graph->tx_color);
 	g_signal_connect(object, "color-set", G_CALLBACK(on_tx_color_changed), this);
 
+	object = gtk_builder_get_object(builder, "drop-color");
+	gtk_color_chooser_set_rgba(GTK_COLOR_CHOOSER(object), &this->graph->drop_color);
+	g_signal_connect(object, "color-set", G_CALLBACK(on_drop_color_changed), this);
+
+	/* The colors of the interfaces only show when they're stacked. */
+	object = gtk_builder_get_object(builder, "stacked");
+	gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(object), this->graph->stacked);
+	g_signal_connect(object, "toggled", G_CALLBACK(on_stacked_changed), this);
+	GObject *dev_colors = gtk_builder_get_object(builder, "dev-colors");
+	gtk_entry_set_text(GTK_ENTRY(dev_colors), this->dev_colors ? this->dev_colors : "");
+	g_signal_connect(dev_colors, "changed", G_CALLBACK(on_dev_colors_changed), this);
+	g_object_bind_property(object, "active", dev_colors, "sensitive", G_BINDING_SYNC_CREATE);
+
 	object = gtk_builder_get_object(builder, "update-interval");
 	gtk_spin_button_set_value(GTK_SPIN_BUTTON(object), this->update_interval);
 	g_signal_connect(object, "value-changed",
 		G_CALLBACK(on_update_interval_changed), this);
 
+	object = gtk_builder_get_object(builder, "adaptive-interval");
+	gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(object), this->adaptive_interval);
+	g_signal_connect(object, "toggled",
+		G_CALLBACK(on_adaptive_interval_changed), this);
+
 	object = gtk_builder_get_object(builder, "min-scale");
-	gtk_spin_button_set_value(GTK_SPIN_BUTTON(object), this->min_scale / 1024);
+	gtk_spin_button_set_value(GTK_SPIN_BUTTON(object), this->graph->min_scale / 1024);
 	g_signal_connect(object, "value-changed",
 		G_CALLBACK(on_min_scale_changed), this);
 
+	object = gtk_builder_get_object(builder, "autoscale");
+	gtk_combo_box_set_active(GTK_COMBO_BOX(object), this->graph->autoscale);
+	g_signal_connect(object, "changed", G_CALLBACK(on_autoscale_changed), this);
+
+	object = gtk_builder_get_object(builder, "scale-mode");
+	gtk_combo_box_set_active(GTK_COMBO_BOX(object), this->graph->scale_mode);
+	g_signal_connect(object, "changed", G_CALLBACK(on_scale_mode_changed), this);
+
+	object = gtk_builder_get_object(builder, "graph-tier");
+	gtk_combo_box_set_active(GTK_COMBO_BOX(object), this->graph->tier);
+	g_signal_connect(object, "changed", G_CALLBACK(on_graph_tier_changed), this);
+
+	object = gtk_builder_get_object(builder, "persist-history");
+	gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(object), this->persist_history);
+	g_signal_connect(object, "toggled", G_CALLBACK(on_persist_history_changed), this);
+
+	object = gtk_builder_get_object(builder, "count-packets");
+	gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(object), this->count_packets);
+	g_signal_connect(object, "toggled", G_CALLBACK(on_count_packets_changed), this);
+
+	/* Packets can only be graphed while they're counted. */
+	GObject *show_packets = gtk_builder_get_object(builder, "show-packets");
+	gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(show_packets), this->graph->show_packets);
+	g_signal_connect(show_packets, "toggled", G_CALLBACK(on_show_packets_changed), this);
+	g_object_bind_property(object, "active", show_packets, "sensitive", G_BINDING_SYNC_CREATE);
+
+	object = gtk_builder_get_object(builder, "export-metrics");
+	gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(object), this->export_metrics);
+	g_autofree gchar *export_path = netgraph_get_export_path(this);
+	g_autofree gchar *export_tooltip = g_strdup_printf(
+		_("Serves the traffic to local agents at %s, in the Prometheus text "
+		  "format at /metrics, and as a binary snapshot at /snapshot."),
+		export_path);
+	gtk_widget_set_tooltip_text(GTK_WIDGET(object), export_tooltip);
+	g_signal_connect(object, "toggled", G_CALLBACK(on_export_metrics_changed), this);
+
+	object = gtk_builder_get_object(builder, "compact-history");
+	gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(object), this->compact_history);
+	g_signal_connect(object, "toggled", G_CALLBACK(on_compact_history_changed), this);
+
 	this->dev_names_entry = gtk_builder_get_object(builder, "dev-names");
 	object = gtk_builder_get_object(builder, "monitor-devs");
 	gtk_combo_box_set_active(GTK_COMBO_BOX(object), (this->dev_names != NULL));
@@ -190,34 +260,107 @@ static void on_has_border_changed(GtkWidget *widget, NetgraphPlugin *this)
 
 static void on_bg_color_changed(GtkWidget *widget, NetgraphPlugin *this)
 {
-	gtk_color_chooser_get_rgba(GTK_COLOR_CHOOSER(widget), &this->bg_color);
+	gtk_color_chooser_get_rgba(GTK_COLOR_CHOOSER(widget), &this->graph->bg_color);
 	netgraph_redraw(this);
 }
 
 static void on_rx_color_changed(GtkWidget *widget, NetgraphPlugin *this)
 {
-	gtk_color_chooser_get_rgba(GTK_COLOR_CHOOSER(widget), &this->rx_color);
+	gtk_color_chooser_get_rgba(GTK_COLOR_CHOOSER(widget), &this->graph->rx_color);
 	netgraph_redraw(this);
 }
 
 static void on_tx_color_changed(GtkWidget *widget, NetgraphPlugin *this)
 {
-	gtk_color_chooser_get_rgba(GTK_COLOR_CHOOSER(widget), &this->tx_color);
+	gtk_color_chooser_get_rgba(GTK_COLOR_CHOOSER(widget), &this->graph->tx_color);
+	netgraph_redraw(this);
+}
+
+static void on_drop_color_changed(GtkWidget *widget, NetgraphPlugin *this)
+{
+	gtk_color_chooser_get_rgba(GTK_COLOR_CHOOSER(widget), &this->graph->drop_color);
 	netgraph_redraw(this);
 }
 
+static void on_stacked_changed(GtkWidget *widget, NetgraphPlugin *this)
+{
+	netgraph_set_stacked(
+		this, gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(widget)));
+}
+
+static void on_dev_colors_changed(GtkWidget *widget, NetgraphPlugin *this)
+{
+	gboolean valid = netgraph_set_dev_colors(this, gtk_entry_get_text(GTK_ENTRY(widget)));
+	gtk_entry_set_icon_from_icon_name(GTK_ENTRY(widget), GTK_ENTRY_ICON_SECONDARY,
+					  valid ? NULL : "dialog-warning");
+}
+
 static void on_update_interval_changed(GtkWidget *widget, NetgraphPlugin *this)
 {
 	netgraph_set_update_interval(
 		this, gtk_spin_button_get_value(GTK_SPIN_BUTTON(widget)));
 }
 
+static void on_adaptive_interval_changed(GtkWidget *widget, NetgraphPlugin *this)
+{
+	netgraph_set_adaptive_interval(
+		this, gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(widget)));
+}
+
 static void on_min_scale_changed(GtkWidget *widget, NetgraphPlugin *this)
 {
 	netgraph_set_min_scale(
 		this, gtk_spin_button_get_value(GTK_SPIN_BUTTON(widget)) * 1024);
 }
 
+static void on_autoscale_changed(GtkWidget *widget, NetgraphPlugin *this)
+{
+	netgraph_set_autoscale(
+		this, gtk_combo_box_get_active(GTK_COMBO_BOX(widget)));
+}
+
+static void on_scale_mode_changed(GtkWidget *widget, NetgraphPlugin *this)
+{
+	netgraph_set_scale_mode(
+		this, gtk_combo_box_get_active(GTK_COMBO_BOX(widget)));
+}
+
+static void on_graph_tier_changed(GtkWidget *widget, NetgraphPlugin *this)
+{
+	netgraph_set_graph_tier(
+		this, gtk_combo_box_get_active(GTK_COMBO_BOX(widget)));
+}
+
+static void on_persist_history_changed(GtkWidget *widget, NetgraphPlugin *this)
+{
+	netgraph_set_persist_history(
+		this, gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(widget)));
+}
+
+static void on_count_packets_changed(GtkWidget *widget, NetgraphPlugin *this)
+{
+	netgraph_set_count_packets(
+		this, gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(widget)));
+}
+
+static void on_show_packets_changed(GtkWidget *widget, NetgraphPlugin *this)
+{
+	netgraph_set_show_packets(
+		this, gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(widget)));
+}
+
+static void on_export_metrics_changed(GtkWidget *widget, NetgraphPlugin *this)
+{
+	netgraph_set_export_metrics(
+		this, gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(widget)));
+}
+
+static void on_compact_history_changed(GtkWidget *widget, NetgraphPlugin *this)
+{
+	netgraph_set_compact_history(
+		this, gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(widget)));
+}
+
 static void on_monitor_devs_changed(GtkWidget *widget, NetgraphPlugin *this)
 {
 	if (gtk_combo_box_get_active(GTK_COMBO_BOX(widget))) {
@@ -0,0 +1,540 @@
+/*
+ *  Copyright (C) 2019 David Lazar <dlazar@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <glib-unix.h>
+
+#include "export.h"
+
+/* Connections beyond this are closed right away. */
+#define MAX_CLIENTS	8
+
+/* Clients that don't send a whole request, or don't read the whole
+ * response, by then are dropped. */
+#define CLIENT_TIMEOUT	10	/* seconds */
+
+#define MAX_REQUEST	4096	/* bytes */
+
+/* The snapshot is formatted this much at a time, as the socket takes it,
+ * so that a large one never holds up the main loop. */
+#define SNAPSHOT_CHUNK	(64 * 1024)	/* bytes */
+
+struct _Exporter {
+	gchar *path;
+	const Traffic *traffic;
+	int fd;
+	guint listen_id;
+	GPtrArray *clients;
+};
+
+typedef struct {
+	Exporter *exporter;
+	int fd;
+	guint io_id;
+	guint timeout_id;
+	GString *request;
+	GString *response;  /* NULL until the request was read. */
+	gsize sent;
+
+	/* The devices of a snapshot that are yet to be formatted, as they
+	 * were when it was requested. */
+	GArray *snapshot_ifindexes;
+	GPtrArray *snapshot_names;
+	guint snapshot_next;
+	gsize snapshot_hist_len;
+} Client;
+
+
+static gboolean on_accept(gint fd, GIOCondition condition, Exporter *this);
+static void client_free(Client *client);
+static gboolean on_client_timeout(Client *client);
+static gboolean on_client_readable(gint fd, GIOCondition condition, Client *client);
+static gboolean on_client_writable(gint fd, GIOCondition condition, Client *client);
+static gboolean client_write(Client *client);
+static gboolean client_refill(Client *client);
+static void respond(Client *client);
+static void format_metrics(GString *out, const Traffic *traffic);
+static void append_family(GString *out, const gchar *name, const gchar *type, const gchar *help);
+static void append_sample(GString *out, const gchar *name, const NetworkDevice *dev, guint64 value);
+static void start_snapshot(Client *client, const Traffic *traffic);
+static gsize get_snapshot_size(const Client *client);
+static void format_snapshot_header(GString *out, const Client *client,
+				   const Traffic *traffic);
+static void format_snapshot_dev(GString *out, const Client *client, guint i,
+				const Traffic *traffic);
+static guint64 get_sample(const History *hist, gsize age);
+static void append_u32(GString *out, guint32 value);
+static void append_u64(GString *out, guint64 value);
+
+
+// Allow variable declarations at the first use.
+#pragma GCC diagnostic ignored "-Wdeclaration-after-statement"
+
+
+Exporter *exporter_new(const gchar *path, const Traffic *traffic)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		g_warning("The socket path %s is too long.", path);
+		return NULL;
+	}
+	g_strlcpy(addr.sun_path, path, sizeof(addr.sun_path));
+
+	g_autofree gchar *dir = g_path_get_dirname(path);
+	if (g_mkdir_with_parents(dir, 0700) < 0) {
+		g_warning("Could not create %s: %s.", dir, g_strerror(errno));
+		return NULL;
+	}
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		g_warning("Could not create a socket: %s.", g_strerror(errno));
+		return NULL;
+	}
+
+	/* A socket left behind by a panel that crashed would fail the bind. */
+	g_unlink(path);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0
+	    || chmod(path, 0600) < 0
+	    || listen(fd, MAX_CLIENTS) < 0) {
+		g_warning("Could not listen on %s: %s.", path, g_strerror(errno));
+		close(fd);
+		return NULL;
+	}
+
+	Exporter *this = g_slice_new0(Exporter);
+	this->path = g_strdup(path);
+	this->traffic = traffic;
+	this->fd = fd;
+	this->listen_id = g_unix_fd_add(fd, G_IO_IN, (GUnixFDSourceFunc)on_accept, this);
+	this->clients = g_ptr_array_new();
+
+	return this;
+}
+
+void exporter_free(Exporter *this)
+{
+	while (this->clients->len > 0) {
+		client_free(g_ptr_array_index(this->clients, 0));
+	}
+	g_ptr_array_free(this->clients, TRUE);
+
+	g_source_remove(this->listen_id);
+	close(this->fd);
+	g_unlink(this->path);
+	g_free(this->path);
+
+	g_slice_free(Exporter, this);
+}
+
+static gboolean on_accept(gint fd, GIOCondition condition, Exporter *this)
+{
+	for (;;) {
+		int client_fd = accept(fd, NULL, NULL);
+		if (client_fd < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+				g_warning("Could not accept a connection on %s: %s.",
+					  this->path, g_strerror(errno));
+			}
+			break;
+		}
+
+		if (this->clients->len >= MAX_CLIENTS) {
+			close(client_fd);
+			continue;
+		}
+		fcntl(client_fd, F_SETFD, FD_CLOEXEC);
+		g_unix_set_fd_nonblocking(client_fd, TRUE, NULL);
+
+		Client *client = g_slice_new0(Client);
+		client->exporter = this;
+		client->fd = client_fd;
+		client->request = g_string_new("");
+		client->io_id = g_unix_fd_add(client_fd, G_IO_IN,
+			(GUnixFDSourceFunc)on_client_readable, client);
+		client->timeout_id = g_timeout_add_seconds(CLIENT_TIMEOUT,
+			(GSourceFunc)on_client_timeout, client);
+		g_ptr_array_add(this->clients, client);
+	}
+
+	return TRUE;
+}
+
+static void client_free(Client *client)
+{
+	if (client->io_id) g_source_remove(client->io_id);
+	if (client->timeout_id) g_source_remove(client->timeout_id);
+	close(client->fd);
+	g_string_free(client->request, TRUE);
+	if (client->response) g_string_free(client->response, TRUE);
+	if (client->snapshot_ifindexes) g_array_free(client->snapshot_ifindexes, TRUE);
+	if (client->snapshot_names) g_ptr_array_free(client->snapshot_names, TRUE);
+
+	g_ptr_array_remove_fast(client->exporter->clients, client);
+	g_slice_free(Client, client);
+}
+
+static gboolean on_client_timeout(Client *client)
+{
+	client->timeout_id = 0;
+	client_free(client);
+
+	return G_SOURCE_REMOVE;
+}
+
+static gboolean on_client_readable(gint fd, GIOCondition condition, Client *client)
+{
+	gchar buf[512];
+	gboolean eof = FALSE;
+	for (;;) {
+		gssize n = read(fd, buf, sizeof(buf));
+		if (n < 0 && errno == EINTR) continue;
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+		if (n == 0) {
+			eof = TRUE;
+			break;
+		}
+		if (n < 0 || client->request->len + n > MAX_REQUEST) {
+			client->io_id = 0;
+			client_free(client);
+			return G_SOURCE_REMOVE;
+		}
+		g_string_append_len(client->request, buf, n);
+	}
+
+	/* Only the request line matters, but the response can't be sent
+	 * before the whole request was read. */
+	if (!strstr(client->request->str, "\r\n\r\n")
+	    && !strstr(client->request->str, "\n\n")) {
+		if (!eof) return G_SOURCE_CONTINUE;
+
+		client->io_id = 0;
+		client_free(client);
+		return G_SOURCE_REMOVE;
+	}
+
+	client->io_id = 0;
+	respond(client);
+	if (client_write(client)) {
+		client->io_id = g_unix_fd_add(fd, G_IO_OUT,
+			(GUnixFDSourceFunc)on_client_writable, client);
+	}
+
+	return G_SOURCE_REMOVE;
+}
+
+static gboolean on_client_writable(gint fd, GIOCondition condition, Client *client)
+{
+	return client_write(client) ? G_SOURCE_CONTINUE : G_SOURCE_REMOVE;
+}
+
+/* Writes as much of the response as the socket takes.  Returns TRUE if
+ * there is more to write, otherwise frees the client. */
+static gboolean client_write(Client *client)
+{
+	GString *response = client->response;
+	while (client->sent < response->len || client_refill(client)) {
+		gssize n = send(client->fd, response->str + client->sent,
+				response->len - client->sent, MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR) continue;
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return TRUE;
+		if (n < 0) break;
+		client->sent += n;
+	}
+
+	/* The caller owns the I/O source, and removes it. */
+	client->io_id = 0;
+	client_free(client);
+	return FALSE;
+}
+
+/* Formats the next devices of a snapshot, once the response was sent.
+ * Returns FALSE if there are none left. */
+static gboolean client_refill(Client *client)
+{
+	if (!client->snapshot_names) return FALSE;
+
+	GString *response = client->response;
+	g_string_truncate(response, 0);
+	client->sent = 0;
+
+	const Traffic *traffic = client->exporter->traffic;
+	while (client->snapshot_next < client->snapshot_names->len
+	       && response->len < SNAPSHOT_CHUNK) {
+		format_snapshot_dev(response, client, client->snapshot_next++, traffic);
+	}
+	return response->len > 0;
+}
+
+static void respond(Client *client)
+{
+	g_autoptr(GString) body = g_string_new("");
+	const gchar *status = "200 OK";
+	const gchar *type = "text/plain; charset=utf-8";
+
+	gchar **words = g_strsplit(client->request->str, " ", 3);
+	if (g_strv_length(words) < 3 || strcmp(words[0], "GET") != 0) {
+		status = "405 Method Not Allowed";
+	} else if (strcmp(words[1], "/metrics") == 0) {
+		type = "text/plain; version=0.0.4; charset=utf-8";
+		format_metrics(body, client->exporter->traffic);
+	} else if (strcmp(words[1], "/snapshot") == 0) {
+		type = "application/octet-stream";
+		start_snapshot(client, client->exporter->traffic);
+	} else {
+		status = "404 Not Found";
+	}
+	g_strfreev(words);
+
+	/* Only the header of a snapshot is formatted here, and the devices
+	 * as it's being sent. */
+	gsize len = client->snapshot_names ? get_snapshot_size(client) : body->len;
+	client->response = g_string_sized_new(MIN(body->len, SNAPSHOT_CHUNK) + 128);
+	g_string_printf(client->response,
+			"HTTP/1.0 %s\r\n"
+			"Content-Type: %s\r\n"
+			"Content-Length: %" G_GSIZE_FORMAT "\r\n"
+			"Connection: close\r\n"
+			"\r\n",
+			status, type, len);
+	if (client->snapshot_names) {
+		format_snapshot_header(client->response, client, client->exporter->traffic);
+	} else {
+		g_string_append_len(client->response, body->str, body->len);
+	}
+}
+
+static void format_metrics(GString *out, const Traffic *traffic)
+{
+	static const struct {
+		const gchar *name;
+		const gchar *help;
+	} counters[NETDEV_N_COUNTERS] = {
+		[NETDEV_RX_PACKETS] = { "netgraph_receive_packets_total", "Packets received." },
+		[NETDEV_TX_PACKETS] = { "netgraph_transmit_packets_total", "Packets sent." },
+		[NETDEV_RX_DROPPED] = { "netgraph_receive_dropped_total", "Incoming packets dropped." },
+		[NETDEV_RX_ERRORS] = { "netgraph_receive_errors_total", "Receive errors." },
+		[NETDEV_TX_ERRORS] = { "netgraph_transmit_errors_total", "Transmit errors." },
+		[NETDEV_RX_MISSED_ERRORS] = { "netgraph_receive_missed_errors_total",
+					      "Incoming packets missed by the interface." },
+	};
+	GPtrArray *devs = traffic->devs;
+
+	append_family(out, "netgraph_interval_seconds", "gauge", "Time between samples.");
+	g_string_append_printf(out, "netgraph_interval_seconds %u.%03u\n",
+			       traffic->interval / 1000, traffic->interval % 1000);
+
+	append_family(out, "netgraph_up", "gauge", "Whether the interface is up.");
+	for (guint i = 0; i < devs->len; i++) {
+		NetworkDevice *dev = g_ptr_array_index(devs, i);
+		append_sample(out, "netgraph_up", dev, dev->down == 0);
+	}
+
+	append_family(out, "netgraph_receive_bytes_total", "counter", "Bytes received.");
+	for (guint i = 0; i < devs->len; i++) {
+		NetworkDevice *dev = g_ptr_array_index(devs, i);
+		append_sample(out, "netgraph_receive_bytes_total", dev, dev->rx_bytes);
+	}
+
+	append_family(out, "netgraph_transmit_bytes_total", "counter", "Bytes sent.");
+	for (guint i = 0; i < devs->len; i++) {
+		NetworkDevice *dev = g_ptr_array_index(devs, i);
+		append_sample(out, "netgraph_transmit_bytes_total", dev, dev->tx_bytes);
+	}
+
+	append_family(out, "netgraph_receive_bytes_per_second", "gauge",
+		      "Download rate over the last interval.");
+	for (guint i = 0; i < devs->len; i++) {
+		NetworkDevice *dev = g_ptr_array_index(devs, i);
+		append_sample(out, "netgraph_receive_bytes_per_second", dev,
+			      history_get(dev->hist_rx, 0));
+	}
+
+	append_family(out, "netgraph_transmit_bytes_per_second", "gauge",
+		      "Upload rate over the last interval.");
+	for (guint i = 0; i < devs->len; i++) {
+		NetworkDevice *dev = g_ptr_array_index(devs, i);
+		append_sample(out, "netgraph_transmit_bytes_per_second", dev,
+			      history_get(dev->hist_tx, 0));
+	}
+
+	if (traffic->agg_packets[0]) {
+		for (gint c = 0; c < NETDEV_N_COUNTERS; c++) {
+			append_family(out, counters[c].name, "counter", counters[c].help);
+			for (guint i = 0; i < devs->len; i++) {
+				NetworkDevice *dev = g_ptr_array_index(devs, i);
+				if (!dev->packets || !dev->packets->valid) continue;
+				append_sample(out, counters[c].name, dev, dev->packets->counters[c]);
+			}
+		}
+	}
+
+	/* The recent history, summed over all the devices. */
+	static const gchar *const quantiles[] = { "0.5", "0.95", "0.99", "1" };
+	for (gint dir = 0; dir < 2; dir++) {
+		const gchar *name = (dir == 0) ? "netgraph_graph_receive_bytes_per_second"
+					       : "netgraph_graph_transmit_bytes_per_second";
+		History *hist = (dir == 0) ? traffic->agg_rx : traffic->agg_tx;
+		append_family(out, name, "summary",
+			      (dir == 0) ? "Distribution of the total download rate over the graph."
+					 : "Distribution of the total upload rate over the graph.");
+		for (gsize i = 0; i < G_N_ELEMENTS(quantiles); i++) {
+			guint64 value = (i == G_N_ELEMENTS(quantiles) - 1)
+				? history_max(hist)
+				: history_quantile(hist, g_ascii_strtod(quantiles[i], NULL));
+			g_string_append_printf(out, "%s{quantile=\"%s\"} %" G_GUINT64_FORMAT "\n",
+					       name, quantiles[i], value);
+		}
+
+		/* Over the samples of the graph, which only fills up after
+		 * a while. */
+		gsize count = MIN(traffic->updates, hist->len);
+		guint64 sum = 0;
+		for (gsize age = 0; age < count; age++) {
+			sum += history_get(hist, age);
+		}
+		g_string_append_printf(out, "%s_sum %" G_GUINT64_FORMAT "\n", name, sum);
+		g_string_append_printf(out, "%s_count %" G_GSIZE_FORMAT "\n", name, count);
+	}
+}
+
+static void append_family(GString *out, const gchar *name, const gchar *type, const gchar *help)
+{
+	g_string_append_printf(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+static void append_sample(GString *out, const gchar *name, const NetworkDevice *dev, guint64 value)
+{
+	g_string_append(out, name);
+	g_string_append(out, "{device=\"");
+	for (const gchar *p = dev->name; *p; p++) {
+		if (*p == '\\' || *p == '"') {
+			g_string_append_c(out, '\\');
+			g_string_append_c(out, *p);
+		} else if (*p == '\n') {
+			g_string_append(out, "\\n");
+		} else {
+			g_string_append_c(out, *p);
+		}
+	}
+	g_string_append_printf(out, "\"} %" G_GUINT64_FORMAT "\n", value);
+}
+
+/* Keeps the devices as they are now, which the response is made of, even if
+ * some of them are gone by the time they're formatted. */
+static void start_snapshot(Client *client, const Traffic *traffic)
+{
+	GPtrArray *devs = traffic->devs;
+	client->snapshot_ifindexes = g_array_sized_new(FALSE, FALSE, sizeof(gint), devs->len);
+	client->snapshot_names = g_ptr_array_new_full(devs->len, g_free);
+	client->snapshot_next = 0;
+	client->snapshot_hist_len = traffic->hist_len;
+
+	for (guint i = 0; i < devs->len; i++) {
+		NetworkDevice *dev = g_ptr_array_index(devs, i);
+		g_array_append_val(client->snapshot_ifindexes, dev->ifindex);
+		g_ptr_array_add(client->snapshot_names, g_strdup(dev->name));
+	}
+}
+
+static gsize get_snapshot_size(const Client *client)
+{
+	gsize size = 4 + 3 * sizeof(guint32) + sizeof(guint64);
+	for (guint i = 0; i < client->snapshot_names->len; i++) {
+		size += 3 * sizeof(guint32)
+			+ strlen(g_ptr_array_index(client->snapshot_names, i))
+			+ (2 + NETDEV_N_COUNTERS + 2 * client->snapshot_hist_len) * sizeof(guint64);
+	}
+	return size;
+}
+
+static void format_snapshot_header(GString *out, const Client *client,
+				   const Traffic *traffic)
+{
+	g_string_append_len(out, EXPORT_MAGIC, 4);
+	append_u32(out, client->snapshot_names->len);
+	append_u32(out, traffic->interval);
+	append_u32(out, client->snapshot_hist_len);
+	append_u64(out, traffic->last_update);
+}
+
+/* Formats the device at `i` in the snapshot as it is now, or as down with
+ * zeroes if it was removed since the snapshot was requested. */
+static void format_snapshot_dev(GString *out, const Client *client, guint i,
+				const Traffic *traffic)
+{
+	const gchar *name = g_ptr_array_index(client->snapshot_names, i);
+	gint ifindex = g_array_index(client->snapshot_ifindexes, gint, i);
+	gsize hist_len = client->snapshot_hist_len;
+
+	NetworkDevice *dev = traffic_find(traffic, ifindex, name);
+	gboolean up = dev && dev->down == 0;
+	gboolean packets = dev && dev->packets && dev->packets->valid;
+
+	append_u32(out, ifindex);
+	append_u32(out, (up ? EXPORT_FLAG_UP : 0) | (packets ? EXPORT_FLAG_PACKETS : 0));
+	gsize name_len = strlen(name);
+	append_u32(out, name_len);
+	g_string_append_len(out, name, name_len);
+
+	append_u64(out, dev ? dev->rx_bytes : 0);
+	append_u64(out, dev ? dev->tx_bytes : 0);
+	for (gint c = 0; c < NETDEV_N_COUNTERS; c++) {
+		append_u64(out, packets ? dev->packets->counters[c] : 0);
+	}
+
+	for (gsize age = 0; age < hist_len; age++) {
+		append_u64(out, dev ? get_sample(dev->hist_rx, age) : 0);
+	}
+	for (gsize age = 0; age < hist_len; age++) {
+		append_u64(out, dev ? get_sample(dev->hist_tx, age) : 0);
+	}
+}
+
+/* The histories may have been resized since the snapshot was requested. */
+static guint64 get_sample(const History *hist, gsize age)
+{
+	return (age < hist->len) ? history_get(hist, age) : 0;
+}
+
+static void append_u32(GString *out, guint32 value)
+{
+	value = GUINT32_TO_LE(value);
+	g_string_append_len(out, (const gchar *)&value, sizeof(value));
+}
+
+static void append_u64(GString *out, guint64 value)
+{
+	value = GUINT64_TO_LE(value);
+	g_string_append_len(out, (const gchar *)&value, sizeof(value));
+}
@@ -0,0 +1,76 @@
+/*
+ *  Copyright (C) 2019 David Lazar <dlazar@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __EXPORT_H__
+#define __EXPORT_H__
+
+#include <glib.h>
+
+#include "traffic.h"
+
+G_BEGIN_DECLS
+
+/* Serves the traffic on a Unix socket, over HTTP, so that local agents can
+ * scrape it instead of reading the counters again:
+ *
+ *	curl --unix-socket PATH http://localhost/metrics
+ *
+ * GET /metrics answers in the Prometheus text format, with the counters and
+ * current rates of every device, and the distribution of the total over the
+ * graph.  GET /snapshot answers with the histories too, in the binary
+ * layout below.  The responses are built from the main loop and written
+ * without blocking, so a slow reader only ever holds up itself.  A snapshot
+ * is formatted a chunk at a time, as the socket takes it, so the devices
+ * are those of the time it was requested, but each of them is as it was
+ * when its chunk was formatted, and one that was removed meanwhile is down,
+ * with zeroes. */
+typedef struct _Exporter Exporter;
+
+/* The snapshot is little-endian, and starts with a header:
+ *
+ *	char magic[4]		"NGS1"
+ *	u32 n_devs
+ *	u32 interval		milliseconds between samples
+ *	u32 hist_len		samples per history
+ *	i64 time		of the last update, monotonic microseconds
+ *
+ * followed by every device:
+ *
+ *	i32 ifindex		0 if not known
+ *	u32 flags		EXPORT_FLAG_*
+ *	u32 name_len
+ *	char name[name_len]	not NUL-terminated
+ *	u64 rx_bytes		counters
+ *	u64 tx_bytes
+ *	u64 counters[6]		NetdevCounter order, zeroes without packets
+ *	u64 rx[hist_len]	bytes per second, the newest first
+ *	u64 tx[hist_len] */
+#define EXPORT_MAGIC		"NGS1"
+#define EXPORT_FLAG_UP		(1 << 0)
+#define EXPORT_FLAG_PACKETS	(1 << 1)
+
+/* Listens on `path`, replacing whatever socket was left there.  Returns NULL
+ * on errors. */
+Exporter *exporter_new(const gchar *path, const Traffic *traffic);
+
+/* Drops the clients and removes the socket. */
+void exporter_free(Exporter *this);
+
+G_END_DECLS
+
+#endif  /* __EXPORT_H__ */
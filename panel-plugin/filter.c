@@ -0,0 +1,116 @@
+/*
+ *  Copyright (C) 2019 David Lazar <dlazar@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "filter.h"
+
+#include <string.h>
+#include <glib.h>
+
+static gboolean match_any(GPtrArray *patterns, const gchar *name);
+static void pattern_spec_free(gpointer spec);
+
+
+// Allow variable declarations at the first use.
+#pragma GCC diagnostic ignored "-Wdeclaration-after-statement"
+
+
+Filter *filter_new(const gchar *list)
+{
+	if (!list) return NULL;
+
+	Filter *this = g_slice_new0(Filter);
+	this->names = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	this->patterns = g_ptr_array_new_with_free_func(pattern_spec_free);
+	this->excluded_names = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	this->excluded_patterns = g_ptr_array_new_with_free_func(pattern_spec_free);
+
+	gboolean empty = TRUE;
+	g_auto(GStrv) parts = g_strsplit_set(list, ", \t\r\n", -1);
+	for (gsize i = 0; parts[i] != NULL; i++) {
+		const gchar *entry = parts[i];
+		gboolean exclude = (*entry == '!');
+		if (exclude) entry++;
+		if (*entry == '\0') continue;
+
+		empty = FALSE;
+		if (strpbrk(entry, "*?")) {
+			g_ptr_array_add(exclude ? this->excluded_patterns : this->patterns,
+					g_pattern_spec_new(entry));
+		} else {
+			g_hash_table_add(exclude ? this->excluded_names : this->names,
+					 g_strdup(entry));
+		}
+	}
+
+	if (empty) {
+		filter_free(this);
+		return NULL;
+	}
+	return this;
+}
+
+void filter_free(Filter *this)
+{
+	if (!this) return;
+
+	g_hash_table_destroy(this->names);
+	g_ptr_array_free(this->patterns, TRUE);
+	g_hash_table_destroy(this->excluded_names);
+	g_ptr_array_free(this->excluded_patterns, TRUE);
+
+	g_slice_free(Filter, this);
+}
+
+gboolean filter_is_fixed(const Filter *this)
+{
+	return this->patterns->len == 0
+		&& g_hash_table_size(this->excluded_names) == 0
+		&& this->excluded_patterns->len == 0;
+}
+
+gboolean filter_match(const Filter *this, const gchar *name)
+{
+	if (g_hash_table_contains(this->excluded_names, name)) return FALSE;
+	if (match_any(this->excluded_patterns, name)) return FALSE;
+
+	/* Only exclusions, so everything else is in. */
+	if (g_hash_table_size(this->names) == 0 && this->patterns->len == 0)
+		return TRUE;
+
+	return g_hash_table_contains(this->names, name)
+		|| match_any(this->patterns, name);
+}
+
+static gboolean match_any(GPtrArray *patterns, const gchar *name)
+{
+	for (guint i = 0; i < patterns->len; i++) {
+#if GLIB_CHECK_VERSION(2, 70, 0)
+		if (g_pattern_spec_match_string(g_ptr_array_index(patterns, i), name))
+			return TRUE;
+#else
+		if (g_pattern_match_string(g_ptr_array_index(patterns, i), name))
+			return TRUE;
+#endif
+	}
+	return FALSE;
+}
+
+static void pattern_spec_free(gpointer spec)
+{
+	g_pattern_spec_free(spec);
+}
@@ -0,0 +1,51 @@
+/*
+ *  Copyright (C) 2019 David Lazar <dlazar@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __FILTER_H__
+#define __FILTER_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Picks the interfaces to monitor, from a list of names and glob patterns
+ * such as `veth*`, separated by commas or whitespace.  Entries that start
+ * with `!` exclude the interfaces they match, and a list of exclusions
+ * alone keeps all the other interfaces.  The list is compiled once, with
+ * the plain names looked up in hash tables, so matching stays cheap on
+ * hosts with thousands of interfaces. */
+typedef struct {
+	GHashTable *names;  /* Included by name. */
+	GPtrArray *patterns;  /* GPatternSpec, included. */
+	GHashTable *excluded_names;
+	GPtrArray *excluded_patterns;
+} Filter;
+
+/* Returns NULL if `list` has no entries, which means all interfaces. */
+Filter *filter_new(const gchar *list);
+void filter_free(Filter *this);
+
+/* Whether the filter names exactly the interfaces to monitor, which can be
+ * watched even before they exist, rather than matching the ones found. */
+gboolean filter_is_fixed(const Filter *this);
+
+gboolean filter_match(const Filter *this, const gchar *name);
+
+G_END_DECLS
+
+#endif  /* __FILTER_H__ */
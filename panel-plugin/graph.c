@@ -0,0 +1,622 @@
+/*
+ *  Copyright (C) 2019 David Lazar <dlazar@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "graph.h"
+
+#include <math.h>
+#include <string.h>
+#include <glib.h>
+#include <cairo.h>
+
+/* The packet rate below which the graph doesn't zoom in. */
+#define MIN_PACKET_SCALE	10	/* packets/s */
+
+/* The size of the height lookup table, in buckets per pixel. */
+#define SEGS_PER_PIXEL	4
+
+#define RGB(r, g, b)	{ (r) / 255.0, (g) / 255.0, (b) / 255.0, 1.0 }
+
+/* For the devices that weren't given a color, from the Tango palette. */
+static const GdkRGBA palette[] = {
+	RGB(0x34, 0x65, 0xa4),  /* Sky Blue */
+	RGB(0x73, 0xd2, 0x16),  /* Chameleon */
+	RGB(0xf5, 0x79, 0x00),  /* Orange */
+	RGB(0x75, 0x50, 0x7b),  /* Plum */
+	RGB(0xed, 0xd4, 0x00),  /* Butter */
+	RGB(0xcc, 0x00, 0x00),  /* Scarlet Red */
+	RGB(0xc1, 0x7d, 0x11),  /* Chocolate */
+	RGB(0x88, 0x8a, 0x85),  /* Aluminium */
+};
+
+static gboolean is_current(Graph *this, guint w, guint h);
+static void render(Graph *this, guint w, guint h);
+static gboolean column_is_blank(Graph *this, gsize age, guint h);
+static void draw_columns(Graph *this, guint x0, guint x1, guint w, guint h);
+static void draw_stacked_columns(Graph *this, guint x0, guint x1, guint w, guint h);
+static void update_stack(Graph *this);
+static void sum_stack_column(Graph *this, gsize age);
+static gboolean shows_packets(const Graph *this);
+static void get_column(Graph *this, gsize age, guint h,
+		       guint32 *rx_seg, guint32 *tx_seg, guint32 *drop_seg);
+static guint64 get_points(Graph *this);
+static guint get_generation(const Graph *this);
+static guint64 get_sample(Graph *this, History *hist, Rrd *rrd, gsize age);
+static void update_thresholds(Graph *this, guint h);
+static gdouble get_fraction(ScaleMode mode, guint64 scale, guint64 value);
+static guint get_height(ScaleMode mode, guint64 scale, guint64 value, guint h);
+static guint32 get_seg(Graph *this, guint64 value, guint h);
+static guint32 get_bucket(guint64 value, guint bits);
+static guint64 get_bucket_start(guint32 bucket, guint bits);
+
+
+// Allow variable declarations at the first use.
+#pragma GCC diagnostic ignored "-Wdeclaration-after-statement"
+
+
+Graph *graph_new(const Traffic *traffic)
+{
+	Graph *this = g_slice_new0(Graph);
+	this->traffic = traffic;
+	this->dev_colors = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+						 (GDestroyNotify)gdk_rgba_free);
+
+	return this;
+}
+
+void graph_free(Graph *this)
+{
+	if (this->surface) cairo_surface_destroy(this->surface);
+	g_free(this->thresholds);
+	g_free(this->segs);
+	g_hash_table_destroy(this->dev_colors);
+	g_free(this->stack_rx);
+	g_free(this->stack_tx);
+
+	g_slice_free(Graph, this);
+}
+
+gboolean graph_set_dev_colors(Graph *this, const gchar *list)
+{
+	g_hash_table_remove_all(this->dev_colors);
+	if (!list) return TRUE;
+
+	gboolean valid = TRUE;
+	const gchar *p = list;
+	while (*p) {
+		/* Split at the commas, except those within a color such as
+		 * rgb(1,2,3). */
+		const gchar *end = p;
+		gint depth = 0;
+		for (; *end && (depth > 0 || *end != ','); end++) {
+			if (*end == '(') depth++;
+			else if (*end == ')' && depth > 0) depth--;
+		}
+		g_autofree gchar *entry = g_strndup(p, end - p);
+		p = *end ? end + 1 : end;
+
+		g_strstrip(entry);
+		if (!*entry) continue;
+
+		gchar *color_str = strchr(entry, '=');
+		GdkRGBA color;
+		if (!color_str) {
+			valid = FALSE;
+			continue;
+		}
+		*color_str++ = '\0';
+		g_strstrip(entry);
+		g_strstrip(color_str);
+		if (!*entry || !gdk_rgba_parse(&color, color_str)) {
+			valid = FALSE;
+			continue;
+		}
+
+		g_hash_table_replace(this->dev_colors, g_strdup(entry), gdk_rgba_copy(&color));
+	}
+
+	return valid;
+}
+
+void graph_get_dev_color(const Graph *this, gsize index, GdkRGBA *color)
+{
+	const NetworkDevice *dev = g_ptr_array_index(this->traffic->devs, index);
+	const GdkRGBA *found = g_hash_table_lookup(this->dev_colors, dev->name);
+
+	*color = found ? *found : palette[index % G_N_ELEMENTS(palette)];
+}
+
+guint64 graph_scale_value(ScaleMode mode, guint64 scale, gdouble fraction)
+{
+	gdouble top = MAX(scale, 1);
+	gdouble value;
+	switch (mode) {
+	case SCALE_SQRT:
+		value = top * fraction * fraction;
+		break;
+	case SCALE_LOG:
+		value = expm1(fraction * log1p(top));
+		break;
+	default:
+		value = top * fraction;
+		break;
+	}
+
+	/* A scale close to G_MAXUINT64 rounds up to 2^64 as a double, which
+	 * doesn't fit back. */
+	value = CLAMP(value, 0, top);
+	if (value >= (gdouble)G_MAXUINT64) return scale;
+
+	return (guint64)value;
+}
+
+void graph_invalidate(Graph *this)
+{
+	this->dirty = TRUE;
+}
+
+void graph_update_scale(Graph *this)
+{
+	const Traffic *traffic = this->traffic;
+	gboolean packets = shows_packets(this);
+	History *agg_rx = packets ? traffic->agg_packets[NETDEV_SERIES_RX_PACKETS] : traffic->agg_rx;
+	History *agg_tx = packets ? traffic->agg_packets[NETDEV_SERIES_TX_PACKETS] : traffic->agg_tx;
+	this->scale = 0;
+
+	if (this->tier != GRAPH_TIER_RAW) {
+		/* The consolidated points are averages, which already smooth
+		 * the spikes out. */
+		RrdTierId tier = this->tier - GRAPH_TIER_MINUTE;
+		Rrd *rrd_rx = packets ? traffic->agg_rrd_packets[NETDEV_SERIES_RX_PACKETS] : traffic->agg_rrd_rx;
+		Rrd *rrd_tx = packets ? traffic->agg_rrd_packets[NETDEV_SERIES_TX_PACKETS] : traffic->agg_rrd_tx;
+		this->scale = rrd_peak(rrd_rx, tier) + rrd_peak(rrd_tx, tier);
+	} else if (this->autoscale == AUTOSCALE_DEVICE_PEAKS) {
+		for (gsize i = 0; i < traffic->devs->len; i++) {
+			NetworkDevice *dev = g_ptr_array_index(traffic->devs, i);
+			if (packets) {
+				this->scale += history_max(dev->packets->hist[NETDEV_SERIES_RX_PACKETS])
+					+ history_max(dev->packets->hist[NETDEV_SERIES_TX_PACKETS]);
+			} else {
+				this->scale += history_max(dev->hist_rx) + history_max(dev->hist_tx);
+			}
+		}
+	} else if (this->autoscale == AUTOSCALE_PEAK) {
+		this->scale = history_max(agg_rx) + history_max(agg_tx);
+	} else {
+		gdouble q = (this->autoscale == AUTOSCALE_P99) ? 0.99 : 0.95;
+		this->scale = history_quantile(agg_rx, q) + history_quantile(agg_tx, q);
+	}
+
+	guint64 min_scale = packets ? MIN_PACKET_SCALE : this->min_scale;
+	if (this->scale < min_scale) this->scale = min_scale;
+}
+
+gboolean graph_changed(Graph *this, guint w, guint h)
+{
+	if (w == 0 || h == 0) return FALSE;
+	if (!is_current(this, w, h)) return TRUE;
+
+	guint64 advance = get_points(this) - this->points;
+	if (advance == 0) return FALSE;
+
+	/* Scrolling blank columns into a blank graph changes nothing. */
+	if (this->blank < w) return TRUE;
+	for (gsize age = 0; age < MIN(advance, w); age++) {
+		if (!column_is_blank(this, age, h)) return TRUE;
+	}
+
+	this->points += advance;
+	return FALSE;
+}
+
+/* Moves the cached graph one column to the left, and draws the newest
+ * point in the last column.  Falls back to a full repaint on the next
+ * draw if anything else changed. */
+void graph_scroll(Graph *this, guint w, guint h)
+{
+	guint64 points = get_points(this);
+	guint64 advance = points - this->points;
+	this->points = points;
+
+	/* The minute and hour graphs don't move on every update. */
+	if (advance == 0) return;
+
+	if (advance > 1 || !is_current(this, w, h)) {
+		this->dirty = TRUE;
+		return;
+	}
+
+	cairo_surface_flush(this->surface);
+	guchar *data = cairo_image_surface_get_data(this->surface);
+	int stride = cairo_image_surface_get_stride(this->surface);
+	for (guint y = 0; y < h; y++) {
+		guchar *row = data + y * stride;
+		memmove(row, row + 4, (w - 1) * 4);
+	}
+	cairo_surface_mark_dirty(this->surface);
+
+	draw_columns(this, w - 1, w, w, h);
+
+	if (!column_is_blank(this, 0, h)) this->blank = 0;
+	else if (this->blank < w) this->blank++;
+}
+
+void graph_draw(Graph *this, cairo_t *cr, guint w, guint h)
+{
+	if (w == 0 || h == 0) return;
+
+	if (!is_current(this, w, h)) render(this, w, h);
+	this->redraws++;
+
+	cairo_set_source_surface(cr, this->surface, 0, 0);
+	cairo_rectangle(cr, 0, 0, w, h);
+	cairo_fill(cr);
+}
+
+/* Returns whether the cached surface can be reused as it is. */
+static gboolean is_current(Graph *this, guint w, guint h)
+{
+	return this->surface != NULL
+		&& !this->dirty
+		&& this->surface_scale == this->scale
+		&& this->surface_generation == get_generation(this)
+		&& (guint)cairo_image_surface_get_width(this->surface) == w
+		&& (guint)cairo_image_surface_get_height(this->surface) == h;
+}
+
+static void render(Graph *this, guint w, guint h)
+{
+	if (this->surface
+	    && ((guint)cairo_image_surface_get_width(this->surface) != w
+		|| (guint)cairo_image_surface_get_height(this->surface) != h)) {
+		cairo_surface_destroy(this->surface);
+		this->surface = NULL;
+	}
+	if (!this->surface) {
+		this->surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, w, h);
+	}
+
+	/* The colors may have changed. */
+	render_style_init(&this->style, &this->bg_color, &this->rx_color,
+			  &this->tx_color, &this->drop_color);
+
+	draw_columns(this, 0, w, w, h);
+
+	this->blank = 0;
+	while (this->blank < w && column_is_blank(this, this->blank, h)) {
+		this->blank++;
+	}
+
+	this->surface_scale = this->scale;
+	this->surface_generation = get_generation(this);
+	this->points = get_points(this);
+	this->dirty = FALSE;
+}
+
+static gboolean column_is_blank(Graph *this, gsize age, guint h)
+{
+	guint32 rx_seg, tx_seg, drop_seg;
+	get_column(this, age, h, &rx_seg, &tx_seg, &drop_seg);
+
+	return rx_seg == 0 && tx_seg == 0 && drop_seg == 0;
+}
+
+/* Paints columns [x0, x1) of a graph that is w x h pixels large. */
+static void draw_columns(Graph *this, guint x0, guint x1, guint w, guint h)
+{
+	const Traffic *traffic = this->traffic;
+	guint n = x1 - x0;
+
+	if (this->stacked) {
+		draw_stacked_columns(this, x0, x1, w, h);
+		return;
+	}
+
+	/* Scrolling only draws one column, so avoid allocating for that. */
+	guint32 one_column[3];
+	g_autofree guint32 *columns = NULL;
+	guint32 *rx_seg = one_column;
+	if (n > 1) {
+		columns = g_new(guint32, 3 * n);
+		rx_seg = columns;
+	}
+	guint32 *tx_seg = rx_seg + n;
+	guint32 *drop_seg = tx_seg + n;
+
+	for (guint i = 0; i < n; i++) {
+		gsize age = w - 1 - (x0 + i);
+		get_column(this, age, h, &rx_seg[i], &tx_seg[i], &drop_seg[i]);
+	}
+
+	/* Without the packet counters, there's no drop overlay to draw. */
+	render_columns_pixels(this->surface, &this->style, rx_seg, tx_seg,
+			      traffic->agg_packets[0] ? drop_seg : NULL, x0, x1);
+}
+
+static void draw_stacked_columns(Graph *this, guint x0, guint x1, guint w, guint h)
+{
+	update_stack(this);
+	update_thresholds(this, h);
+
+	guint n = x1 - x0;
+	gsize n_devs = this->stack_n_devs;
+	g_autofree guint32 *colors = g_new(guint32, n_devs);
+	for (gsize i = 0; i < n_devs; i++) {
+		GdkRGBA color;
+		graph_get_dev_color(this, i, &color);
+		colors[i] = render_premultiply(&color);
+	}
+
+	/* Only the running totals need to be mapped to pixels. */
+	g_autofree guint32 *rx_bounds = g_new(guint32, 2 * n * n_devs);
+	guint32 *tx_bounds = rx_bounds + n * n_devs;
+	for (guint i = 0; i < n; i++) {
+		gsize age = w - 1 - (x0 + i);
+		gsize slot = (this->stack_head + this->stack_len - age) % this->stack_len;
+		const guint64 *rx = this->stack_rx + slot * n_devs;
+		const guint64 *tx = this->stack_tx + slot * n_devs;
+		for (gsize k = 0; k < n_devs; k++) {
+			rx_bounds[i * n_devs + k] = get_seg(this, rx[k], h);
+			tx_bounds[i * n_devs + k] = get_seg(this, tx[k], h);
+		}
+	}
+
+	render_stacked_pixels(this->surface, &this->style, colors, n_devs,
+			      rx_bounds, tx_bounds, x0, x1);
+}
+
+/* Adds up the columns of the new points, or all of them if anything else
+ * changed, in which case the graph needs a full repaint. */
+static void update_stack(Graph *this)
+{
+	const Traffic *traffic = this->traffic;
+	GPtrArray *devs = traffic->devs;
+	gsize len = traffic->hist_len;
+	guint64 points = get_points(this);
+	gboolean packets = shows_packets(this);
+	if (len == 0) return;
+
+	gboolean same = this->stack_valid
+		&& this->stack_len == len
+		&& this->stack_generation == get_generation(this)
+		&& this->stack_tier == this->tier
+		&& this->stack_packets == packets
+		&& this->stack_devs_generation == traffic->devs_generation;
+	guint64 advance = points - this->stack_points;
+	if (same && advance == 0) return;
+
+	gsize n_columns;
+	if (same) {
+		n_columns = MIN(advance, len);
+		this->stack_head = (this->stack_head + advance) % len;
+	} else {
+		g_free(this->stack_rx);
+		g_free(this->stack_tx);
+		this->stack_rx = g_new(guint64, len * devs->len);
+		this->stack_tx = g_new(guint64, len * devs->len);
+		this->stack_len = len;
+		this->stack_head = 0;
+		this->stack_n_devs = devs->len;
+		this->stack_devs_generation = traffic->devs_generation;
+		this->stack_generation = get_generation(this);
+		this->stack_tier = this->tier;
+		this->stack_packets = packets;
+		this->stack_valid = TRUE;
+		this->dirty = TRUE;
+		n_columns = len;
+	}
+
+	for (gsize age = 0; age < n_columns; age++) {
+		sum_stack_column(this, age);
+	}
+	this->stack_points = points;
+}
+
+static void sum_stack_column(Graph *this, gsize age)
+{
+	GPtrArray *devs = this->traffic->devs;
+	gsize slot = (this->stack_head + this->stack_len - age) % this->stack_len;
+	guint64 *rx = this->stack_rx + slot * devs->len;
+	guint64 *tx = this->stack_tx + slot * devs->len;
+
+	guint64 rx_total = 0, tx_total = 0;
+	for (gsize i = 0; i < devs->len; i++) {
+		NetworkDevice *dev = g_ptr_array_index(devs, i);
+		if (this->stack_packets) {
+			History *const *hist = dev->packets->hist;
+			Rrd *const *rrd = dev->packets->rrd;
+			rx_total += get_sample(this, hist[NETDEV_SERIES_RX_PACKETS],
+					       rrd[NETDEV_SERIES_RX_PACKETS], age);
+			tx_total += get_sample(this, hist[NETDEV_SERIES_TX_PACKETS],
+					       rrd[NETDEV_SERIES_TX_PACKETS], age);
+		} else {
+			rx_total += get_sample(this, dev->hist_rx, dev->rrd_rx, age);
+			tx_total += get_sample(this, dev->hist_tx, dev->rrd_tx, age);
+		}
+		rx[i] = rx_total;
+		tx[i] = tx_total;
+	}
+}
+
+static gboolean shows_packets(const Graph *this)
+{
+	return this->show_packets && this->traffic->agg_packets[0] != NULL;
+}
+
+/* Returns the heights of the bars in a column, in pixels. */
+static void get_column(Graph *this, gsize age, guint h,
+		       guint32 *rx_seg, guint32 *tx_seg, guint32 *drop_seg)
+{
+	const Traffic *traffic = this->traffic;
+	History *const *hist = traffic->agg_packets;
+	Rrd *const *rrd = traffic->agg_rrd_packets;
+	update_thresholds(this, h);
+
+	guint64 rx, tx;
+	if (shows_packets(this)) {
+		rx = get_sample(this, hist[NETDEV_SERIES_RX_PACKETS], rrd[NETDEV_SERIES_RX_PACKETS], age);
+		tx = get_sample(this, hist[NETDEV_SERIES_TX_PACKETS], rrd[NETDEV_SERIES_TX_PACKETS], age);
+	} else {
+		rx = get_sample(this, traffic->agg_rx, traffic->agg_rrd_rx, age);
+		tx = get_sample(this, traffic->agg_tx, traffic->agg_rrd_tx, age);
+	}
+	*rx_seg = get_seg(this, rx, h);
+	*tx_seg = get_seg(this, tx, h);
+
+	*drop_seg = 0;
+	if (!hist[0]) return;
+
+	guint64 drops = get_sample(this, hist[NETDEV_SERIES_DROPS], rrd[NETDEV_SERIES_DROPS], age);
+	if (drops == 0) return;
+
+	/* The share of the incoming packets that were dropped, out of the
+	 * download bar, but at least a pixel, so that no drop goes
+	 * unnoticed. */
+	guint64 received = get_sample(this, hist[NETDEV_SERIES_RX_PACKETS],
+				      rrd[NETDEV_SERIES_RX_PACKETS], age);
+	guint32 seg = (guint32)(*rx_seg * ((gdouble)drops / (gdouble)(drops + received)));
+	*drop_seg = CLAMP(seg, 1, h);
+}
+
+/* Returns the number of points added so far to the series being shown. */
+static guint64 get_points(Graph *this)
+{
+	if (this->tier == GRAPH_TIER_RAW) return this->traffic->updates;
+
+	return rrd_count(this->traffic->agg_rrd_rx, this->tier - GRAPH_TIER_MINUTE);
+}
+
+/* Changes whenever past points of the tier that is shown changed.  Both
+ * generations only go up, so their sum does too. */
+static guint get_generation(const Graph *this)
+{
+	const Traffic *traffic = this->traffic;
+	if (this->tier == GRAPH_TIER_RAW) return traffic->generation;
+
+	return traffic->generation + traffic->rrd_generation;
+}
+
+/* Returns the aggregate traffic shown in a column of the graph. */
+static guint64 get_sample(Graph *this, History *hist, Rrd *rrd, gsize age)
+{
+	if (this->tier == GRAPH_TIER_RAW) return history_get(hist, age);
+
+	return rrd_get(rrd, this->tier - GRAPH_TIER_MINUTE, age).avg;
+}
+
+static void update_thresholds(Graph *this, guint h)
+{
+	if (this->thresholds
+	    && this->thresholds_h == h
+	    && this->thresholds_scale == this->scale
+	    && this->thresholds_mode == this->scale_mode) {
+		return;
+	}
+
+	ScaleMode mode = this->scale_mode;
+	guint64 scale = this->scale;
+	this->thresholds = g_renew(guint64, this->thresholds, h);
+	for (guint seg = 1; seg <= h; seg++) {
+		/* Start from the inverse of the mapping, and step over what
+		 * it got wrong by rounding. */
+		guint64 value = graph_scale_value(mode, scale, (gdouble)seg / h);
+		while (value > 0 && get_height(mode, scale, value - 1, h) >= seg) value--;
+		while (value < G_MAXUINT64 && get_height(mode, scale, value, h) < seg) value++;
+		this->thresholds[seg - 1] = value;
+	}
+
+	/* As many bits of mantissa as fit the table in its bound, from the
+	 * first threshold, since the values below are all at height 0. */
+	guint bits = g_bit_storage(h) + 1;
+	guint32 base, n_segs;
+	for (;; bits--) {
+		base = get_bucket(this->thresholds[0], bits);
+		n_segs = get_bucket(scale, bits) - base + 1;
+		if (bits == 1 || n_segs <= MAX(SEGS_PER_PIXEL * h, 128)) break;
+	}
+
+	this->segs = g_renew(guint32, this->segs, n_segs);
+	this->n_segs = n_segs;
+	this->seg_base = base;
+	this->seg_bits = bits;
+	guint seg = 0;
+	for (guint32 i = 0; i < n_segs; i++) {
+		guint64 start = get_bucket_start(base + i, bits);
+		while (seg < h && this->thresholds[seg] <= start) seg++;
+		this->segs[i] = seg;
+	}
+
+	this->thresholds_h = h;
+	this->thresholds_scale = scale;
+	this->thresholds_mode = mode;
+}
+
+/* Returns how far up a value is drawn, from 0 to 1 at the scale. */
+static gdouble get_fraction(ScaleMode mode, guint64 scale, guint64 value)
+{
+	gdouble top = MAX(scale, 1);
+	switch (mode) {
+	case SCALE_SQRT:
+		return sqrt(value / top);
+	case SCALE_LOG:
+		return log1p(value) / log1p(top);
+	default:
+		return value / top;
+	}
+}
+
+static guint get_height(ScaleMode mode, guint64 scale, guint64 value, guint h)
+{
+	return (guint)MIN(h * get_fraction(mode, scale, value), h);
+}
+
+/* Returns the height in pixels of the bar for a sample, which is the
+ * number of thresholds it reaches.  The bucket of the sample gives the
+ * height at its start, and a few thresholds are left to check. */
+static guint32 get_seg(Graph *this, guint64 value, guint h)
+{
+	const guint64 *thresholds = this->thresholds;
+	if (value < thresholds[0]) return 0;
+
+	guint32 bucket = get_bucket(value, this->seg_bits) - this->seg_base;
+	if (bucket >= this->n_segs) return h;
+
+	guint32 seg = this->segs[bucket];
+	while (seg < h && thresholds[seg] <= value) seg++;
+
+	return seg;
+}
+
+/* Splits the values like history_encode() does, with `bits` bits of
+ * mantissa, so the buckets keep the same order as the values. */
+static guint32 get_bucket(guint64 value, guint bits)
+{
+	guint64 mask = ((guint64)1 << bits) - 1;
+	if (value <= mask) return value;
+
+	guint exp = g_bit_storage(value) - bits;
+	return (exp << bits) | ((value >> (exp - 1)) & mask);
+}
+
+static guint64 get_bucket_start(guint32 bucket, guint bits)
+{
+	guint64 mask = ((guint64)1 << bits) - 1;
+	guint exp = bucket >> bits;
+	if (exp == 0) return bucket;
+
+	return ((bucket & mask) | (mask + 1)) << (exp - 1);
+}
@@ -0,0 +1,156 @@
+/*
+ *  Copyright (C) 2019 David Lazar <dlazar@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __GRAPH_H__
+#define __GRAPH_H__
+
+#include <glib.h>
+#include <cairo.h>
+#include <gdk/gdk.h>
+
+#include "render.h"
+#include "traffic.h"
+
+G_BEGIN_DECLS
+
+/* How much time each column of the graph covers. */
+typedef enum {
+	GRAPH_TIER_RAW,  /* One update interval. */
+	GRAPH_TIER_MINUTE,
+	GRAPH_TIER_HOUR,
+} GraphTier;
+
+/* What the graph is zoomed to fit.  The percentiles leave the rare spikes
+ * out, so that they don't flatten the rest of the graph. */
+typedef enum {
+	AUTOSCALE_DEVICE_PEAKS,  /* Sum of the peaks of every device. */
+	AUTOSCALE_PEAK,  /* Peak of the total traffic. */
+	AUTOSCALE_P99,
+	AUTOSCALE_P95,
+} Autoscale;
+
+/* How the traffic maps to the height of the bars.  The square root and
+ * the logarithm leave room for the small flows next to the large bursts. */
+typedef enum {
+	SCALE_LINEAR,
+	SCALE_SQRT,
+	SCALE_LOG,  /* From 1 at the bottom to the scale at the top. */
+} ScaleMode;
+
+/* Draws the total traffic.  The graph is rendered into a surface, which is
+ * scrolled by one column for every new point, and only fully repainted
+ * when needed.  When the traffic counts packets, the share of incoming
+ * packets that were dropped is drawn at the bottom of the download bars.
+ * When stacked, the bars are split into a band for every device instead,
+ * without the drops. */
+typedef struct {
+	GdkRGBA bg_color;
+	GdkRGBA rx_color;
+	GdkRGBA tx_color;
+	GdkRGBA drop_color;
+	guint64 min_scale;  /* Bytes per second. */
+	gboolean show_packets;  /* Packets instead of bytes, if they're counted. */
+	Autoscale autoscale;
+	ScaleMode scale_mode;
+	GraphTier tier;
+	gboolean stacked;  /* Every device in its own color. */
+	GHashTable *dev_colors;  /* Names to the GdkRGBA of their bands. */
+
+	const Traffic *traffic;
+	guint64 scale;
+
+	/* The smallest value that reaches each height in pixels, from 1 to
+	 * `thresholds_h`, so that the bars are looked up the same way in
+	 * every mode.  Rebuilt when the scale, the height or the mode
+	 * change. */
+	guint64 *thresholds;
+	guint thresholds_h;
+	guint64 thresholds_scale;
+	ScaleMode thresholds_mode;
+
+	/* The height of the smallest value in every bucket of values from
+	 * the first threshold to the scale, which are split by their top
+	 * `seg_bits` bits, like floats, so that a height is looked up in
+	 * constant time, with a few thresholds left to check.  The bits are
+	 * picked so that there are at most four buckets per pixel of height,
+	 * 16 bytes, or 128 buckets when that's more. */
+	guint32 *segs;
+	guint32 n_segs;
+	guint32 seg_base;  /* The bucket of the first threshold. */
+	guint seg_bits;
+
+	/* When stacked, the running totals of the devices in every column,
+	 * so that they're summed once per point rather than on every
+	 * repaint.  The newest column is at `stack_head`. */
+	guint64 *stack_rx;  /* stack_len columns of stack_n_devs totals. */
+	guint64 *stack_tx;
+	gsize stack_len;
+	gsize stack_head;
+	gsize stack_n_devs;  /* The number of devices they add up. */
+	guint stack_devs_generation;
+	guint64 stack_points;  /* Number of points when they were updated. */
+	guint stack_generation;  /* Of the traffic they were summed from. */
+	GraphTier stack_tier;
+	gboolean stack_packets;
+	gboolean stack_valid;
+
+	cairo_surface_t *surface;
+	RenderStyle style;
+	guint64 surface_scale;  /* The scale the surface was rendered at. */
+	guint surface_generation;  /* Of the traffic it was rendered from. */
+	guint64 points;  /* Number of points when it was last drawn. */
+	guint blank;  /* Number of empty columns at its right end. */
+	gboolean dirty;
+	guint64 redraws;  /* Number of times the graph was drawn. */
+} Graph;
+
+Graph *graph_new(const Traffic *traffic);
+void graph_free(Graph *this);
+
+/* Returns the value that is drawn at `fraction` of the height, e.g. 0.5 for
+ * halfway up. */
+guint64 graph_scale_value(ScaleMode mode, guint64 scale, gdouble fraction);
+
+/* Sets the colors of the devices in the stacked graph, from a list such
+ * as "eth0=#3465a4, wlan0=rgb(115,210,22)".  The other devices take theirs
+ * from a palette, by position.  Returns FALSE if some of the list couldn't
+ * be parsed, after setting the rest. */
+gboolean graph_set_dev_colors(Graph *this, const gchar *list);
+
+/* Returns the color of the band of the `index`th device. */
+void graph_get_dev_color(const Graph *this, gsize index, GdkRGBA *color);
+
+/* Forces a full repaint on the next draw, e.g. after the colors changed. */
+void graph_invalidate(Graph *this);
+
+/* Should be called after every update, and when the settings change. */
+void graph_update_scale(Graph *this);
+
+/* Returns whether the new samples change what a w x h graph looks like. */
+gboolean graph_changed(Graph *this, guint w, guint h);
+
+/* Applies the new samples to the cached surface, by scrolling it if
+ * possible. */
+void graph_scroll(Graph *this, guint w, guint h);
+
+/* Paints a w x h graph, which must not be wider than the histories. */
+void graph_draw(Graph *this, cairo_t *cr, guint w, guint h);
+
+G_END_DECLS
+
+#endif  /* __GRAPH_H__ */
@@ -0,0 +1,265 @@
+/*
+ *  Copyright (C) 2019 David Lazar <dlazar@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "histfile.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <glib.h>
+
+#include "history.h"
+
+#define HISTFILE_MAGIC		"NGHIST\n"
+#define HISTFILE_VERSION	1
+#define HISTFILE_SLOTS		32
+#define NAME_SIZE		32
+
+typedef struct {
+	gchar magic[8];
+	guint32 version;
+	guint32 n_slots;
+	guint64 hist_len;
+	guint64 checksum;  /* Of the fields above. */
+
+	gint64 timestamp;  /* Wall-clock time of the last update, in ms. */
+} FileHeader;
+
+typedef struct {
+	gchar name[NAME_SIZE];  /* Empty if the slot is free. */
+	guint64 name_checksum;
+	HistorySeal rx_seal;
+	HistorySeal tx_seal;
+
+	/* Followed by `hist_len` samples of rx, then of tx. */
+	guint64 samples[];
+} Slot;
+
+struct _HistoryFile {
+	guchar *map;
+	gsize size;
+	gsize hist_len;
+
+	/* Slots used by devices in this run.  The other slots may hold
+	 * devices from a previous run, and are reused when needed. */
+	gboolean claimed[HISTFILE_SLOTS];
+};
+
+static FileHeader *get_header(HistoryFile *this);
+static Slot *get_slot(HistoryFile *this, gint i);
+static gint find_slot(HistoryFile *this, NetworkDevice *dev);
+static Slot *claim_slot(HistoryFile *this, const gchar *name);
+static void set_slot_name(Slot *slot, const gchar *name);
+static guint64 checksum(const void *data, gsize size);
+
+
+// Allow variable declarations at the first use.
+#pragma GCC diagnostic ignored "-Wdeclaration-after-statement"
+
+
+HistoryFile *histfile_open(const gchar *path, gsize hist_len)
+{
+	gsize slot_size = sizeof(Slot) + 2 * hist_len * sizeof(guint64);
+	gsize size = sizeof(FileHeader) + HISTFILE_SLOTS * slot_size;
+
+	int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	if (fd == -1) {
+		g_warning("Could not open %s: %s.", path, g_strerror(errno));
+		return NULL;
+	}
+
+	/* Start over from an empty file if the size doesn't match. */
+	struct stat st;
+	if (fstat(fd, &st) == -1
+	    || (gsize)st.st_size != size) {
+		if (ftruncate(fd, 0) == -1 || ftruncate(fd, size) == -1) {
+			g_warning("Could not resize %s: %s.", path, g_strerror(errno));
+			close(fd);
+			return NULL;
+		}
+	}
+
+	void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		g_warning("Could not map %s: %s.", path, g_strerror(errno));
+		return NULL;
+	}
+
+	HistoryFile *this = g_slice_new0(HistoryFile);
+	this->map = map;
+	this->size = size;
+	this->hist_len = hist_len;
+
+	FileHeader expected = {
+		.magic = HISTFILE_MAGIC,
+		.version = HISTFILE_VERSION,
+		.n_slots = HISTFILE_SLOTS,
+		.hist_len = hist_len,
+	};
+	expected.checksum = checksum(&expected, G_STRUCT_OFFSET(FileHeader, checksum));
+
+	FileHeader *header = get_header(this);
+	if (memcmp(header, &expected, G_STRUCT_OFFSET(FileHeader, timestamp)) != 0) {
+		g_debug("Initializing history file %s.", path);
+		memset(this->map, 0, size);
+		memcpy(header, &expected, sizeof(FileHeader));
+	}
+
+	return this;
+}
+
+void histfile_close(HistoryFile *this)
+{
+	munmap(this->map, this->size);
+
+	g_slice_free(HistoryFile, this);
+}
+
+gboolean histfile_attach(HistoryFile *this, NetworkDevice *dev, guint interval)
+{
+	if (dev->hist_rx->len != this->hist_len || dev->hist_rx->codes) return FALSE;
+
+	Slot *slot = claim_slot(this, dev->name);
+	if (!slot) {
+		g_debug("No room left in the history file for netdev %s.", dev->name);
+		return FALSE;
+	}
+
+	guint64 *rx_samples = slot->samples;
+	guint64 *tx_samples = slot->samples + this->hist_len;
+
+	/* A slot that was in use has the name of its device. */
+	gboolean restore = strncmp(slot->name, dev->name, NAME_SIZE) == 0
+		&& history_can_restore(dev->hist_rx, rx_samples, &slot->rx_seal)
+		&& history_can_restore(dev->hist_tx, tx_samples, &slot->tx_seal);
+
+	if (!restore) {
+		history_attach(dev->hist_rx, rx_samples, &slot->rx_seal);
+		history_attach(dev->hist_tx, tx_samples, &slot->tx_seal);
+		set_slot_name(slot, dev->name);
+		return FALSE;
+	}
+
+	history_restore(dev->hist_rx, rx_samples, &slot->rx_seal);
+	history_restore(dev->hist_tx, tx_samples, &slot->tx_seal);
+	g_debug("Restored the history of netdev %s.", dev->name);
+
+	/* Nothing was measured while the plugin wasn't running. */
+	gint64 now = g_get_real_time() / 1000;
+	gint64 then = get_header(this)->timestamp;
+	if (now > then && interval > 0) {
+		guint64 missed = MIN((guint64)(now - then) / interval, this->hist_len);
+		for (guint64 i = 0; i < missed; i++) {
+			history_push(dev->hist_rx, 0);
+			history_push(dev->hist_tx, 0);
+		}
+	}
+
+	return TRUE;
+}
+
+void histfile_detach(HistoryFile *this, NetworkDevice *dev)
+{
+	gint i = find_slot(this, dev);
+	if (i == -1) return;
+
+	history_detach(dev->hist_rx);
+	history_detach(dev->hist_tx);
+
+	set_slot_name(get_slot(this, i), "");
+	this->claimed[i] = FALSE;
+}
+
+void histfile_rename(HistoryFile *this, NetworkDevice *dev)
+{
+	gint i = find_slot(this, dev);
+	if (i != -1) set_slot_name(get_slot(this, i), dev->name);
+}
+
+void histfile_touch(HistoryFile *this)
+{
+	get_header(this)->timestamp = g_get_real_time() / 1000;
+}
+
+static FileHeader *get_header(HistoryFile *this)
+{
+	return (FileHeader *)this->map;
+}
+
+static Slot *get_slot(HistoryFile *this, gint i)
+{
+	gsize slot_size = sizeof(Slot) + 2 * this->hist_len * sizeof(guint64);
+	return (Slot *)(this->map + sizeof(FileHeader) + i * slot_size);
+}
+
+/* Returns the index of the slot that holds the histories of a device, or
+ * -1 if they are not in the file. */
+static gint find_slot(HistoryFile *this, NetworkDevice *dev)
+{
+	for (gint i = 0; i < HISTFILE_SLOTS; i++) {
+		if (this->claimed[i] && dev->hist_rx->samples == get_slot(this, i)->samples) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+/* Returns the slot that a device used in a previous run, or else a free
+ * slot, or else one that isn't used in this run. */
+static Slot *claim_slot(HistoryFile *this, const gchar *name)
+{
+	gint found = -1;
+	for (gint i = 0; i < HISTFILE_SLOTS; i++) {
+		if (this->claimed[i]) continue;
+
+		Slot *slot = get_slot(this, i);
+		gboolean valid = slot->name_checksum == checksum(slot->name, NAME_SIZE);
+		if (valid && strncmp(slot->name, name, NAME_SIZE) == 0) {
+			found = i;
+			break;
+		}
+		if (found == -1 || (valid && slot->name[0] == '\0')) found = i;
+	}
+	if (found == -1) return NULL;
+
+	this->claimed[found] = TRUE;
+	return get_slot(this, found);
+}
+
+static void set_slot_name(Slot *slot, const gchar *name)
+{
+	memset(slot->name, 0, NAME_SIZE);
+	g_strlcpy(slot->name, name, NAME_SIZE);
+	slot->name_checksum = checksum(slot->name, NAME_SIZE);
+}
+
+/* FNV-1a. */
+static guint64 checksum(const void *data, gsize size)
+{
+	const guchar *bytes = data;
+	guint64 hash = G_GUINT64_CONSTANT(0xcbf29ce484222325);
+	for (gsize i = 0; i < size; i++) {
+		hash ^= bytes[i];
+		hash *= G_GUINT64_CONSTANT(0x100000001b3);
+	}
+	return hash;
+}
@@ -0,0 +1,56 @@
+/*
+ *  Copyright (C) 2019 David Lazar <dlazar@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __HISTFILE_H__
+#define __HISTFILE_H__
+
+#include <glib.h>
+
+#include "netdev.h"
+
+G_BEGIN_DECLS
+
+/* A memory-mapped file that holds the histories of the devices, so that
+ * they survive restarts of the panel.  The file has a fixed layout, with a
+ * slot for each device, and the histories keep their samples directly in
+ * it, so nothing needs to be written out or parsed. */
+typedef struct _HistoryFile HistoryFile;
+
+/* Creates the file, or reinitializes it if it doesn't match `hist_len`.
+ * Returns NULL on errors. */
+HistoryFile *histfile_open(const gchar *path, gsize hist_len);
+void histfile_close(HistoryFile *this);
+
+/* Moves the histories of a new device into the file.  If the file still
+ * had them from a previous run, restores them, filling the time since then
+ * with zeroes, and returns TRUE.  Compact histories stay in memory. */
+gboolean histfile_attach(HistoryFile *this, NetworkDevice *dev, guint interval);
+
+/* Moves the histories back into memory, and frees their slot. */
+void histfile_detach(HistoryFile *this, NetworkDevice *dev);
+
+/* Records the new name of a device that was renamed. */
+void histfile_rename(HistoryFile *this, NetworkDevice *dev);
+
+/* Records the time of the latest update.  Should be called after every
+ * update. */
+void histfile_touch(HistoryFile *this);
+
+G_END_DECLS
+
+#endif  /* __HISTFILE_H__ */
@@ -0,0 +1,324 @@
+/*
+ *  Copyright (C) 2019 David Lazar <dlazar@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "history.h"
+
+#include <string.h>
+#include <glib.h>
+
+/* Weight of the head in the checksum, which must be odd, like the weights
+ * of the samples, so that any change to a single field shows up. */
+#define HEAD_WEIGHT	G_GUINT64_CONSTANT(0x9e3779b97f4a7c15)
+
+static void set_at(History *this, gsize pos, guint64 sample);
+static guint64 checksum(const guint64 *samples, gsize len, gsize head);
+static void seal_update(History *this);
+static void set_samples(History *this, guint64 *samples);
+static void maxq_rebuild(History *this);
+static void maxq_append(History *this, gsize pos);
+static void sketch_rebuild(History *this);
+
+
+// Allow variable declarations at the first use.
+#pragma GCC diagnostic ignored "-Wdeclaration-after-statement"
+
+
+History *history_new(gsize len)
+{
+	History *this = g_slice_new0(History);
+	this->samples = g_new0(guint64, len);
+	this->maxq = g_new0(guint32, len);
+	this->len = len;
+	this->head = 0;
+
+	return this;
+}
+
+void history_free(History *this)
+{
+	if (!this->seal) g_free(this->samples);
+	g_free(this->codes);
+	g_free(this->maxq);
+	if (this->sketch) quantile_free(this->sketch);
+
+	g_slice_free(History, this);
+}
+
+void history_resize(History *this, gsize newlen)
+{
+	if (newlen == this->len) return;
+
+	/* Keep the most recent samples, oldest first.  If the history grows,
+	 * the new slots are filled with zeroes at the old end. */
+	gsize keep = MIN(this->len, newlen);
+	if (this->codes) {
+		guint32 *codes = g_new0(guint32, MAX(newlen, 1));
+		for (gsize i = 0; i < keep; i++) {
+			codes[i] = this->codes[history_pos(this, keep - 1 - i)];
+		}
+		g_free(this->codes);
+		this->codes = codes;
+	} else {
+		guint64 *samples = g_new0(guint64, newlen);
+		for (gsize i = 0; i < keep; i++) {
+			samples[i] = history_get(this, keep - 1 - i);
+		}
+		set_samples(this, samples);
+	}
+
+	g_free(this->maxq);
+	this->maxq = g_new0(guint32, newlen);
+	this->len = newlen;
+	this->head = keep ? keep - 1 : 0;
+
+	maxq_rebuild(this);
+	sketch_rebuild(this);
+}
+
+void history_push(History *this, guint64 sample)
+{
+	if (this->len == 0) return;
+
+	this->head++;
+	if (this->head == this->len) this->head = 0;
+
+	/* The slot at `head` holds the oldest sample, which is about to fall
+	 * out of the window. */
+	if (this->maxq_count && this->maxq[this->maxq_first] == this->head) {
+		this->maxq_first++;
+		if (this->maxq_first == this->len) this->maxq_first = 0;
+		this->maxq_count--;
+	}
+
+	guint32 code = 0;
+	if (this->codes) {
+		/* Work with the sample as it's stored from here on. */
+		code = history_encode(sample);
+		sample = history_decode(code);
+	}
+
+	if (this->sketch) {
+		quantile_remove(this->sketch, history_at(this, this->head));
+		quantile_insert(this->sketch, sample);
+	}
+
+	if (this->codes) {
+		this->codes[this->head] = code;
+	} else if (this->seal) {
+		/* Update the samples before the seal, so that they don't
+		 * validate if writing gets interrupted in between. */
+		guint64 old_head = history_pos(this, 1);
+		guint64 old_sample = this->samples[this->head];
+		this->samples[this->head] = sample;
+		this->seal->checksum += (sample - old_sample) * (2 * this->head + 1)
+			+ (this->head - old_head) * HEAD_WEIGHT;
+		this->seal->head = this->head;
+	} else {
+		this->samples[this->head] = sample;
+	}
+
+	maxq_append(this, this->head);
+}
+
+void history_clear(History *this)
+{
+	if (this->codes) {
+		memset(this->codes, 0, this->len * sizeof(guint32));
+	} else {
+		memset(this->samples, 0, this->len * sizeof(guint64));
+	}
+	this->maxq_first = 0;
+	this->maxq_count = 0;
+	sketch_rebuild(this);
+	seal_update(this);
+}
+
+void history_set_compact(History *this, gboolean compact)
+{
+	if (compact == (this->codes != NULL)) return;
+
+	if (compact) {
+		history_detach(this);
+		this->codes = g_new(guint32, MAX(this->len, 1));
+		for (gsize pos = 0; pos < this->len; pos++) {
+			this->codes[pos] = history_encode(this->samples[pos]);
+		}
+		g_free(this->samples);
+		this->samples = NULL;
+	} else {
+		this->samples = g_new(guint64, this->len);
+		for (gsize pos = 0; pos < this->len; pos++) {
+			this->samples[pos] = history_decode(this->codes[pos]);
+		}
+		g_free(this->codes);
+		this->codes = NULL;
+	}
+
+	/* The max, and the quantiles, may have been rounded down. */
+	maxq_rebuild(this);
+	sketch_rebuild(this);
+}
+
+void history_track_quantiles(History *this)
+{
+	if (this->sketch) return;
+
+	this->sketch = quantile_new();
+	sketch_rebuild(this);
+}
+
+void history_attach(History *this, guint64 *storage, HistorySeal *seal)
+{
+	g_return_if_fail(this->codes == NULL);
+
+	memcpy(storage, this->samples, this->len * sizeof(guint64));
+	set_samples(this, storage);
+	this->seal = seal;
+	seal_update(this);
+}
+
+void history_detach(History *this)
+{
+	if (!this->seal) return;
+
+	guint64 *samples = g_new(guint64, this->len);
+	memcpy(samples, this->samples, this->len * sizeof(guint64));
+	set_samples(this, samples);
+}
+
+gboolean history_can_restore(const History *this, const guint64 *storage,
+			     const HistorySeal *seal)
+{
+	return !this->codes
+		&& seal->head < MAX(this->len, 1)
+		&& seal->checksum == checksum(storage, this->len, seal->head);
+}
+
+gboolean history_restore(History *this, guint64 *storage, HistorySeal *seal)
+{
+	if (!history_can_restore(this, storage, seal)) return FALSE;
+
+	set_samples(this, storage);
+	this->seal = seal;
+	this->head = seal->head;
+	maxq_rebuild(this);
+	sketch_rebuild(this);
+
+	return TRUE;
+}
+
+void history_add(History *this, const History *other)
+{
+	g_return_if_fail(this->len == other->len);
+
+	for (gsize age = 0; age < this->len; age++) {
+		gsize pos = history_pos(this, age);
+		set_at(this, pos, history_at(this, pos) + history_get(other, age));
+	}
+	maxq_rebuild(this);
+	sketch_rebuild(this);
+	seal_update(this);
+}
+
+void history_subtract(History *this, const History *other)
+{
+	g_return_if_fail(this->len == other->len);
+
+	for (gsize age = 0; age < this->len; age++) {
+		gsize pos = history_pos(this, age);
+		guint64 current = history_at(this, pos);
+		guint64 sample = history_get(other, age);
+		set_at(this, pos, (current > sample) ? current - sample : 0);
+	}
+	maxq_rebuild(this);
+	sketch_rebuild(this);
+	seal_update(this);
+}
+
+/* Stores a sample, without updating the max, the sketch or the seal. */
+static void set_at(History *this, gsize pos, guint64 sample)
+{
+	if (this->codes) {
+		this->codes[pos] = history_encode(sample);
+	} else {
+		this->samples[pos] = sample;
+	}
+}
+
+static guint64 checksum(const guint64 *samples, gsize len, gsize head)
+{
+	guint64 sum = head * HEAD_WEIGHT;
+	for (gsize pos = 0; pos < len; pos++) {
+		sum += samples[pos] * (2 * pos + 1);
+	}
+	return sum;
+}
+
+static void seal_update(History *this)
+{
+	if (!this->seal) return;
+
+	this->seal->head = this->head;
+	this->seal->checksum = checksum(this->samples, this->len, this->head);
+}
+
+/* Replaces the samples buffer, which the history owns afterwards unless a
+ * seal is set again. */
+static void set_samples(History *this, guint64 *samples)
+{
+	if (!this->seal) g_free(this->samples);
+	this->samples = samples;
+	this->seal = NULL;
+}
+
+static void maxq_rebuild(History *this)
+{
+	this->maxq_first = 0;
+	this->maxq_count = 0;
+
+	/* Replay the samples from the oldest to the newest. */
+	for (gsize age = this->len; age-- > 0; ) {
+		maxq_append(this, history_pos(this, age));
+	}
+}
+
+static void maxq_append(History *this, gsize pos)
+{
+	guint64 sample = history_at(this, pos);
+
+	/* Samples that are not larger than the new one can never be the max
+	 * again, since they will expire first. */
+	while (this->maxq_count) {
+		gsize back = (this->maxq_first + this->maxq_count - 1) % this->len;
+		if (history_at(this, this->maxq[back]) > sample) break;
+		this->maxq_count--;
+	}
+
+	this->maxq[(this->maxq_first + this->maxq_count) % this->len] = pos;
+	this->maxq_count++;
+}
+
+static void sketch_rebuild(History *this)
+{
+	if (!this->sketch) return;
+
+	quantile_clear(this->sketch);
+	for (gsize pos = 0; pos < this->len; pos++) {
+		quantile_insert(this->sketch, history_at(this, pos));
+	}
+}
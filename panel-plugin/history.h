@@ -0,0 +1,154 @@
+/*
+ *  Copyright (C) 2019 David Lazar <dlazar@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __HISTORY_H__
+#define __HISTORY_H__
+
+#include <glib.h>
+
+#include "quantile.h"
+
+G_BEGIN_DECLS
+
+/* Stored next to samples that are kept outside the history, e.g. in a
+ * memory-mapped file, so that they can be validated when loaded again.
+ * The checksum is updated with every sample, in O(1). */
+typedef struct {
+	guint64 head;
+	guint64 checksum;
+} HistorySeal;
+
+/* A compact history keeps every sample in 32 bits, as a 6-bit exponent
+ * and a 26-bit mantissa with an implicit leading one, like a float.  The
+ * samples below 2^27 are kept exactly, and the larger ones are rounded
+ * down by less than 2^-26 of their value, i.e. 0.0000015%. */
+#define HISTORY_MANTISSA_BITS	26
+#define HISTORY_MANTISSA_MASK	((1u << HISTORY_MANTISSA_BITS) - 1)
+
+/* A fixed-length window of the most recent samples, stored as a circular
+ * buffer.  The maximum over the window is maintained incrementally with a
+ * monotonic deque, so adding a sample costs O(1) amortized. */
+typedef struct {
+	guint64 *samples;  /* NULL when compact. */
+	/* Only set when compact, see history_set_compact(), even if empty. */
+	guint32 *codes;
+	gsize len;
+	gsize head;  /* Position of the most recent sample. */
+
+	HistorySeal *seal;  /* Only set when the samples are external. */
+
+	/* Positions in `samples`, in order of age, with strictly
+	 * decreasing values.  The first one always holds the max. */
+	guint32 *maxq;
+	gsize maxq_first;
+	gsize maxq_count;
+
+	QuantileSketch *sketch;  /* Only set by history_track_quantiles(). */
+} History;
+
+History *history_new(gsize len);
+void history_free(History *this);
+void history_resize(History *this, gsize newlen);
+void history_push(History *this, guint64 sample);
+void history_clear(History *this);
+
+/* Switches between keeping the samples in 64 bits, and in 32 bits with the
+ * precision above, which halves the memory of long histories.  Compact
+ * histories can't be attached to external storage. */
+void history_set_compact(History *this, gboolean compact);
+
+/* Keeps a sketch of all the samples in the window up to date, at a cost of
+ * O(log n) per sample, for history_quantile(). */
+void history_track_quantiles(History *this);
+
+/* Moves the samples to `storage`, which must have room for `len` samples
+ * and outlive the history, or until history_detach() or history_resize()
+ * move them back to memory owned by the history.  Not for compact
+ * histories. */
+void history_attach(History *this, guint64 *storage, HistorySeal *seal);
+void history_detach(History *this);
+
+/* Uses samples that were previously attached to another history of the
+ * same length.  Returns FALSE, and does nothing, if their seal is not
+ * valid, which can be checked beforehand with history_can_restore(). */
+gboolean history_can_restore(const History *this, const guint64 *storage,
+			     const HistorySeal *seal);
+gboolean history_restore(History *this, guint64 *storage, HistorySeal *seal);
+
+/* Add or subtract another history of the same length, sample by sample. */
+void history_add(History *this, const History *other);
+void history_subtract(History *this, const History *other);
+
+/* Returns the position in `samples` of the sample that was pushed `age`
+ * samples ago (0 is the newest). */
+static inline gsize history_pos(const History *this, gsize age)
+{
+	return (this->head >= age) ? this->head - age
+				   : this->head + this->len - age;
+}
+
+/* Rounds a sample down to what a compact history keeps of it. */
+static inline guint32 history_encode(guint64 sample)
+{
+	if (sample <= HISTORY_MANTISSA_MASK) return sample;
+
+	/* Keep the leading one, implicitly, and the 26 bits after it. */
+	guint exp = g_bit_storage(sample) - HISTORY_MANTISSA_BITS;
+	guint32 mantissa = (sample >> (exp - 1)) & HISTORY_MANTISSA_MASK;
+	return (exp << HISTORY_MANTISSA_BITS) | mantissa;
+}
+
+static inline guint64 history_decode(guint32 code)
+{
+	/* Without a branch, as it's done for every column that is drawn. */
+	guint exp = code >> HISTORY_MANTISSA_BITS;
+	guint64 leading = (exp != 0);
+	guint64 mantissa = (code & HISTORY_MANTISSA_MASK) | (leading << HISTORY_MANTISSA_BITS);
+	return mantissa << (exp - leading);
+}
+
+/* Returns the sample at a position in `samples`, or `codes`. */
+static inline guint64 history_at(const History *this, gsize pos)
+{
+	return this->codes ? history_decode(this->codes[pos]) : this->samples[pos];
+}
+
+static inline guint64 history_get(const History *this, gsize age)
+{
+	if (this->len == 0) return 0;
+
+	return history_at(this, history_pos(this, age));
+}
+
+static inline guint64 history_max(const History *this)
+{
+	if (this->maxq_count == 0) return 0;
+	return history_at(this, this->maxq[this->maxq_first]);
+}
+
+/* Returns the `q` quantile of the window, see quantile_get().  Only
+ * available with history_track_quantiles(). */
+static inline guint64 history_quantile(const History *this, gdouble q)
+{
+	if (!this->sketch) return 0;
+	return quantile_get(this->sketch, q);
+}
+
+G_END_DECLS
+
+#endif  /* __HISTORY_H__ */
@@ -0,0 +1,233 @@
+/*
+ *  Copyright (C) 2019 David Lazar <dlazar@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "instrument.h"
+
+#ifdef ENABLE_INSTRUMENTATION
+
+#ifdef HAVE_MALLINFO2
+#include <malloc.h>
+#endif
+#include <time.h>
+
+#include <glib.h>
+
+#undef G_LOG_DOMAIN
+#define G_LOG_DOMAIN	"netgraph"
+
+/* Bucket i counts the values below 2^i, and at least 2^(i-1); the last one
+ * also counts everything above. */
+#define N_BUCKETS	32
+
+#define DUMP_INTERVAL	60	/* seconds */
+
+typedef struct {
+	guint64 count;
+	guint64 max;
+	guint64 buckets[N_BUCKETS];
+} Histogram;
+
+static const gchar *const span_names[N_SPANS] = {
+	[SPAN_SAMPLE] = "sample",
+	[SPAN_UPDATE_LIST] = "update list",
+	[SPAN_UPDATE_STATS] = "update stats",
+	[SPAN_TOOLTIP] = "tooltip",
+	[SPAN_DRAW] = "draw",
+};
+
+/* Written by both the sampler and the main thread. */
+static GMutex lock;
+static Histogram wall[N_SPANS];  /* Microseconds. */
+static Histogram cpu[N_SPANS];
+static Histogram heap[N_SPANS];  /* Bytes the heap grew by. */
+static Histogram syscalls;  /* Per tick. */
+static Histogram jitter;  /* Microseconds off the interval. */
+static gint pending_syscalls;  /* Since the last tick. */
+static guint64 updates;  /* Of all the plugins. */
+static guint64 redraws;
+
+/* Only used by the sampler thread. */
+static gint64 last_tick;
+static gint64 last_dump;
+
+
+static void record(Histogram *hist, guint64 value);
+static guint64 get_quantile(const Histogram *hist, gdouble q);
+static void format_summary(GString *out, gboolean markup);
+static void append_histogram(GString *out, const gchar *label,
+			     const Histogram *hist, const gchar *unit);
+static gint64 get_cpu_time(void);
+static gsize get_heap_size(void);
+
+
+// Allow variable declarations at the first use.
+#pragma GCC diagnostic ignored "-Wdeclaration-after-statement"
+
+
+void instrument_begin(InstrumentMark *mark)
+{
+	mark->heap = get_heap_size();
+	mark->cpu = get_cpu_time();
+	mark->wall = g_get_monotonic_time();
+}
+
+void instrument_end(InstrumentSpan span, const InstrumentMark *mark)
+{
+	gint64 wall_time = g_get_monotonic_time() - mark->wall;
+	gint64 cpu_time = get_cpu_time() - mark->cpu;
+	gsize heap_size = get_heap_size();
+
+	g_mutex_lock(&lock);
+	record(&wall[span], MAX(wall_time, 0));
+	record(&cpu[span], MAX(cpu_time, 0));
+	record(&heap[span], (heap_size > mark->heap) ? heap_size - mark->heap : 0);
+	if (span == SPAN_SAMPLE) {
+		record(&syscalls, g_atomic_int_and(&pending_syscalls, 0));
+	}
+	g_mutex_unlock(&lock);
+}
+
+void instrument_syscalls(guint n)
+{
+	g_atomic_int_add(&pending_syscalls, n);
+}
+
+void instrument_tick(gint64 now, guint interval)
+{
+	gint64 elapsed = now - last_tick;
+	gboolean first = (last_tick == 0);
+	last_tick = now;
+	if (first) {
+		last_dump = now;
+		return;
+	}
+
+	g_mutex_lock(&lock);
+	record(&jitter, ABS(elapsed - (gint64)interval * 1000));
+	g_mutex_unlock(&lock);
+
+	if (now - last_dump >= DUMP_INTERVAL * G_USEC_PER_SEC) {
+		last_dump = now;
+		instrument_dump();
+	}
+}
+
+void instrument_update(void)
+{
+	g_mutex_lock(&lock);
+	updates++;
+	g_mutex_unlock(&lock);
+}
+
+void instrument_redraw(void)
+{
+	g_mutex_lock(&lock);
+	redraws++;
+	g_mutex_unlock(&lock);
+}
+
+void instrument_format(GString *out)
+{
+	format_summary(out, TRUE);
+}
+
+void instrument_dump(void)
+{
+	g_autoptr(GString) out = g_string_new("");
+	format_summary(out, FALSE);
+	g_debug("%s", out->str);
+}
+
+static void record(Histogram *hist, guint64 value)
+{
+	gint i = value ? g_bit_storage(value) : 0;
+	hist->buckets[MIN(i, N_BUCKETS - 1)]++;
+	hist->count++;
+	hist->max = MAX(hist->max, value);
+}
+
+/* Returns the upper bound of the bucket that holds the quantile. */
+static guint64 get_quantile(const Histogram *hist, gdouble q)
+{
+	guint64 rank = q * hist->count;
+	guint64 seen = 0;
+	for (gint i = 0; i < N_BUCKETS - 1; i++) {
+		seen += hist->buckets[i];
+		if (seen > rank) return i ? MIN(((guint64)1 << i) - 1, hist->max) : 0;
+	}
+	return hist->max;
+}
+
+static void format_summary(GString *out, gboolean markup)
+{
+	g_string_append(out, markup ? "\n<b>Cost</b> (p50/p99/max):"
+				    : "Cost of the updates (p50/p99/max):");
+
+	g_mutex_lock(&lock);
+	for (gint span = 0; span < N_SPANS; span++) {
+		g_string_append_printf(out, markup ? "\n<i>%s</i>: " : "\n  %s: ",
+				       span_names[span]);
+		append_histogram(out, "wall", &wall[span], "µs");
+		append_histogram(out, ", cpu", &cpu[span], "µs");
+		append_histogram(out, ", heap growth", &heap[span], "B");
+		g_string_append_printf(out, ", %" G_GUINT64_FORMAT " times",
+				       wall[span].count);
+	}
+
+	g_string_append(out, markup ? "\n<i>ticks</i>: " : "\n  ticks: ");
+	append_histogram(out, "syscalls", &syscalls, "");
+	append_histogram(out, ", jitter", &jitter, "µs");
+
+	g_string_append(out, markup ? "\n<i>redraws</i>: " : "\n  redraws: ");
+	g_string_append_printf(out, "%" G_GUINT64_FORMAT " in %" G_GUINT64_FORMAT " updates",
+			       redraws, updates);
+	g_mutex_unlock(&lock);
+}
+
+static void append_histogram(GString *out, const gchar *label,
+			     const Histogram *hist, const gchar *unit)
+{
+	g_string_append_printf(out, "%s %" G_GUINT64_FORMAT "/%" G_GUINT64_FORMAT
+			       "/%" G_GUINT64_FORMAT "%s%s",
+			       label, get_quantile(hist, 0.50), get_quantile(hist, 0.99),
+			       hist->max, *unit ? " " : "", unit);
+}
+
+static gint64 get_cpu_time(void)
+{
+	struct timespec ts;
+	if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) < 0) return 0;
+	return (gint64)ts.tv_sec * G_USEC_PER_SEC + ts.tv_nsec / 1000;
+}
+
+/* Only counts the main arena, so it mostly misses what the sampler thread
+ * allocates. */
+static gsize get_heap_size(void)
+{
+#ifdef HAVE_MALLINFO2
+	return mallinfo2().uordblks;
+#else
+	return 0;
+#endif
+}
+
+#endif  /* ENABLE_INSTRUMENTATION */
@@ -0,0 +1,91 @@
+/*
+ *  Copyright (C) 2019 David Lazar <dlazar@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __INSTRUMENT_H__
+#define __INSTRUMENT_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Measures what the plugin costs, when configured with
+ * --enable-instrumentation.  Otherwise, all the INSTRUMENT_* macros
+ * expand to nothing.  The measurements are process-wide, as all the
+ * plugins share the sampler.  Must be included after config.h. */
+
+/* The steps of an update that are timed. */
+typedef enum {
+	SPAN_SAMPLE,        /* Reading the counters, on the sampler thread. */
+	SPAN_UPDATE_LIST,   /* traffic_update_list() */
+	SPAN_UPDATE_STATS,  /* traffic_update_stats() */
+	SPAN_TOOLTIP,       /* tooltip_format() */
+	SPAN_DRAW,          /* Drawing the graph. */
+	N_SPANS,
+} InstrumentSpan;
+
+#ifdef ENABLE_INSTRUMENTATION
+
+typedef struct {
+	gint64 wall;  /* Microseconds. */
+	gint64 cpu;   /* Of the calling thread, in microseconds. */
+	gsize heap;   /* Bytes in use on the main heap. */
+} InstrumentMark;
+
+void instrument_begin(InstrumentMark *mark);
+void instrument_end(InstrumentSpan span, const InstrumentMark *mark);
+
+/* Records the system calls made to read the counters, and how late the
+ * sampler woke up compared to `interval`, in milliseconds. */
+void instrument_syscalls(guint n);
+void instrument_tick(gint64 now, guint interval);
+
+/* Counts the snapshots a plugin applied, and how many times its graph was
+ * drawn, which is at most once a frame however many came in. */
+void instrument_update(void);
+void instrument_redraw(void);
+
+/* Appends a summary of the measurements to `out`, as Pango markup. */
+void instrument_format(GString *out);
+
+/* Logs the summary with g_debug(), as seen with G_MESSAGES_DEBUG.  The
+ * sampler also does that every minute. */
+void instrument_dump(void);
+
+#define INSTRUMENT_BEGIN(mark)		InstrumentMark mark; instrument_begin(&mark)
+#define INSTRUMENT_END(span, mark)	instrument_end(span, &mark)
+#define INSTRUMENT_SYSCALLS(n)		instrument_syscalls(n)
+#define INSTRUMENT_TICK(now, interval)	instrument_tick(now, interval)
+#define INSTRUMENT_UPDATE()		instrument_update()
+#define INSTRUMENT_REDRAW()		instrument_redraw()
+#define INSTRUMENT_DUMP()		instrument_dump()
+
+#else
+
+#define INSTRUMENT_BEGIN(mark)
+#define INSTRUMENT_END(span, mark)
+#define INSTRUMENT_SYSCALLS(n)
+#define INSTRUMENT_TICK(now, interval)
+#define INSTRUMENT_UPDATE()
+#define INSTRUMENT_REDRAW()
+#define INSTRUMENT_DUMP()
+
+#endif  /* ENABLE_INSTRUMENTATION */
+
+G_END_DECLS
+
+#endif  /* __INSTRUMENT_H__ */
@@ -18,18 +18,29 @@
 
 #include "netdev.h"
 
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
 #include <glib.h>
 
-typedef struct {
-	gboolean is_up;
-	guint64 rx_bytes;
-	guint64 tx_bytes;
-} DeviceStats;
+#include "instrument.h"
+
+/* Samples taken further apart in suspend time than this are not used for
+ * computing a rate. */
+#define SUSPEND_THRESHOLD	(10 * 1000)	/* microseconds */
 
 /* Functions defined in the OS-specific files. */
-static void netdev_os_init(NetworkDevice *this);
-static void netdev_os_free(NetworkDevice *this);
-static void netdev_os_read_stats(NetworkDevice *this, DeviceStats* stats);
+static void netdev_os_set_root(const gchar *root);
+static GPtrArray *netdev_os_enumerate(void);
+static void netdev_os_get_time(NetdevTime *time);
+static void netdev_os_refresh(void);
+static void netdev_os_init(NetdevProbe *this);
+static void netdev_os_free(NetdevProbe *this);
+static void netdev_os_read_stats(NetdevProbe *this, NetdevStats *stats);
+static NetdevMonitor *netdev_os_monitor_new(NetdevLinkFunc func, gpointer user_data);
+static void netdev_os_monitor_free(NetdevMonitor *this);
 
 #ifdef __linux__
 #include "netdev_linux.c"
@@ -37,109 +48,339 @@ static void netdev_os_read_stats(NetworkDevice *this, DeviceStats* stats);
 #error "Unsupported operating system.  Please contact the plugin authors."
 #endif
 
+#include "netdev_replay.c"
+
+typedef enum {
+	SOURCE_SYSTEM,
+	SOURCE_SYSFS_ROOT,
+	SOURCE_REPLAY,
+} NetdevSource;
 
-static void shift_get_max(guint64 *hist, gsize len, guint64 *max);
+static NetdevSource source = SOURCE_SYSTEM;
+
+static void source_init(void);
+static guint64 get_rate(guint64 value, guint64 prev, gint64 elapsed);
 
 
 // Allow variable declarations at the first use.
 #pragma GCC diagnostic ignored "-Wdeclaration-after-statement"
 
 
-NetworkDevice *netdev_new(gchar *name, gsize hist_len)
+void netdev_set_sysfs_root(const gchar *root)
 {
-	NetworkDevice *this = g_slice_new0(NetworkDevice);
+	source_init();
+
+	netdev_os_set_root(root);
+	source = SOURCE_SYSFS_ROOT;
+}
+
+gboolean netdev_set_replay(const gchar *path, gdouble speed)
+{
+	source_init();
+
+	if (!replay_open(path, speed)) return FALSE;
+	source = SOURCE_REPLAY;
+	return TRUE;
+}
+
+void netdev_refresh(void)
+{
+	source_init();
+
+	if (source == SOURCE_REPLAY) {
+		replay_refresh();
+	} else {
+		netdev_os_refresh();
+	}
+}
+
+void netdev_get_time(NetdevTime *time)
+{
+	source_init();
+
+	if (source == SOURCE_REPLAY) {
+		replay_get_time(time);
+	} else {
+		netdev_os_get_time(time);
+	}
+}
+
+GPtrArray *netdev_enumerate(void)
+{
+	source_init();
+
+	if (source == SOURCE_REPLAY) return replay_enumerate();
+	return netdev_os_enumerate();
+}
+
+NetdevMonitor *netdev_monitor_new(NetdevLinkFunc func, gpointer user_data)
+{
+	source_init();
+
+	/* Link notifications only ever come from the running system, so
+	 * other sources are polled. */
+	if (source != SOURCE_SYSTEM) return NULL;
+	return netdev_os_monitor_new(func, user_data);
+}
+
+void netdev_monitor_free(NetdevMonitor *this)
+{
+	netdev_os_monitor_free(this);
+}
+
+NetdevProbe *netdev_probe_new(const gchar *name)
+{
+	NetdevProbe *this = g_slice_new0(NetdevProbe);
 	this->name = g_strdup(name);
-	this->hist_rx = g_new0(guint64, hist_len);
-	this->hist_tx = g_new0(guint64, hist_len);
 
-	netdev_os_init(this);
+	source_init();
+	if (source == SOURCE_REPLAY) {
+		replay_init(this);
+	} else {
+		netdev_os_init(this);
+	}
+
+	return this;
+}
+
+void netdev_probe_free(NetdevProbe *this)
+{
+	if (source != SOURCE_REPLAY) netdev_os_free(this);
+
+	g_free(this->name);
 
-	DeviceStats stats;
-	netdev_os_read_stats(this, &stats);
-	this->rx_bytes = stats.rx_bytes;
-	this->tx_bytes = stats.tx_bytes;
+	g_slice_free(NetdevProbe, this);
+}
+
+void netdev_probe_rename(NetdevProbe *this, const gchar *name)
+{
+	if (source != SOURCE_REPLAY) netdev_os_free(this);
+
+	g_free(this->name);
+	this->name = g_strdup(name);
+
+	if (source == SOURCE_REPLAY) {
+		replay_init(this);
+	} else {
+		netdev_os_init(this);
+	}
+}
+
+void netdev_probe_set_counters(NetdevProbe *this, gboolean counters)
+{
+	if (this->counters == counters) return;
+	this->counters = counters;
+
+	/* Reopen the files, with or without the counters. */
+	if (source != SOURCE_REPLAY) {
+		netdev_os_free(this);
+		netdev_os_init(this);
+	}
+}
+
+void netdev_probe_read(NetdevProbe *this, NetdevStats *stats)
+{
+	if (source == SOURCE_REPLAY) {
+		replay_read_stats(this, stats);
+	} else {
+		netdev_os_read_stats(this, stats);
+	}
+}
+
+NetworkDevice *netdev_new(const gchar *name, gsize hist_len)
+{
+	NetworkDevice *this = g_slice_new0(NetworkDevice);
+	this->name = g_strdup(name);
+	this->name_markup = g_markup_escape_text(name, -1);
+	this->hist_rx = history_new(hist_len);
+	this->hist_tx = history_new(hist_len);
+	this->rrd_rx = rrd_new(hist_len);
+	this->rrd_tx = rrd_new(hist_len);
 
 	return this;
 }
 
 void netdev_free(NetworkDevice* this)
 {
-	netdev_os_free(this);
-
 	g_free(this->name);
-	g_free(this->hist_tx);
-	g_free(this->hist_rx);
+	g_free(this->name_markup);
+	history_free(this->hist_tx);
+	history_free(this->hist_rx);
+	rrd_free(this->rrd_tx);
+	rrd_free(this->rrd_rx);
+	netdev_count_packets(this, FALSE, 0);
 
 	g_slice_free(NetworkDevice, this);
 }
 
-void netdev_resize(NetworkDevice *this, gsize oldlen, gsize newlen)
+void netdev_rename(NetworkDevice *this, const gchar *name)
 {
-	this->hist_rx = g_realloc(this->hist_rx, newlen * sizeof(guint64));
-	this->hist_tx = g_realloc(this->hist_tx, newlen * sizeof(guint64));
-	if (newlen > oldlen) {
-		memset(this->hist_rx + oldlen, 0, (newlen - oldlen) * sizeof(guint64));
-		memset(this->hist_tx + oldlen, 0, (newlen - oldlen) * sizeof(guint64));
+	g_free(this->name);
+	g_free(this->name_markup);
+	this->name = g_strdup(name);
+	this->name_markup = g_markup_escape_text(name, -1);
+}
+
+void netdev_resize(NetworkDevice *this, gsize hist_len)
+{
+	history_resize(this->hist_rx, hist_len);
+	history_resize(this->hist_tx, hist_len);
+	rrd_resize(this->rrd_rx, hist_len);
+	rrd_resize(this->rrd_tx, hist_len);
+
+	NetdevPackets *packets = this->packets;
+	for (gint i = 0; packets && i < NETDEV_N_SERIES; i++) {
+		history_resize(packets->hist[i], hist_len);
+		rrd_resize(packets->rrd[i], hist_len);
 	}
 }
 
-void netdev_update(NetworkDevice *this, gsize hist_len, guint interval)
+void netdev_set_compact(NetworkDevice *this, gboolean compact)
 {
-	/* Read the new sample. */
-	DeviceStats stats;
-	netdev_os_read_stats(this, &stats);
+	history_set_compact(this->hist_rx, compact);
+	history_set_compact(this->hist_tx, compact);
+	rrd_set_compact(this->rrd_rx, compact);
+	rrd_set_compact(this->rrd_tx, compact);
 
-	/* Make room for the new sample. */
-	shift_get_max(this->hist_rx, hist_len, &this->max_rx);
-	shift_get_max(this->hist_tx, hist_len, &this->max_tx);
+	NetdevPackets *packets = this->packets;
+	for (gint i = 0; packets && i < NETDEV_N_SERIES; i++) {
+		history_set_compact(packets->hist[i], compact);
+		rrd_set_compact(packets->rrd[i], compact);
+	}
+}
 
-	if (!stats.is_up) {
-		/* Add zeroes if the interface is down. */
-		this->down++;
-		this->hist_rx[0] = 0;
-		this->hist_tx[0] = 0;
+void netdev_count_packets(NetworkDevice *this, gboolean enable, gsize hist_len)
+{
+	if (enable == (this->packets != NULL)) return;
+
+	if (enable) {
+		this->packets = g_slice_new0(NetdevPackets);
+		for (gint i = 0; i < NETDEV_N_SERIES; i++) {
+			this->packets->hist[i] = history_new(hist_len);
+			history_set_compact(this->packets->hist[i], this->hist_rx->codes != NULL);
+			this->packets->rrd[i] = rrd_new(hist_len);
+			rrd_set_compact(this->packets->rrd[i], this->hist_rx->codes != NULL);
+		}
 		return;
 	}
 
-	this->down = 0;
-
-	/* Insert the new sample. */
-	if (stats.rx_bytes >= this->rx_bytes) {
-		this->hist_rx[0] = (stats.rx_bytes - this->rx_bytes) * 1000 / interval;
-	} else {
-		/* The rx_bytes counter is only supposed to go up.  If it went
-		 * down, we assume a wrap-around happened, and the counter
-		 * restarted from 0. */
-		this->hist_rx[0] = stats.rx_bytes;
+	for (gint i = 0; i < NETDEV_N_SERIES; i++) {
+		history_free(this->packets->hist[i]);
+		rrd_free(this->packets->rrd[i]);
 	}
-	if (stats.tx_bytes >= this->tx_bytes) {
-		this->hist_tx[0] = (stats.tx_bytes - this->tx_bytes) * 1000 / interval;
+	g_slice_free(NetdevPackets, this->packets);
+	this->packets = NULL;
+}
+
+void netdev_update(NetworkDevice *this, const NetdevStats *stats,
+		   guint64 now, guint interval, guint ticks)
+{
+	static const NetdevStats gone = { .is_up = FALSE };
+	if (!stats) stats = &gone;
+
+	/* The timer fires late when the system is busy, so the rate is
+	 * computed over the time that actually passed. */
+	gint64 elapsed = stats->time.monotonic - this->time.monotonic;
+	gboolean resumed = stats->time.suspended - this->time.suspended > SUSPEND_THRESHOLD;
+
+	NetdevPackets *packets = this->packets;
+	guint64 rx = 0, tx = 0;
+	if (!stats->is_up) {
+		/* Add zeroes if the interface is down. */
+		this->down += ticks;
+		if (packets) memset(packets->rates, 0, sizeof(packets->rates));
+	} else if (this->time.monotonic == 0 || resumed || elapsed <= 0) {
+		/* This is the first reading, or the system was suspended
+		 * since the previous one, and the counters may have been
+		 * reset in the meantime.  Either way, there's no telling how
+		 * much of the difference is real traffic. */
+		this->down = 0;
+		this->rx_bytes = stats->rx_bytes;
+		this->tx_bytes = stats->tx_bytes;
+		this->time = stats->time;
+		if (packets) {
+			packets->valid = stats->has_counters;
+			memcpy(packets->counters, stats->counters, sizeof(packets->counters));
+			memset(packets->rates, 0, sizeof(packets->rates));
+		}
 	} else {
-		this->hist_tx[0] = stats.tx_bytes;
+		this->down = 0;
+
+		rx = get_rate(stats->rx_bytes, this->rx_bytes, elapsed);
+		tx = get_rate(stats->tx_bytes, this->tx_bytes, elapsed);
+
+		/* The packet counters may only just have been turned on. */
+		if (packets) {
+			for (gint i = 0; i < NETDEV_N_COUNTERS; i++) {
+				packets->rates[i] = (packets->valid && stats->has_counters)
+					? get_rate(stats->counters[i], packets->counters[i], elapsed)
+					: 0;
+			}
+			packets->valid = stats->has_counters;
+			memcpy(packets->counters, stats->counters, sizeof(packets->counters));
+		}
+
+		/* Update the current stats. */
+		this->rx_bytes = stats->rx_bytes;
+		this->tx_bytes = stats->tx_bytes;
+		this->time = stats->time;
 	}
 
-	/* Recompute the max values. */
-	if (this->hist_rx[0] > this->max_rx) {
-		this->max_rx = this->hist_rx[0];
+	/* Insert the new samples.  When the sampler backed off, the rate is
+	 * an average over all the intervals it skipped. */
+	for (guint i = 0; i < ticks; i++) {
+		history_push(this->hist_rx, rx);
+		history_push(this->hist_tx, tx);
 	}
-	if (this->hist_tx[0] > this->max_tx) {
-		this->max_tx = this->hist_tx[0];
+	rrd_push(this->rrd_rx, now, rx, interval);
+	rrd_push(this->rrd_tx, now, tx, interval);
+
+	if (packets) {
+		guint64 rates[NETDEV_N_SERIES];
+		rates[NETDEV_SERIES_RX_PACKETS] = packets->rates[NETDEV_RX_PACKETS];
+		rates[NETDEV_SERIES_TX_PACKETS] = packets->rates[NETDEV_TX_PACKETS];
+		rates[NETDEV_SERIES_DROPS] = packets->rates[NETDEV_RX_DROPPED]
+			+ packets->rates[NETDEV_RX_MISSED_ERRORS];
+
+		for (gint s = 0; s < NETDEV_N_SERIES; s++) {
+			for (guint i = 0; i < ticks; i++) {
+				history_push(packets->hist[s], rates[s]);
+			}
+			rrd_push(packets->rrd[s], now, rates[s], interval);
+		}
 	}
+}
 
-	/* Update the current stats. */
-	this->rx_bytes = stats.rx_bytes;
-	this->tx_bytes = stats.tx_bytes;
+/* Returns the rate per second of a counter. */
+static guint64 get_rate(guint64 value, guint64 prev, gint64 elapsed)
+{
+	/* The counters are only supposed to go up.  If one went down, it was
+	 * reset, e.g. by a driver reload, and there's no telling how much
+	 * traffic passed before that, so the reading only serves as the new
+	 * start. */
+	if (value < prev) return 0;
+
+	return (value - prev) * G_USEC_PER_SEC / elapsed;
 }
 
-static void shift_get_max(guint64 *hist, gsize len, guint64 *max)
+/* Picks the source named by the environment, unless it was set already. */
+static void source_init(void)
 {
-	if (len == 0) return;
+	static gsize initialized = 0;
+	if (!g_once_init_enter(&initialized)) return;
 
-	*max = hist[0];
-	for (gssize i = len - 1; i > 0; i--) {
-		hist[i] = hist[i - 1];
-		if (hist[i] > *max) {
-			*max = hist[i];
+	const gchar *replay = g_getenv("NETGRAPH_REPLAY");
+	const gchar *root = g_getenv("NETGRAPH_SYSFS_ROOT");
+	if (replay && *replay) {
+		const gchar *speed = g_getenv("NETGRAPH_REPLAY_SPEED");
+		if (replay_open(replay, speed ? g_ascii_strtod(speed, NULL) : 1.0)) {
+			source = SOURCE_REPLAY;
 		}
+	} else if (root && *root) {
+		g_debug("Reading the interfaces from %s.", root);
+		netdev_os_set_root(root);
+		source = SOURCE_SYSFS_ROOT;
 	}
+
+	g_once_init_leave(&initialized, 1);
 }
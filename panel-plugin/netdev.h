@@ -21,35 +21,164 @@
 
 #include <glib.h>
 
+#include "history.h"
+#include "rrd.h"
+
 G_BEGIN_DECLS
 
+/* When a sample was taken. */
 typedef struct {
-	gchar *name;  /* Interface name. */
+	gint64 monotonic;  /* Microseconds, not counting suspend. */
+	gint64 suspended;  /* Total time spent in suspend, in microseconds. */
+} NetdevTime;
 
+/* The counters that are only read when packets are counted. */
+typedef enum {
+	NETDEV_RX_PACKETS,
+	NETDEV_TX_PACKETS,
+	NETDEV_RX_DROPPED,
+	NETDEV_RX_ERRORS,
+	NETDEV_TX_ERRORS,
+	NETDEV_RX_MISSED_ERRORS,
+	NETDEV_N_COUNTERS,
+} NetdevCounter;
+
+/* A reading of the counters of an interface. */
+typedef struct {
+	gboolean is_up;
 	guint64 rx_bytes;
 	guint64 tx_bytes;
+	gboolean has_counters;  /* Whether `counters` were read. */
+	guint64 counters[NETDEV_N_COUNTERS];
+	NetdevTime time;
+} NetdevStats;
 
-	guint64 *hist_rx;  /* Download traffic. */
-	guint64 *hist_tx;  /* Upload traffic. */
-	guint64 max_rx;
-	guint64 max_tx;
-
-	guint down;  /* Number of updates when the interface was down. */
+/* Reads the counters of an interface.  Probes, as well as the functions
+ * that work on all the interfaces, must only be used from one thread. */
+typedef struct {
+	gchar *name;
+	gint ifindex;  /* Kernel interface index, 0 if not known. */
+	gboolean counters;  /* Whether to read the packet counters too. */
 
 #ifdef __linux__
-	gchar *rx_bytes_file;
-	gchar *tx_bytes_file;
+	/* The sysfs attribute files, kept open between updates. */
+	int operstate_fd;
+	int rx_bytes_fd;
+	int tx_bytes_fd;
+	int counter_fds[NETDEV_N_COUNTERS];  /* Only open with `counters`. */
 #endif
+} NetdevProbe;
+
+/* The packet rates that are graphed, when packets are counted. */
+typedef enum {
+	NETDEV_SERIES_RX_PACKETS,
+	NETDEV_SERIES_TX_PACKETS,
+	NETDEV_SERIES_DROPS,  /* Dropped and missed incoming packets. */
+	NETDEV_N_SERIES,
+} NetdevSeries;
+
+/* The packet counters of an interface, and the history of its packet
+ * rates. */
+typedef struct {
+	gboolean valid;  /* Whether `counters` hold a reading. */
+	guint64 counters[NETDEV_N_COUNTERS];
+	guint64 rates[NETDEV_N_COUNTERS];  /* Per second, at the last update. */
+
+	History *hist[NETDEV_N_SERIES];
+	Rrd *rrd[NETDEV_N_SERIES];
+} NetdevPackets;
+
+/* The traffic history of an interface, computed from the readings of its
+ * probe. */
+typedef struct {
+	gchar *name;  /* Interface name. */
+	gchar *name_markup;  /* Interface name, escaped for Pango markup. */
+	gint ifindex;  /* Kernel interface index, 0 if not known. */
+
+	guint64 rx_bytes;
+	guint64 tx_bytes;
+	NetdevTime time;  /* When the counters were read, 0 if never. */
+
+	History *hist_rx;  /* Download traffic. */
+	History *hist_tx;  /* Upload traffic. */
+	Rrd *rrd_rx;  /* Consolidated download traffic. */
+	Rrd *rrd_tx;
+	NetdevPackets *packets;  /* NULL unless packets are counted. */
+
+	guint down;  /* Number of samples since the interface went down. */
+	guint serial;  /* Of the last snapshot it was updated from. */
 } NetworkDevice;
 
+typedef enum {
+	NETDEV_LINK_NEW,     /* A link was added, or its state changed. */
+	NETDEV_LINK_DEL,     /* A link was removed. */
+	NETDEV_LINK_RESYNC,  /* Notifications were lost, re-enumerate. */
+} NetdevLinkEvent;
+
+typedef void (*NetdevLinkFunc)(NetdevLinkEvent event, gint ifindex,
+			       const gchar *name, gboolean is_up,
+			       gpointer user_data);
+
+/* Watches for links being added, removed or renamed, and calls `func` from
+ * the thread-default main context of the caller when that happens. */
+typedef struct _NetdevMonitor NetdevMonitor;
+
+
+/* The counters are normally read from the running system.  For tests and
+ * benchmarks, they can come from a directory laid out like /sys/class/net
+ * instead, or from a trace recorded earlier (see trace.h), played back
+ * `speed` times faster than it was recorded, or one sample per refresh if
+ * `speed` is 0.  Either must be set before any other netdev function is
+ * used.  The NETGRAPH_SYSFS_ROOT, or NETGRAPH_REPLAY and
+ * NETGRAPH_REPLAY_SPEED environment variables do the same for the plugin.
+ * Returns FALSE if the trace can't be loaded. */
+void netdev_set_sysfs_root(const gchar *root);
+gboolean netdev_set_replay(const gchar *path, gdouble speed);
+
+/* Takes a snapshot of the counters of all network devices, for the backends
+ * that can read them in a single batch.  Should be called once per update,
+ * before netdev_enumerate() and netdev_probe_read(). */
+void netdev_refresh(void);
+
+/* Reads the clocks that the stats are timestamped with. */
+void netdev_get_time(NetdevTime *time);
 
 /* Returns the list of network device names that are currently up. */
 GPtrArray *netdev_enumerate(void);
 
-NetworkDevice *netdev_new(gchar *name, gsize hist_len);
+/* Returns NULL if the OS can't notify about link changes, in which case
+ * the caller should poll netdev_enumerate() instead. */
+NetdevMonitor *netdev_monitor_new(NetdevLinkFunc func, gpointer user_data);
+void netdev_monitor_free(NetdevMonitor *this);
+
+NetdevProbe *netdev_probe_new(const gchar *name);
+void netdev_probe_free(NetdevProbe *this);
+void netdev_probe_rename(NetdevProbe *this, const gchar *name);
+void netdev_probe_read(NetdevProbe *this, NetdevStats *stats);
+
+/* Reads the packet, error and drop counters along with the byte counters,
+ * which costs nothing extra with rtnetlink, and a few more files per
+ * interface with sysfs. */
+void netdev_probe_set_counters(NetdevProbe *this, gboolean counters);
+
+NetworkDevice *netdev_new(const gchar *name, gsize hist_len);
 void netdev_free(NetworkDevice* this);
-void netdev_resize(NetworkDevice *this, gsize oldlen, gsize newlen);
-void netdev_update(NetworkDevice *this, gsize hist_len, guint interval);
+void netdev_rename(NetworkDevice *this, const gchar *name);
+void netdev_resize(NetworkDevice *this, gsize hist_len);
+
+/* Keeps all the histories compact, see history_set_compact() and
+ * rrd_set_compact(). */
+void netdev_set_compact(NetworkDevice *this, gboolean compact);
+
+/* Starts or stops keeping the history of the packet rates. */
+void netdev_count_packets(NetworkDevice *this, gboolean enable, gsize hist_len);
+
+/* Adds `ticks` samples, with the rate measured since the previous reading,
+ * or zeroes if `stats` is NULL because the interface is gone.  `now` and
+ * `interval` place them in the consolidated histories, and must be in
+ * milliseconds, from the same clock for all devices. */
+void netdev_update(NetworkDevice *this, const NetdevStats *stats,
+		   guint64 now, guint interval, guint ticks);
 
 G_END_DECLS
 
@@ -16,8 +16,40 @@
  *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 
+#ifdef ENABLE_NETLINK
+#include "netdev_netlink.c"
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SYSFS_PATH_MAX	256
+#define SYSFS_VALUE_MAX	32
+
+/* The sysfs attributes of the packet counters, in NetdevCounter order. */
+static const gchar *const counter_attrs[NETDEV_N_COUNTERS] = {
+	"statistics/rx_packets",
+	"statistics/tx_packets",
+	"statistics/rx_dropped",
+	"statistics/rx_errors",
+	"statistics/tx_errors",
+	"statistics/rx_missed_errors",
+};
+
+/* Where the interfaces are listed, changed by netdev_os_set_root(). */
+static const gchar *sysfs_root = "/sys/class/net";
+static gchar *sysfs_root_owned = NULL;  /* What sysfs_root points to, if set. */
+
+static gboolean sysfs_open(NetdevProbe *this);
+static void sysfs_close(NetdevProbe *this);
+static int open_attr(const gchar *devname, const gchar *attr);
+static gboolean read_attr(int fd, gchar *buf, gsize bufsize);
 static gboolean device_is_up(const gchar *devname);
-static guint64 read_u64_from_file(const gchar *filename);
+static gboolean attr_is_up(int fd);
+static guint64 attr_read_u64(int fd);
+static guint64 parse_u64(const gchar *str);
 static int strptrcmp(gconstpointer a, gconstpointer b);
 
 
@@ -25,12 +57,34 @@ static int strptrcmp(gconstpointer a, gconstpointer b);
 #pragma GCC diagnostic ignored "-Wdeclaration-after-statement"
 
 
-GPtrArray *netdev_enumerate(void)
+static void netdev_os_set_root(const gchar *root)
+{
+	g_free(sysfs_root_owned);
+	sysfs_root_owned = g_strdup(root);
+	sysfs_root = sysfs_root_owned;
+
+#ifdef ENABLE_NETLINK
+	/* rtnetlink would only ever show the running system. */
+	netlink_disabled = TRUE;
+#endif
+}
+
+static GPtrArray *netdev_os_enumerate(void)
 {
-	g_autoptr(GDir) dir = g_dir_open("/sys/class/net", 0, NULL);
+	GPtrArray *files = NULL;
+
+#ifdef ENABLE_NETLINK
+	files = netlink_enumerate();
+	if (files) {
+		g_ptr_array_sort(files, strptrcmp);
+		return files;
+	}
+#endif
+
+	g_autoptr(GDir) dir = g_dir_open(sysfs_root, 0, NULL);
 	if (!dir) return NULL;
 
-	GPtrArray *files = g_ptr_array_new_with_free_func(g_free);
+	files = g_ptr_array_new_with_free_func(g_free);
 
 	const gchar *file = NULL;
 	while ((file = g_dir_read_name(dir)) != NULL) {
@@ -46,45 +100,208 @@ GPtrArray *netdev_enumerate(void)
 	return files;
 }
 
-static void netdev_os_init(NetworkDevice *this)
+static void netdev_os_init(NetdevProbe *this)
 {
-	this->rx_bytes_file = g_strdup_printf("/sys/class/net/%s/statistics/rx_bytes", this->name);
-	this->tx_bytes_file = g_strdup_printf("/sys/class/net/%s/statistics/tx_bytes", this->name);
+	this->operstate_fd = -1;
+	this->rx_bytes_fd = -1;
+	this->tx_bytes_fd = -1;
+	for (gint i = 0; i < NETDEV_N_COUNTERS; i++) {
+		this->counter_fds[i] = -1;
+	}
+
+	int fd = open_attr(this->name, "ifindex");
+	guint64 ifindex = attr_read_u64(fd);
+	if (fd >= 0) close(fd);
+	this->ifindex = (ifindex <= G_MAXINT) ? ifindex : 0;
+
+#ifdef ENABLE_NETLINK
+	/* The sysfs files are opened on demand if rtnetlink is working. */
+	if (netlink_valid) return;
+#endif
+
+	sysfs_open(this);
 }
 
-static void netdev_os_free(NetworkDevice *this)
+static void netdev_os_free(NetdevProbe *this)
 {
-	g_free(this->rx_bytes_file);
-	g_free(this->tx_bytes_file);
+	sysfs_close(this);
 }
 
-static void netdev_os_read_stats(NetworkDevice *this, DeviceStats* stats)
+static void netdev_os_refresh(void)
 {
-	stats->is_up = device_is_up(this->name);
-	stats->rx_bytes = read_u64_from_file(this->rx_bytes_file);
-	stats->tx_bytes = read_u64_from_file(this->tx_bytes_file);
+#ifdef ENABLE_NETLINK
+	netlink_refresh();
+#endif
+}
+
+static void netdev_os_get_time(NetdevTime *time)
+{
+	struct timespec monotonic, boottime;
+	clock_gettime(CLOCK_MONOTONIC, &monotonic);
+
+	/* CLOCK_BOOTTIME keeps counting during suspend. */
+	if (clock_gettime(CLOCK_BOOTTIME, &boottime) == -1) boottime = monotonic;
+
+	time->monotonic = monotonic.tv_sec * G_USEC_PER_SEC + monotonic.tv_nsec / 1000;
+	time->suspended = boottime.tv_sec * G_USEC_PER_SEC + boottime.tv_nsec / 1000
+		- time->monotonic;
+}
+
+static void netdev_os_read_stats(NetdevProbe *this, NetdevStats *stats)
+{
+#ifdef ENABLE_NETLINK
+	if (netlink_read_stats(this, stats)) {
+		/* The sysfs files were only needed until the link showed up
+		 * in a dump. */
+		if (this->operstate_fd >= 0) sysfs_close(this);
+		return;
+	}
+#endif
+
+	netdev_os_get_time(&stats->time);
+
+	/* Keep trying to open the files of devices that don't exist (yet). */
+	if (this->operstate_fd < 0 && !sysfs_open(this)) {
+		stats->is_up = FALSE;
+		stats->has_counters = FALSE;
+		stats->rx_bytes = G_MAXUINT64;
+		stats->tx_bytes = G_MAXUINT64;
+		return;
+	}
+
+	stats->is_up = attr_is_up(this->operstate_fd);
+	stats->rx_bytes = attr_read_u64(this->rx_bytes_fd);
+	stats->tx_bytes = attr_read_u64(this->tx_bytes_fd);
+
+	/* Read in the same pass, so that all the counters of a snapshot
+	 * are from the same moment. */
+	stats->has_counters = this->counters;
+	for (gint i = 0; i < NETDEV_N_COUNTERS; i++) {
+		stats->counters[i] = 0;
+		if (!this->counters || this->counter_fds[i] < 0) continue;
+
+		stats->counters[i] = attr_read_u64(this->counter_fds[i]);
+		if (stats->counters[i] == G_MAXUINT64) stats->has_counters = FALSE;
+	}
+
+	if (stats->rx_bytes == G_MAXUINT64 || stats->tx_bytes == G_MAXUINT64) {
+		/* Whatever was read doesn't make a valid sample.  The device
+		 * was probably removed, so the files need to be reopened in
+		 * case it comes back. */
+		stats->is_up = FALSE;
+		stats->has_counters = FALSE;
+		sysfs_close(this);
+	}
+}
+
+static NetdevMonitor *netdev_os_monitor_new(NetdevLinkFunc func, gpointer user_data)
+{
+#ifdef ENABLE_NETLINK
+	return netlink_monitor_new(func, user_data);
+#else
+	return NULL;
+#endif
+}
+
+static void netdev_os_monitor_free(NetdevMonitor *this)
+{
+#ifdef ENABLE_NETLINK
+	netlink_monitor_free(this);
+#endif
+}
+
+static gboolean sysfs_open(NetdevProbe *this)
+{
+	this->operstate_fd = open_attr(this->name, "operstate");
+	this->rx_bytes_fd = open_attr(this->name, "statistics/rx_bytes");
+	this->tx_bytes_fd = open_attr(this->name, "statistics/tx_bytes");
+
+	if (this->operstate_fd < 0 || this->rx_bytes_fd < 0 || this->tx_bytes_fd < 0) {
+		sysfs_close(this);
+		return FALSE;
+	}
+
+	/* Some drivers don't have all the counters, which then read as 0. */
+	for (gint i = 0; this->counters && i < NETDEV_N_COUNTERS; i++) {
+		this->counter_fds[i] = open_attr(this->name, counter_attrs[i]);
+	}
+	return TRUE;
+}
+
+static void sysfs_close(NetdevProbe *this)
+{
+	if (this->operstate_fd >= 0) close(this->operstate_fd);
+	if (this->rx_bytes_fd >= 0) close(this->rx_bytes_fd);
+	if (this->tx_bytes_fd >= 0) close(this->tx_bytes_fd);
+	this->operstate_fd = -1;
+	this->rx_bytes_fd = -1;
+	this->tx_bytes_fd = -1;
+
+	for (gint i = 0; i < NETDEV_N_COUNTERS; i++) {
+		if (this->counter_fds[i] >= 0) close(this->counter_fds[i]);
+		this->counter_fds[i] = -1;
+	}
+}
+
+static int open_attr(const gchar *devname, const gchar *attr)
+{
+	gchar path[SYSFS_PATH_MAX];
+	if (g_snprintf(path, sizeof(path), "%s/%s/%s", sysfs_root, devname, attr) >= (gint)sizeof(path))
+		return -1;
+
+	return open(path, O_RDONLY | O_CLOEXEC);
+}
+
+/* Rereads a sysfs attribute from the start, as a NUL-terminated string. */
+static gboolean read_attr(int fd, gchar *buf, gsize bufsize)
+{
+	if (fd < 0) return FALSE;
+
+	gssize len;
+	do {
+		len = pread(fd, buf, bufsize - 1, 0);
+		INSTRUMENT_SYSCALLS(1);
+	} while (len < 0 && errno == EINTR);
+	if (len < 0) return FALSE;
+
+	buf[len] = '\0';
+	return TRUE;
 }
 
 static gboolean device_is_up(const gchar *devname)
 {
-	g_autofree gchar *state_file = g_strdup_printf("/sys/class/net/%s/operstate", devname);
+	int fd = open_attr(devname, "operstate");
+	gboolean is_up = attr_is_up(fd);
+	if (fd >= 0) close(fd);
+
+	return is_up;
+}
 
-	g_autofree gchar *contents = NULL;
-	gsize len;
-	if (!g_file_get_contents(state_file, &contents, &len, NULL))
+static gboolean attr_is_up(int fd)
+{
+	gchar buf[SYSFS_VALUE_MAX];
+	if (!read_attr(fd, buf, sizeof(buf)))
 		return FALSE;
 
-	return (g_strcmp0(contents, "up\n") == 0);
+	return (g_strcmp0(buf, "up\n") == 0);
 }
 
-static guint64 read_u64_from_file(const gchar *filename)
+static guint64 attr_read_u64(int fd)
 {
-	g_autofree gchar *contents = NULL;
-	gsize len;
-	if (!g_file_get_contents(filename, &contents, &len, NULL))
+	gchar buf[SYSFS_VALUE_MAX];
+	if (!read_attr(fd, buf, sizeof(buf)))
 		return G_MAXUINT64;
 
-	return g_ascii_strtoull(contents, NULL, 10);
+	return parse_u64(buf);
+}
+
+static guint64 parse_u64(const gchar *str)
+{
+	guint64 value = 0;
+	for (; *str >= '0' && *str <= '9'; str++) {
+		value = value * 10 + (*str - '0');
+	}
+	return value;
 }
 
 static int strptrcmp(gconstpointer a, gconstpointer b)
@@ -0,0 +1,399 @@
+/*
+ *  Copyright (C) 2019 David Lazar <dlazar@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* rtnetlink backend: a single RTM_GETLINK dump over a persistent socket
+ * returns the state and counters of every link at once.  The results are
+ * cached until the next netdev_refresh(), and the sysfs code is used as a
+ * fallback whenever there's no valid dump.
+ *
+ * A second socket subscribed to RTNLGRP_LINK implements NetdevMonitor. */
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <linux/if.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <glib-unix.h>
+
+#define NETLINK_BUFSIZE	32768
+
+typedef struct {
+	gint ifindex;
+	gchar name[IFNAMSIZ];
+	NetdevStats stats;
+	guint generation;  /* The last dump that reported this link. */
+} NetlinkLink;
+
+struct _NetdevMonitor {
+	int fd;
+	GSource *source;
+	NetdevLinkFunc func;
+	gpointer user_data;
+};
+
+static int netlink_fd = -1;
+static gboolean netlink_disabled = FALSE;
+static gboolean netlink_valid = FALSE;  /* Whether the last dump succeeded. */
+static guint32 netlink_seq = 0;
+static guint netlink_generation = 0;
+static NetdevTime netlink_time;  /* When the last dump was requested. */
+static GHashTable *netlink_links = NULL;  /* ifindex -> NetlinkLink. */
+static GHashTable *netlink_names = NULL;  /* Interface name -> NetlinkLink. */
+
+static gboolean netlink_open(void);
+static void netlink_close(void);
+static void netlink_refresh(void);
+static gboolean netlink_dump_links(void);
+static void netlink_parse_link(struct nlmsghdr *nh);
+static gint netlink_parse_ifinfo(struct nlmsghdr *nh, const gchar **name,
+				 guint8 *operstate, struct rtnl_link_stats64 *stats64);
+static gboolean netlink_read_stats(NetdevProbe *dev, NetdevStats *stats);
+static GPtrArray *netlink_enumerate(void);
+static NetdevMonitor *netlink_monitor_new(NetdevLinkFunc func, gpointer user_data);
+static void netlink_monitor_free(NetdevMonitor *this);
+static gboolean on_netlink_monitor_event(gint fd, GIOCondition condition, NetdevMonitor *this);
+
+
+// Allow variable declarations at the first use.
+#pragma GCC diagnostic ignored "-Wdeclaration-after-statement"
+
+
+static gboolean netlink_open(void)
+{
+	if (g_strcmp0(g_getenv("NETGRAPH_BACKEND"), "sysfs") == 0) {
+		g_debug("Using the sysfs backend, as requested.");
+		return FALSE;
+	}
+
+	netlink_fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+	if (netlink_fd < 0) {
+		g_warning("Could not open rtnetlink socket: %s.  Using sysfs.",
+			  g_strerror(errno));
+		return FALSE;
+	}
+
+	struct sockaddr_nl addr = { .nl_family = AF_NETLINK };
+	if (bind(netlink_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		g_warning("Could not bind rtnetlink socket: %s.  Using sysfs.",
+			  g_strerror(errno));
+		netlink_close();
+		return FALSE;
+	}
+
+	if (!netlink_links) {
+		netlink_links = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+						      NULL, g_free);
+		netlink_names = g_hash_table_new(g_str_hash, g_str_equal);
+	}
+
+	return TRUE;
+}
+
+static void netlink_close(void)
+{
+	if (netlink_fd >= 0) close(netlink_fd);
+	netlink_fd = -1;
+	netlink_valid = FALSE;
+}
+
+static void netlink_refresh(void)
+{
+	if (netlink_disabled) return;
+
+	if (netlink_fd < 0 && !netlink_open()) {
+		netlink_disabled = TRUE;
+		return;
+	}
+
+	netlink_valid = netlink_dump_links();
+	if (!netlink_valid) {
+		/* Reopen the socket on the next refresh, in case it got into a
+		 * bad state.  Until then, the sysfs code takes over. */
+		g_debug("rtnetlink dump failed: %s.", g_strerror(errno));
+		netlink_close();
+	}
+}
+
+static gboolean netlink_dump_links(void)
+{
+	struct {
+		struct nlmsghdr nh;
+		struct ifinfomsg ifi;
+	} req;
+	memset(&req, 0, sizeof(req));
+	req.nh.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
+	req.nh.nlmsg_type = RTM_GETLINK;
+	req.nh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+	req.nh.nlmsg_seq = ++netlink_seq;
+	req.ifi.ifi_family = AF_UNSPEC;
+
+	netdev_os_get_time(&netlink_time);
+	INSTRUMENT_SYSCALLS(1);
+	if (send(netlink_fd, &req, req.nh.nlmsg_len, 0) < 0) return FALSE;
+
+	netlink_generation++;
+
+	static guint8 buf[NETLINK_BUFSIZE] __attribute__((aligned(NLMSG_ALIGNTO)));
+	for (;;) {
+		int len = recv(netlink_fd, buf, sizeof(buf), 0);
+		INSTRUMENT_SYSCALLS(1);
+		if (len < 0) {
+			if (errno == EINTR) continue;
+			return FALSE;
+		}
+		if (len == 0) return FALSE;
+
+		for (struct nlmsghdr *nh = (struct nlmsghdr *)buf;
+		     NLMSG_OK(nh, len);
+		     nh = NLMSG_NEXT(nh, len)) {
+			if (nh->nlmsg_seq != netlink_seq) continue;
+
+			if (nh->nlmsg_type == NLMSG_DONE) {
+				/* Forget about the links that disappeared. */
+				GHashTableIter iter;
+				NetlinkLink *link;
+				g_hash_table_iter_init(&iter, netlink_links);
+				while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&link)) {
+					if (link->generation != netlink_generation) {
+						/* Another link may have taken the name. */
+						if (g_hash_table_lookup(netlink_names, link->name) == link) {
+							g_hash_table_remove(netlink_names, link->name);
+						}
+						g_hash_table_iter_remove(&iter);
+					}
+				}
+				return TRUE;
+			}
+			if (nh->nlmsg_type == NLMSG_ERROR) {
+				struct nlmsgerr *err = NLMSG_DATA(nh);
+				errno = -err->error;
+				return FALSE;
+			}
+			if (nh->nlmsg_type == RTM_NEWLINK) {
+				netlink_parse_link(nh);
+			}
+		}
+	}
+}
+
+static void netlink_parse_link(struct nlmsghdr *nh)
+{
+	const gchar *name = NULL;
+	guint8 operstate;
+	struct rtnl_link_stats64 stats64;
+	gint ifindex = netlink_parse_ifinfo(nh, &name, &operstate, &stats64);
+	if (!name) return;
+
+	NetlinkLink *link = g_hash_table_lookup(netlink_links, GINT_TO_POINTER(ifindex));
+	if (!link) {
+		link = g_new0(NetlinkLink, 1);
+		link->ifindex = ifindex;
+		g_hash_table_insert(netlink_links, GINT_TO_POINTER(ifindex), link);
+	}
+	if (g_strcmp0(link->name, name) != 0) {
+		/* The link is new, or it was renamed. */
+		if (g_hash_table_lookup(netlink_names, link->name) == link) {
+			g_hash_table_remove(netlink_names, link->name);
+		}
+		g_strlcpy(link->name, name, sizeof(link->name));
+		/* Replaces the key too, as another link may still own the
+		 * old one. */
+		g_hash_table_replace(netlink_names, link->name, link);
+	}
+
+	link->generation = netlink_generation;
+	link->stats.is_up = (operstate == IF_OPER_UP);
+	link->stats.rx_bytes = stats64.rx_bytes;
+	link->stats.tx_bytes = stats64.tx_bytes;
+
+	/* The packet counters come with the same dump, so they're always
+	 * kept. */
+	link->stats.has_counters = TRUE;
+	link->stats.counters[NETDEV_RX_PACKETS] = stats64.rx_packets;
+	link->stats.counters[NETDEV_TX_PACKETS] = stats64.tx_packets;
+	link->stats.counters[NETDEV_RX_DROPPED] = stats64.rx_dropped;
+	link->stats.counters[NETDEV_RX_ERRORS] = stats64.rx_errors;
+	link->stats.counters[NETDEV_TX_ERRORS] = stats64.tx_errors;
+	link->stats.counters[NETDEV_RX_MISSED_ERRORS] = stats64.rx_missed_errors;
+	link->stats.time = netlink_time;
+}
+
+/* Parses an RTM_NEWLINK or RTM_DELLINK message, and returns the ifindex. */
+static gint netlink_parse_ifinfo(struct nlmsghdr *nh, const gchar **name,
+				 guint8 *operstate, struct rtnl_link_stats64 *stats64)
+{
+	struct ifinfomsg *ifi = NLMSG_DATA(nh);
+	*name = NULL;
+	*operstate = IF_OPER_UNKNOWN;
+	memset(stats64, 0, sizeof(*stats64));
+
+	int len = IFLA_PAYLOAD(nh);
+	for (struct rtattr *rta = IFLA_RTA(ifi); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		switch (rta->rta_type) {
+		case IFLA_IFNAME:
+			*name = RTA_DATA(rta);
+			break;
+		case IFLA_OPERSTATE:
+			*operstate = *(guint8 *)RTA_DATA(rta);
+			break;
+		case IFLA_STATS64:
+			/* The payload is not necessarily 64-bit aligned. */
+			memcpy(stats64, RTA_DATA(rta),
+			       MIN(sizeof(*stats64), RTA_PAYLOAD(rta)));
+			break;
+		}
+	}
+
+	return ifi->ifi_index;
+}
+
+static gboolean netlink_read_stats(NetdevProbe *dev, NetdevStats *stats)
+{
+	if (!netlink_valid) return FALSE;
+
+	NetlinkLink *link = NULL;
+	if (dev->ifindex > 0) {
+		link = g_hash_table_lookup(netlink_links, GINT_TO_POINTER(dev->ifindex));
+	}
+	if (!link) {
+		link = g_hash_table_lookup(netlink_names, dev->name);
+		/* The link didn't exist when the device was created, or it was
+		 * re-created since then. */
+		if (link) dev->ifindex = link->ifindex;
+	}
+	if (!link) {
+		/* The link is either gone, or so new that it's not in the last
+		 * dump yet.  Let the sysfs code figure out which. */
+		return FALSE;
+	}
+
+	*stats = link->stats;
+	return TRUE;
+}
+
+static GPtrArray *netlink_enumerate(void)
+{
+	if (!netlink_valid) return NULL;
+
+	GPtrArray *names = g_ptr_array_new_with_free_func(g_free);
+
+	GHashTableIter iter;
+	NetlinkLink *link;
+	g_hash_table_iter_init(&iter, netlink_links);
+	while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&link)) {
+		if (g_strcmp0(link->name, "lo") == 0) continue;
+
+		if (!link->stats.is_up) continue;
+
+		g_ptr_array_add(names, g_strdup(link->name));
+	}
+
+	return names;
+}
+
+static NetdevMonitor *netlink_monitor_new(NetdevLinkFunc func, gpointer user_data)
+{
+	int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_ROUTE);
+	if (fd < 0) {
+		g_warning("Could not open rtnetlink socket: %s.", g_strerror(errno));
+		return NULL;
+	}
+
+	struct sockaddr_nl addr = {
+		.nl_family = AF_NETLINK,
+		.nl_groups = RTMGRP_LINK,
+	};
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		g_warning("Could not subscribe to link notifications: %s.",
+			  g_strerror(errno));
+		close(fd);
+		return NULL;
+	}
+
+	NetdevMonitor *this = g_slice_new0(NetdevMonitor);
+	this->fd = fd;
+	this->func = func;
+	this->user_data = user_data;
+
+	/* Deliver the notifications in the thread that asked for them. */
+	this->source = g_unix_fd_source_new(fd, G_IO_IN);
+	g_source_set_callback(this->source,
+		(GSourceFunc)on_netlink_monitor_event, this, NULL);
+	g_source_attach(this->source, g_main_context_get_thread_default());
+
+	return this;
+}
+
+static void netlink_monitor_free(NetdevMonitor *this)
+{
+	g_source_destroy(this->source);
+	g_source_unref(this->source);
+	close(this->fd);
+
+	g_slice_free(NetdevMonitor, this);
+}
+
+static gboolean on_netlink_monitor_event(gint fd,
+					 GIOCondition condition,
+					 NetdevMonitor *this)
+{
+	static guint8 buf[NETLINK_BUFSIZE] __attribute__((aligned(NLMSG_ALIGNTO)));
+	for (;;) {
+		int len = recv(fd, buf, sizeof(buf), 0);
+		INSTRUMENT_SYSCALLS(1);
+		if (len < 0) {
+			if (errno == EINTR) continue;
+			if (errno == ENOBUFS) {
+				/* The socket buffer overflowed, so some
+				 * notifications were lost. */
+				this->func(NETDEV_LINK_RESYNC, 0, NULL, FALSE, this->user_data);
+				continue;
+			}
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				g_warning("Error reading link notifications: %s.",
+					  g_strerror(errno));
+			}
+			break;
+		}
+
+		for (struct nlmsghdr *nh = (struct nlmsghdr *)buf;
+		     NLMSG_OK(nh, len);
+		     nh = NLMSG_NEXT(nh, len)) {
+			if (nh->nlmsg_type != RTM_NEWLINK && nh->nlmsg_type != RTM_DELLINK) {
+				continue;
+			}
+
+			const gchar *name = NULL;
+			guint8 operstate;
+			struct rtnl_link_stats64 stats64;
+			gint ifindex = netlink_parse_ifinfo(nh, &name, &operstate, &stats64);
+			if (!name) continue;
+
+			if (nh->nlmsg_type == RTM_NEWLINK) {
+				this->func(NETDEV_LINK_NEW, ifindex, name,
+					   operstate == IF_OPER_UP, this->user_data);
+			} else {
+				this->func(NETDEV_LINK_DEL, ifindex, name,
+					   FALSE, this->user_data);
+			}
+		}
+	}
+
+	return G_SOURCE_CONTINUE;
+}
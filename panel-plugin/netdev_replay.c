@@ -0,0 +1,127 @@
+/*
+ *  Copyright (C) 2019 David Lazar <dlazar@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Plays back a recorded trace, in place of the OS-specific backend.  The
+ * sample that is current at each netdev_refresh() is picked by how much
+ * time passed since the first one, scaled by the replay speed, or is just
+ * the next one if the speed is 0.  The last sample is held when the trace
+ * runs out. */
+
+#include "trace.h"
+
+static Trace *replay_trace = NULL;
+static gdouble replay_speed = 1.0;
+static guint replay_pos = 0;
+static gint64 replay_start = -1;  /* Monotonic time of the first refresh. */
+
+static gboolean replay_open(const gchar *path, gdouble speed);
+static void replay_refresh(void);
+static void replay_get_time(NetdevTime *time);
+static void replay_init(NetdevProbe *this);
+static void replay_read_stats(NetdevProbe *this, NetdevStats *stats);
+static GPtrArray *replay_enumerate(void);
+
+
+// Allow variable declarations at the first use.
+#pragma GCC diagnostic ignored "-Wdeclaration-after-statement"
+
+
+static gboolean replay_open(const gchar *path, gdouble speed)
+{
+	Trace *trace = trace_load(path);
+	if (!trace) return FALSE;
+
+	trace_free(replay_trace);
+	replay_trace = trace;
+	replay_speed = MAX(speed, 0.0);
+	replay_pos = 0;
+	replay_start = -1;
+
+	g_debug("Replaying %u samples from %s.", trace->frames->len, path);
+	return TRUE;
+}
+
+static void replay_refresh(void)
+{
+	GArray *frames = replay_trace->frames;
+
+	if (replay_start < 0) {
+		replay_start = g_get_monotonic_time();
+		return;
+	}
+
+	if (replay_speed == 0.0) {
+		if (replay_pos + 1 < frames->len) replay_pos++;
+		return;
+	}
+
+	gint64 elapsed = (g_get_monotonic_time() - replay_start) * replay_speed;
+	gint64 target = g_array_index(frames, TraceFrame, 0).time.monotonic + elapsed;
+	while (replay_pos + 1 < frames->len &&
+	       g_array_index(frames, TraceFrame, replay_pos + 1).time.monotonic <= target) {
+		replay_pos++;
+	}
+}
+
+/* The time of the current sample, so that rates come out as they were
+ * recorded, whatever the speed. */
+static void replay_get_time(NetdevTime *time)
+{
+	*time = g_array_index(replay_trace->frames, TraceFrame, replay_pos).time;
+}
+
+static void replay_init(NetdevProbe *this)
+{
+	const TraceLink *link = trace_find_link(replay_trace, replay_pos, this->name);
+	this->ifindex = link ? link->ifindex : 0;
+}
+
+static void replay_read_stats(NetdevProbe *this, NetdevStats *stats)
+{
+	const TraceLink *link = trace_find_link(replay_trace, replay_pos, this->name);
+	if (!link) {
+		/* Same as a device that doesn't exist. */
+		replay_get_time(&stats->time);
+		stats->is_up = FALSE;
+		stats->rx_bytes = G_MAXUINT64;
+		stats->tx_bytes = G_MAXUINT64;
+		return;
+	}
+
+	this->ifindex = link->ifindex;
+	*stats = link->stats;
+}
+
+static GPtrArray *replay_enumerate(void)
+{
+	const TraceFrame *frame = &g_array_index(replay_trace->frames, TraceFrame, replay_pos);
+	GPtrArray *names = g_ptr_array_new_with_free_func(g_free);
+
+	/* The links of a sample are sorted already. */
+	for (guint i = 0; i < frame->n_links; i++) {
+		const TraceLink *link = &g_array_index(replay_trace->links, TraceLink,
+						       frame->first_link + i);
+		if (g_strcmp0(link->name, "lo") == 0) continue;
+
+		if (!link->stats.is_up) continue;
+
+		g_ptr_array_add(names, g_strdup(link->name));
+	}
+
+	return names;
+}
@@ -25,12 +25,16 @@
 #include <string.h>
 #endif
 
+#include <glib/gstdio.h>
 #include <gtk/gtk.h>
 #include <libxfce4util/libxfce4util.h>
 #include <libxfce4panel/libxfce4panel.h>
 
 #include "dialogs.h"
+#include "filter.h"
+#include "instrument.h"
 #include "netdev.h"
+#include "tooltip.h"
 
 #undef G_LOG_DOMAIN
 #define G_LOG_DOMAIN	"netgraph"
@@ -41,24 +45,40 @@
 #define DEFAULT_BG_COLOR	"rgba(0,0,0,0)"
 #define DEFAULT_RX_COLOR	"rgb(16,80,73)"
 #define DEFAULT_TX_COLOR	"rgb(170,83,8)"
+#define DEFAULT_DROP_COLOR	"rgb(200,0,0)"
 #define DEFAULT_UPDATE_INTERVAL	1000	/* milliseconds */
+#define MIN_UPDATE_INTERVAL	50	/* milliseconds */
+#define DEFAULT_ADAPTIVE_INTERVAL	FALSE
 #define DEFAULT_MIN_SCALE	5120	/* bytes/second */
+#define DEFAULT_AUTOSCALE	AUTOSCALE_DEVICE_PEAKS
+#define DEFAULT_SCALE_MODE	SCALE_LINEAR
+#define DEFAULT_STACKED	FALSE
+#define DEFAULT_GRAPH_TIER	GRAPH_TIER_RAW
+#define DEFAULT_PERSIST_HISTORY	FALSE
+#define DEFAULT_COUNT_PACKETS	FALSE
+#define DEFAULT_SHOW_PACKETS	FALSE
+#define DEFAULT_EXPORT_METRICS	FALSE
+#define DEFAULT_COMPACT_HISTORY	FALSE
 
 
 static void netgraph_construct(XfcePanelPlugin *plugin);
 static NetgraphPlugin *netgraph_new(XfcePanelPlugin *plugin);
 static void netgraph_free(XfcePanelPlugin *plugin, NetgraphPlugin *this);
 static void netgraph_load(NetgraphPlugin *this);
+static void on_removed(XfcePanelPlugin *plugin, NetgraphPlugin *this);
+static gchar *get_histfile_path(NetgraphPlugin *this);
+static void open_histfile(NetgraphPlugin *this);
+static void close_histfile(NetgraphPlugin *this);
 static void on_draw(GtkWidget *widget, cairo_t *cr, NetgraphPlugin *this);
-static gdouble get_rx_fraction(NetgraphPlugin *this, gsize idx);
-static gdouble get_tx_fraction(NetgraphPlugin *this, gsize idx);
+static void get_graph_size(NetgraphPlugin *this, guint *w, guint *h);
+static gboolean on_frame(GtkWidget *widget, GdkFrameClock *clock, NetgraphPlugin *this);
 static gboolean on_size_changed(XfcePanelPlugin *plugin, guint size, NetgraphPlugin *this);
 static void on_orientation_changed(XfcePanelPlugin *plugin, GtkOrientation orientation, NetgraphPlugin *this);
-static gboolean on_update(NetgraphPlugin *this);
-static void update_netdev_list(NetgraphPlugin *this);
-static void update_netdev_stats(NetgraphPlugin *this);
-static void update_tooltip(NetgraphPlugin *this);
-static gchar *format_human_size(guint64 num, gchar *buf, gsize bufsize);
+static void configure_sampler(NetgraphPlugin *this);
+static void on_snapshot(const SamplerSnapshot *snapshot, NetgraphPlugin *this);
+static gboolean on_query_tooltip(GtkWidget *widget, gint x, gint y, gboolean keyboard_mode, GtkTooltip *tooltip, NetgraphPlugin *this);
+static gboolean on_leave(GtkWidget *widget, GdkEventCrossing *event, NetgraphPlugin *this);
+static gboolean update_tooltip(NetgraphPlugin *this);
 
 
 // Allow variable declarations at the first use.
@@ -73,6 +93,7 @@ static void netgraph_construct(XfcePanelPlugin *plugin)
 
 	g_signal_connect(plugin, "free-data", G_CALLBACK(netgraph_free), this);
 	g_signal_connect(plugin, "save", G_CALLBACK(netgraph_save), this);
+	g_signal_connect(plugin, "removed", G_CALLBACK(on_removed), this);
 	g_signal_connect(plugin, "size-changed", G_CALLBACK(on_size_changed), this);
 	g_signal_connect(plugin, "orientation-changed", G_CALLBACK(on_orientation_changed), this);
 	g_signal_connect(plugin, "configure-plugin", G_CALLBACK(netgraph_configure), this);
@@ -88,6 +109,7 @@ static NetgraphPlugin *netgraph_new(XfcePanelPlugin *plugin)
 {
 	NetgraphPlugin *this = g_slice_new0(NetgraphPlugin);
 	this->plugin = plugin;
+	this->sampler = sampler_new((SamplerFunc)on_snapshot, this);
 
 	this->ebox = gtk_event_box_new();
 	gtk_event_box_set_visible_window(GTK_EVENT_BOX(this->ebox), FALSE);
@@ -105,18 +127,35 @@ static NetgraphPlugin *netgraph_new(XfcePanelPlugin *plugin)
 	gtk_container_add(GTK_CONTAINER(this->frame), this->draw_area);
 	g_signal_connect_after(this->draw_area, "draw", G_CALLBACK(on_draw), this);
 
-	this->devs = g_ptr_array_new_with_free_func((GDestroyNotify)netdev_free);
+	this->traffic = traffic_new();
+	this->graph = graph_new(this->traffic);
+	this->tooltip = g_string_new("");
+	this->tooltip_next = g_string_new("");
+	this->tooltip_updates = G_MAXUINT64;  /* Not formatted yet. */
+	this->tooltip_label = g_object_ref_sink(gtk_label_new(NULL));
+	gtk_widget_show(this->tooltip_label);
+	gtk_widget_set_has_tooltip(this->box, TRUE);
+	g_signal_connect(this->box, "query-tooltip", G_CALLBACK(on_query_tooltip), this);
+	gtk_widget_add_events(this->ebox, GDK_LEAVE_NOTIFY_MASK);
+	g_signal_connect(this->ebox, "leave-notify-event", G_CALLBACK(on_leave), this);
 
 	netgraph_load(this);
 
+	/* The histories need the interval before the sampler is set up. */
+	this->traffic->interval = this->update_interval;
+
 	netgraph_set_size(this, this->size);
 	netgraph_set_has_frame(this, this->has_frame);
 	netgraph_set_has_border(this, this->has_border);
 	netgraph_set_dev_names(this, this->dev_names);
+	graph_set_dev_colors(this->graph, this->dev_colors);
+	traffic_count_packets(this->traffic, this->count_packets);
+	traffic_set_compact(this->traffic, this->compact_history);
+	netgraph_set_export_metrics(this, this->export_metrics);
 
 	gtk_widget_show_all(this->ebox);
 
-	/* This must be called last, as it starts the update timer. */
+	/* This must be called last, as it sets the sampling interval. */
 	netgraph_set_update_interval(this, this->update_interval);
 
 	return this;
@@ -124,29 +163,55 @@ static NetgraphPlugin *netgraph_new(XfcePanelPlugin *plugin)
 
 static void netgraph_free(XfcePanelPlugin *plugin, NetgraphPlugin *this)
 {
-	if (this->timeout_id) g_source_remove(this->timeout_id);
+	sampler_free(this->sampler);
+	if (this->exporter) exporter_free(this->exporter);
 
 	gtk_widget_destroy(this->ebox);
 
-	g_ptr_array_free(this->devs, TRUE);
+	g_debug("Redrew the graph %" G_GUINT64_FORMAT " times in %" G_GUINT64_FORMAT " updates.",
+		this->graph->redraws, this->traffic->updates);
+	INSTRUMENT_DUMP();
+
+	graph_free(this->graph);
+	traffic_free(this->traffic);
+	gtk_widget_destroy(this->tooltip_label);
+	g_object_unref(this->tooltip_label);
+	g_string_free(this->tooltip, TRUE);
+	g_string_free(this->tooltip_next, TRUE);
 
 	g_free(this->dev_names);
+	g_free(this->dev_colors);
 
 	g_slice_free(NetgraphPlugin, this);
 }
 
 static void netgraph_load(NetgraphPlugin *this)
 {
+	Graph *graph = this->graph;
+
 	this->size = DEFAULT_SIZE;
 	this->has_frame = DEFAULT_HAS_FRAME;
 	this->has_border = DEFAULT_HAS_BORDER;
-	gdk_rgba_parse(&this->bg_color, DEFAULT_BG_COLOR);
-	gdk_rgba_parse(&this->rx_color, DEFAULT_RX_COLOR);
-	gdk_rgba_parse(&this->tx_color, DEFAULT_TX_COLOR);
+	gdk_rgba_parse(&graph->bg_color, DEFAULT_BG_COLOR);
+	gdk_rgba_parse(&graph->rx_color, DEFAULT_RX_COLOR);
+	gdk_rgba_parse(&graph->tx_color, DEFAULT_TX_COLOR);
+	gdk_rgba_parse(&graph->drop_color, DEFAULT_DROP_COLOR);
 	this->update_interval = DEFAULT_UPDATE_INTERVAL;
-	this->min_scale = DEFAULT_MIN_SCALE;
+	this->adaptive_interval = DEFAULT_ADAPTIVE_INTERVAL;
+	graph->min_scale = DEFAULT_MIN_SCALE;
+	graph->autoscale = DEFAULT_AUTOSCALE;
+	graph->scale_mode = DEFAULT_SCALE_MODE;
+	graph->stacked = DEFAULT_STACKED;
+	graph->tier = DEFAULT_GRAPH_TIER;
+	this->persist_history = DEFAULT_PERSIST_HISTORY;
+	this->count_packets = DEFAULT_COUNT_PACKETS;
+	graph->show_packets = DEFAULT_SHOW_PACKETS;
+	this->export_metrics = DEFAULT_EXPORT_METRICS;
+	this->compact_history = DEFAULT_COMPACT_HISTORY;
 	g_free(this->dev_names);
 	this->dev_names = NULL;
+	g_free(this->dev_colors);
+	this->dev_colors = NULL;
 
 	g_autofree gchar *file =
 		xfce_panel_plugin_lookup_rc_file(this->plugin);
@@ -158,17 +223,36 @@ static void netgraph_load(NetgraphPlugin *this)
 	this->size = xfce_rc_read_int_entry(rc, "size", DEFAULT_SIZE);
 	this->has_frame = !!xfce_rc_read_int_entry(rc, "has_frame", DEFAULT_HAS_FRAME);
 	this->has_border = !!xfce_rc_read_int_entry(rc, "has_border", DEFAULT_HAS_BORDER);
-	gdk_rgba_parse(&this->bg_color, xfce_rc_read_entry(rc, "bg_color", DEFAULT_BG_COLOR));
-	gdk_rgba_parse(&this->rx_color, xfce_rc_read_entry(rc, "rx_color", DEFAULT_RX_COLOR));
-	gdk_rgba_parse(&this->tx_color, xfce_rc_read_entry(rc, "tx_color", DEFAULT_TX_COLOR));
+	gdk_rgba_parse(&graph->bg_color, xfce_rc_read_entry(rc, "bg_color", DEFAULT_BG_COLOR));
+	gdk_rgba_parse(&graph->rx_color, xfce_rc_read_entry(rc, "rx_color", DEFAULT_RX_COLOR));
+	gdk_rgba_parse(&graph->tx_color, xfce_rc_read_entry(rc, "tx_color", DEFAULT_TX_COLOR));
+	gdk_rgba_parse(&graph->drop_color, xfce_rc_read_entry(rc, "drop_color", DEFAULT_DROP_COLOR));
 	this->update_interval = xfce_rc_read_int_entry(rc, "update_interval", DEFAULT_UPDATE_INTERVAL);
-	this->min_scale = xfce_rc_read_int_entry(rc, "min_scale", DEFAULT_MIN_SCALE);
+	if (this->update_interval < MIN_UPDATE_INTERVAL) this->update_interval = MIN_UPDATE_INTERVAL;
+	this->adaptive_interval = !!xfce_rc_read_int_entry(rc, "adaptive_interval", DEFAULT_ADAPTIVE_INTERVAL);
+	graph->min_scale = xfce_rc_read_int_entry(rc, "min_scale", DEFAULT_MIN_SCALE);
+	graph->autoscale = xfce_rc_read_int_entry(rc, "autoscale", DEFAULT_AUTOSCALE);
+	if (graph->autoscale > AUTOSCALE_P95) graph->autoscale = DEFAULT_AUTOSCALE;
+	graph->scale_mode = xfce_rc_read_int_entry(rc, "scale_mode", DEFAULT_SCALE_MODE);
+	if (graph->scale_mode > SCALE_LOG) graph->scale_mode = DEFAULT_SCALE_MODE;
+	graph->stacked = !!xfce_rc_read_int_entry(rc, "stacked", DEFAULT_STACKED);
+	graph->tier = xfce_rc_read_int_entry(rc, "graph_tier", DEFAULT_GRAPH_TIER);
+	if (graph->tier > GRAPH_TIER_HOUR) graph->tier = DEFAULT_GRAPH_TIER;
+	this->persist_history = !!xfce_rc_read_int_entry(rc, "persist_history", DEFAULT_PERSIST_HISTORY);
+	this->count_packets = !!xfce_rc_read_int_entry(rc, "count_packets", DEFAULT_COUNT_PACKETS);
+	graph->show_packets = !!xfce_rc_read_int_entry(rc, "show_packets", DEFAULT_SHOW_PACKETS);
+	this->export_metrics = !!xfce_rc_read_int_entry(rc, "export_metrics", DEFAULT_EXPORT_METRICS);
+	this->compact_history = !!xfce_rc_read_int_entry(rc, "compact_history", DEFAULT_COMPACT_HISTORY);
 	const gchar *dev_names = xfce_rc_read_entry(rc, "dev_names", "");
 	if (*dev_names) this->dev_names = g_strdup(dev_names);
+	const gchar *dev_colors = xfce_rc_read_entry(rc, "dev_colors", "");
+	if (*dev_colors) this->dev_colors = g_strdup(dev_colors);
 }
 
 void netgraph_save(XfcePanelPlugin *plugin, NetgraphPlugin *this)
 {
+	Graph *graph = this->graph;
+
 	g_autofree gchar *file =
 		xfce_panel_plugin_save_location(plugin, TRUE);
 	if (!file) return;
@@ -177,22 +261,74 @@ void netgraph_save(XfcePanelPlugin *plugin, NetgraphPlugin *this)
 	if (!rc) return;
 
 	xfce_rc_write_int_entry(rc, "update_interval", this->update_interval);
+	xfce_rc_write_int_entry(rc, "adaptive_interval", !!this->adaptive_interval);
 	xfce_rc_write_int_entry(rc, "size", this->size);
 	xfce_rc_write_int_entry(rc, "has_frame", !!this->has_frame);
 	xfce_rc_write_int_entry(rc, "has_border", !!this->has_border);
-
-	g_autofree gchar *bg_color = gdk_rgba_to_string(&this->bg_color);
+	xfce_rc_write_int_entry(rc, "autoscale", graph->autoscale);
+	xfce_rc_write_int_entry(rc, "scale_mode", graph->scale_mode);
+	xfce_rc_write_int_entry(rc, "stacked", !!graph->stacked);
+	xfce_rc_write_int_entry(rc, "graph_tier", graph->tier);
+	xfce_rc_write_int_entry(rc, "persist_history", !!this->persist_history);
+	xfce_rc_write_int_entry(rc, "count_packets", !!this->count_packets);
+	xfce_rc_write_int_entry(rc, "show_packets", !!graph->show_packets);
+	xfce_rc_write_int_entry(rc, "export_metrics", !!this->export_metrics);
+	xfce_rc_write_int_entry(rc, "compact_history", !!this->compact_history);
+
+	g_autofree gchar *bg_color = gdk_rgba_to_string(&graph->bg_color);
 	xfce_rc_write_entry(rc, "bg_color", bg_color);
-	g_autofree gchar *rx_color = gdk_rgba_to_string(&this->rx_color);
+	g_autofree gchar *rx_color = gdk_rgba_to_string(&graph->rx_color);
 	xfce_rc_write_entry(rc, "rx_color", rx_color);
-	g_autofree gchar *tx_color = gdk_rgba_to_string(&this->tx_color);
+	g_autofree gchar *tx_color = gdk_rgba_to_string(&graph->tx_color);
 	xfce_rc_write_entry(rc, "tx_color", tx_color);
+	g_autofree gchar *drop_color = gdk_rgba_to_string(&graph->drop_color);
+	xfce_rc_write_entry(rc, "drop_color", drop_color);
 
 	if (this->dev_names) {
 		xfce_rc_write_entry(rc, "dev_names", this->dev_names);
 	} else {
 		xfce_rc_write_entry(rc, "dev_names", "");
 	}
+	xfce_rc_write_entry(rc, "dev_colors", this->dev_colors ? this->dev_colors : "");
+}
+
+/* The plugin was removed from the panel, so its files are not needed. */
+static void on_removed(XfcePanelPlugin *plugin, NetgraphPlugin *this)
+{
+	if (!this->traffic->histfile) return;
+
+	close_histfile(this);
+
+	g_autofree gchar *path = get_histfile_path(this);
+	if (path) g_unlink(path);
+}
+
+/* The history file is kept next to the rc file, e.g. in netgraph-1.history. */
+static gchar *get_histfile_path(NetgraphPlugin *this)
+{
+	g_autofree gchar *rc_file =
+		xfce_panel_plugin_save_location(this->plugin, TRUE);
+	if (!rc_file) return NULL;
+
+	gsize len = strlen(rc_file);
+	if (g_str_has_suffix(rc_file, ".rc")) len -= strlen(".rc");
+
+	return g_strdup_printf("%.*s.history", (int)len, rc_file);
+}
+
+static void open_histfile(NetgraphPlugin *this)
+{
+	g_autofree gchar *path = get_histfile_path(this);
+	if (!path) return;
+
+	HistoryFile *histfile = histfile_open(path, this->traffic->hist_len);
+	if (histfile) traffic_set_histfile(this->traffic, histfile);
+}
+
+/* Moves the histories of all devs back into memory. */
+static void close_histfile(NetgraphPlugin *this)
+{
+	traffic_set_histfile(this->traffic, NULL);
 }
 
 void netgraph_set_size(NetgraphPlugin *this, guint size)
@@ -221,115 +357,208 @@ void netgraph_set_has_border(NetgraphPlugin *this, gboolean has_border)
 
 void netgraph_set_update_interval(NetgraphPlugin *this, guint update_interval)
 {
-	this->update_interval = update_interval;
+	this->update_interval = MAX(update_interval, MIN_UPDATE_INTERVAL);
+	this->traffic->interval = this->update_interval;
+	configure_sampler(this);
+}
 
-	if (this->timeout_id) g_source_remove(this->timeout_id);
-	this->timeout_id = g_timeout_add(this->update_interval, (GSourceFunc)on_update, this);
+void netgraph_set_adaptive_interval(NetgraphPlugin *this, gboolean adaptive_interval)
+{
+	this->adaptive_interval = adaptive_interval;
+	configure_sampler(this);
 }
 
 void netgraph_set_min_scale(NetgraphPlugin *this, guint64 min_scale)
 {
-	this->min_scale = min_scale;
+	this->graph->min_scale = min_scale;
+	netgraph_redraw(this);
+}
+
+void netgraph_set_autoscale(NetgraphPlugin *this, Autoscale autoscale)
+{
+	this->graph->autoscale = autoscale;
+	graph_update_scale(this->graph);
+	netgraph_redraw(this);
+}
+
+void netgraph_set_scale_mode(NetgraphPlugin *this, ScaleMode scale_mode)
+{
+	this->graph->scale_mode = scale_mode;
+	netgraph_redraw(this);
+}
+
+void netgraph_set_stacked(NetgraphPlugin *this, gboolean stacked)
+{
+	this->graph->stacked = stacked;
+	netgraph_redraw(this);
+}
+
+/* Returns FALSE if some of the colors are not valid, see
+ * graph_set_dev_colors(). */
+gboolean netgraph_set_dev_colors(NetgraphPlugin *this, const gchar *list)
+{
+	g_free(this->dev_colors);
+	this->dev_colors = (list && *list) ? g_strdup(list) : NULL;
+
+	gboolean valid = graph_set_dev_colors(this->graph, this->dev_colors);
 	netgraph_redraw(this);
+	return valid;
 }
 
 void netgraph_set_dev_names(NetgraphPlugin *this, const gchar *list)
 {
-	if (!list || !*list) {
+	Traffic *traffic = this->traffic;
+
+	Filter *filter = filter_new(list);
+	if (!filter) {
 		g_free(this->dev_names);
 		this->dev_names = NULL;
-		g_ptr_array_remove_range(this->devs, 0, this->devs->len);
-		update_netdev_list(this);
+		this->fixed_devs = FALSE;
+		traffic_remove(traffic, 0, traffic->devs->len);
+		traffic_recompute(traffic);
+		configure_sampler(this);
 		return;
 	}
 
-	gsize orig_len = this->devs->len;
+	gsize orig_len = traffic->devs->len;
+	gboolean fixed = filter_is_fixed(filter);
+	filter_free(filter);
+
 	g_autoptr(GString) sanitized = g_string_new("");
+	g_autoptr(GHashTable) seen = g_hash_table_new(g_str_hash, g_str_equal);
 	g_auto(GStrv) parts = g_strsplit_set(list, ", \t\r\n", -1);
 	for (gsize i = 0; parts[i] != NULL; i++) {
-		if (*parts[i] == '\0') continue;
+		if (*parts[i] == '\0' || g_strcmp0(parts[i], "!") == 0) continue;
+		if (!g_hash_table_add(seen, parts[i])) continue;
 
 		if (sanitized->len != 0) g_string_append(sanitized, ", ");
 		g_string_append(sanitized, parts[i]);
 
-		g_ptr_array_add(this->devs, netdev_new(parts[i], this->hist_len));
-	}
-
-	if (this->devs->len == orig_len) {
-		/* No new devices were added. */
-		return;
+		/* Patterns pick up the devices as the sampler finds them. */
+		if (fixed) traffic_add(traffic, parts[i]);
 	}
 
 	if (orig_len != 0) {
 		/* Clear the old devices. */
-		g_ptr_array_remove_range(this->devs, 0, orig_len);
+		traffic_remove(traffic, 0, orig_len);
+		traffic_recompute(traffic);
 	}
 
 	g_free(this->dev_names);
 	this->dev_names = g_string_free(sanitized, FALSE);
 	sanitized = NULL;  /* Prevent a double-free from g_autoptr. */
+	this->fixed_devs = fixed;
+
+	configure_sampler(this);
 }
 
-void netgraph_redraw(NetgraphPlugin *this)
+void netgraph_set_graph_tier(NetgraphPlugin *this, GraphTier graph_tier)
 {
-	gtk_widget_queue_draw(this->draw_area);
+	this->graph->tier = graph_tier;
+	graph_update_scale(this->graph);
+	netgraph_redraw(this);
 }
 
-static void on_draw(GtkWidget *widget, cairo_t *cr, NetgraphPlugin *this)
+void netgraph_set_persist_history(NetgraphPlugin *this, gboolean persist_history)
 {
-	GtkAllocation alloc;
-	gtk_widget_get_allocation(this->draw_area, &alloc);
-	guint w = alloc.width;
-	guint h = alloc.height;
+	this->persist_history = persist_history;
 
-	if (w > this->hist_len) w = this->hist_len;
+	if (this->persist_history && !this->traffic->histfile) {
+		open_histfile(this);
+	} else if (!this->persist_history && this->traffic->histfile) {
+		close_histfile(this);
 
-	gdk_cairo_set_source_rgba(cr, &this->bg_color);
-	cairo_rectangle(cr, 0, 0, w, h);
-	cairo_fill(cr);
+		g_autofree gchar *path = get_histfile_path(this);
+		if (path) g_unlink(path);
+	}
+}
 
-	cairo_set_line_width(cr, 1.0);
-	cairo_set_line_cap(cr, CAIRO_LINE_CAP_SQUARE);
+void netgraph_set_count_packets(NetgraphPlugin *this, gboolean count_packets)
+{
+	this->count_packets = count_packets;
+	traffic_count_packets(this->traffic, count_packets);
+	configure_sampler(this);
+	graph_update_scale(this->graph);
+	netgraph_redraw(this);
+}
 
-	gdk_cairo_set_source_rgba(cr, &this->rx_color);
-	for (guint x = 0; x < w; x++) {
-		guint seg = (guint)(h * get_rx_fraction(this, w - 1 - x));
-		if (!seg) continue;
+/* Only takes effect while packets are counted. */
+void netgraph_set_show_packets(NetgraphPlugin *this, gboolean show_packets)
+{
+	this->graph->show_packets = show_packets;
+	graph_update_scale(this->graph);
+	netgraph_redraw(this);
+}
 
-		cairo_move_to(cr, x + 0.5, h - seg - 0.5);
-		cairo_line_to(cr, x + 0.5, h - 0.5);
-		cairo_stroke(cr);
+void netgraph_set_export_metrics(NetgraphPlugin *this, gboolean export_metrics)
+{
+	this->export_metrics = export_metrics;
+
+	if (this->export_metrics && !this->exporter) {
+		g_autofree gchar *path = netgraph_get_export_path(this);
+		this->exporter = exporter_new(path, this->traffic);
+	} else if (!this->export_metrics && this->exporter) {
+		exporter_free(this->exporter);
+		this->exporter = NULL;
 	}
+}
 
-	gdk_cairo_set_source_rgba(cr, &this->tx_color);
-	for (guint x = 0; x < w; x++) {
-		guint seg = (guint)(h * get_tx_fraction(this, w - 1 - x));
-		if (!seg) continue;
+/* One socket per plugin, in the runtime dir, e.g. netgraph-1.sock. */
+gchar *netgraph_get_export_path(NetgraphPlugin *this)
+{
+	return g_strdup_printf("%s/xfce4-netgraph-plugin/netgraph-%d.sock",
+			       g_get_user_runtime_dir(),
+			       xfce_panel_plugin_get_unique_id(this->plugin));
+}
 
-		cairo_move_to(cr, x + 0.5, 0.5);
-		cairo_line_to(cr, x + 0.5, seg - 0.5);
-		cairo_stroke(cr);
-	}
+void netgraph_set_compact_history(NetgraphPlugin *this, gboolean compact_history)
+{
+	this->compact_history = compact_history;
+	traffic_set_compact(this->traffic, compact_history);
+	graph_update_scale(this->graph);
+	netgraph_redraw(this);
 }
 
-static gdouble get_rx_fraction(NetgraphPlugin *this, gsize idx)
+void netgraph_redraw(NetgraphPlugin *this)
 {
-	guint64 rx = 0;
-	for (gsize i = 0; i < this->devs->len; i++) {
-		NetworkDevice *dev = g_ptr_array_index(this->devs, i);
-		rx += dev->hist_rx[idx];
-	}
-	return (gdouble)rx / (gdouble)this->scale;
+	graph_invalidate(this->graph);
+	gtk_widget_queue_draw(this->draw_area);
 }
 
-static gdouble get_tx_fraction(NetgraphPlugin *this, gsize idx)
+static void on_draw(GtkWidget *widget, cairo_t *cr, NetgraphPlugin *this)
 {
-	guint64 tx = 0;
-	for (gsize i = 0; i < this->devs->len; i++) {
-		NetworkDevice *dev = g_ptr_array_index(this->devs, i);
-		tx += dev->hist_tx[idx];
-	}
-	return (gdouble)tx / (gdouble)this->scale;
+	guint w, h;
+	get_graph_size(this, &w, &h);
+
+	INSTRUMENT_BEGIN(mark);
+	graph_draw(this->graph, cr, w, h);
+	INSTRUMENT_END(SPAN_DRAW, mark);
+	INSTRUMENT_REDRAW();
+}
+
+static void get_graph_size(NetgraphPlugin *this, guint *w, guint *h)
+{
+	GtkAllocation alloc;
+	gtk_widget_get_allocation(this->draw_area, &alloc);
+	*w = MAX(alloc.width, 0);
+	*h = MAX(alloc.height, 0);
+
+	if (*w > this->traffic->hist_len) *w = this->traffic->hist_len;
+}
+
+/* Applies all the updates since the previous frame at once. */
+static gboolean on_frame(GtkWidget *widget, GdkFrameClock *clock, NetgraphPlugin *this)
+{
+	this->frame_id = 0;
+
+	guint w, h;
+	get_graph_size(this, &w, &h);
+	INSTRUMENT_BEGIN(mark);
+	graph_scroll(this->graph, w, h);
+	INSTRUMENT_END(SPAN_DRAW, mark);
+	gtk_widget_queue_draw(this->draw_area);
+
+	return G_SOURCE_REMOVE;
 }
 
 static gboolean on_size_changed(XfcePanelPlugin *plugin,
@@ -348,13 +577,14 @@ static gboolean on_size_changed(XfcePanelPlugin *plugin,
 
 	gtk_widget_set_size_request(GTK_WIDGET(this->frame), width, height);
 
-	if (width != this->hist_len) {
-		for (gsize i = 0; i < this->devs->len; i++) {
-			NetworkDevice *dev = g_ptr_array_index(this->devs, i);
-			netdev_resize(dev, this->hist_len, width);
-		}
+	if (width != this->traffic->hist_len) {
+		/* The layout of the history file depends on the width. */
+		if (this->traffic->histfile) close_histfile(this);
+
+		traffic_resize(this->traffic, width);
+
+		if (this->persist_history) open_histfile(this);
 	}
-	this->hist_len = width;
 
 	/* Update the border since it depends on the plugin size. */
 	netgraph_set_has_border(this, this->has_border);
@@ -369,137 +599,104 @@ static void on_orientation_changed(XfcePanelPlugin *plugin,
 	on_size_changed(this->plugin, xfce_panel_plugin_get_size(this->plugin), this);
 }
 
-static gboolean on_update(NetgraphPlugin *this)
+static void configure_sampler(NetgraphPlugin *this)
 {
-	if (this->dev_names == NULL) update_netdev_list(this);
+	sampler_configure(this->sampler, this->update_interval,
+			  this->adaptive_interval, this->count_packets,
+			  this->dev_names);
+}
 
-	update_netdev_stats(this);
-	update_tooltip(this);
-	netgraph_redraw(this);
+static void on_snapshot(const SamplerSnapshot *snapshot, NetgraphPlugin *this)
+{
+	if (!this->fixed_devs) {
+		INSTRUMENT_BEGIN(list_mark);
+		traffic_update_list(this->traffic, snapshot);
+		INSTRUMENT_END(SPAN_UPDATE_LIST, list_mark);
+	}
 
-	return TRUE;  /* Keep the timeout active. */
-}
-
-static void update_netdev_list(NetgraphPlugin *this)
-{
-	g_autoptr(GPtrArray) dev_names = netdev_enumerate();
-	if (!dev_names) return;
-
-	gsize i, j;
-	for (i = j = 0; i < dev_names->len && j < this->devs->len; ) {
-		gchar *dev_name = g_ptr_array_index(dev_names, i);
-		NetworkDevice *dev = g_ptr_array_index(this->devs, j);
-
-		gint cmp = g_strcmp0(dev_name, dev->name);
-		if (cmp == 0) {
-			i++;
-			j++;
-		} else if (cmp < 0) {
-			/* A new netdev appeared, need to add it to devs. */
-			g_debug("Found new netdev %s.", dev_name);
-			g_ptr_array_insert(this->devs, j,
-					   netdev_new(dev_name, this->hist_len));
-			i++;
-			j++;
-		} else {
-			/* The current element in devs seems to have
-			 * disappeared.  It will get cleaned up later, once
-			 * it's been down long enough. */
-			j++;
-		}
+	/* Don't clean up devs if we're monitoring specific interfaces. */
+	INSTRUMENT_BEGIN(stats_mark);
+	traffic_update_stats(this->traffic, snapshot, !this->fixed_devs);
+	INSTRUMENT_END(SPAN_UPDATE_STATS, stats_mark);
+	INSTRUMENT_UPDATE();
+	graph_update_scale(this->graph);
+
+	/* Keep sampling while hidden, so that the history has no gaps, but
+	 * leave the drawing for when the graph is shown again. */
+	if (!gtk_widget_get_mapped(this->draw_area)) {
+		graph_invalidate(this->graph);
+		return;
+	}
+
+	/* GTK parses the markup again whenever it's set, so only do that
+	 * when it changed. */
+	if (this->tooltip_shown && update_tooltip(this)) {
+		gtk_label_set_markup(GTK_LABEL(this->tooltip_label), this->tooltip->str);
 	}
-	for (; i < dev_names->len; i++) {
-		gchar *dev_name = g_ptr_array_index(dev_names, i);
-		g_ptr_array_add(this->devs, netdev_new(dev_name, this->hist_len));
+
+	/* Several updates between two frames get drawn together. */
+	guint w, h;
+	get_graph_size(this, &w, &h);
+	if (graph_changed(this->graph, w, h) && !this->frame_id) {
+		this->frame_id = gtk_widget_add_tick_callback(this->draw_area,
+			(GtkTickCallback)on_frame, this, NULL);
 	}
 }
 
-static void update_netdev_stats(NetgraphPlugin *this)
+static gboolean on_query_tooltip(GtkWidget *widget,
+				 gint x,
+				 gint y,
+				 gboolean keyboard_mode,
+				 GtkTooltip *tooltip,
+				 NetgraphPlugin *this)
 {
-	this->scale = 0;
-
-	for (gsize i = 0; i < this->devs->len; i++) {
-		NetworkDevice *dev = g_ptr_array_index(this->devs, i);
-		netdev_update(dev, this->hist_len, this->update_interval);
-
-		/* Don't clean up devs if we're monitoring specific interfaces. */
-		if (this->dev_names == NULL) {
-			if (dev->down >= this->hist_len) {
-				g_debug("Removing netdev %s, was down for %d intervals.", dev->name, dev->down);
-				g_ptr_array_remove_index(this->devs, i);
-				i--;
-				continue;
-			}
+	/* Called again on every motion of the pointer, while the label is
+	 * kept up to date by the updates. */
+	if (!this->tooltip_shown) {
+		this->tooltip_shown = TRUE;
+		if (update_tooltip(this)) {
+			gtk_label_set_markup(GTK_LABEL(this->tooltip_label), this->tooltip->str);
 		}
-
-		this->scale += dev->max_rx + dev->max_tx;
 	}
 
-	if (this->scale < this->min_scale) this->scale = this->min_scale;
+	gtk_tooltip_set_custom(tooltip, this->tooltip_label);
+	return TRUE;
 }
 
-static void update_tooltip(NetgraphPlugin *this)
+static gboolean on_leave(GtkWidget *widget, GdkEventCrossing *event, NetgraphPlugin *this)
 {
-	g_autoptr(GString) label = g_string_new("");
+	this->tooltip_shown = FALSE;
+	return FALSE;
+}
 
-#define BUFSIZE	32
-	gchar rx_buf[BUFSIZE], tx_buf[BUFSIZE];
-	for (gsize i = 0; i < this->devs->len; i++) {
-		NetworkDevice *dev = g_ptr_array_index(this->devs, i);
-		format_human_size(dev->hist_rx[0], rx_buf, BUFSIZE);
-		format_human_size(dev->hist_tx[0], tx_buf, BUFSIZE);
-		g_autofree gchar *dev_name_esc =
-			g_markup_escape_text(dev->name, -1);
-		g_string_append_printf(
-			label, _("<b>%s</b>: %sB/s down; %sB/s up\n"),
-			dev_name_esc, rx_buf, tx_buf);
+/* Formats the tooltip, and returns TRUE if it changed. */
+static gboolean update_tooltip(NetgraphPlugin *this)
+{
+	const Graph *graph = this->graph;
+	guint64 updates = this->traffic->updates;
+	if (updates == this->tooltip_updates
+	    && graph->scale == this->tooltip_scale
+	    && graph->scale_mode == this->tooltip_mode) {
+		return FALSE;
 	}
+	this->tooltip_updates = updates;
+	this->tooltip_scale = graph->scale;
+	this->tooltip_mode = graph->scale_mode;
+
+	INSTRUMENT_BEGIN(mark);
+	tooltip_format(this->tooltip_next, graph,
+		       graph->show_packets && this->count_packets);
+	INSTRUMENT_END(SPAN_TOOLTIP, mark);
+#ifdef ENABLE_INSTRUMENTATION
+	instrument_format(this->tooltip_next);
+#endif
 
-	format_human_size(this->scale, rx_buf, BUFSIZE);
-	g_string_append_printf(label, _("current scale: %sB/s"), rx_buf);
-
-	gtk_widget_set_tooltip_markup(this->box, label->str);
-#undef BUFSIZE
-}
-
-static gchar *format_human_size(guint64 num, gchar *buf, gsize bufsize)
-{
-	if (num < 1024) {
-		g_snprintf(buf, bufsize, "%ld ", num);
-	} else if (num < 10240) {
-		g_snprintf(buf, bufsize, "%.2f K", (gdouble)num / 1024UL);
-	} else if (num < 102400) {
-		g_snprintf(buf, bufsize, "%.1f K", (gdouble)num / 1024UL);
-	} else if (num < 1024UL * 1024) {
-		g_snprintf(buf, bufsize, "%.0f K", (gdouble)num / 1024UL);
-	} else if (num < 1024UL * 10240) {
-		g_snprintf(buf, bufsize, "%.2f M", (gdouble)num / (1024UL * 1024));
-	} else if (num < 1024UL * 102400) {
-		g_snprintf(buf, bufsize, "%.1f M", (gdouble)num / (1024UL * 1024));
-	} else if (num < 1024UL * 1024 * 1024) {
-		g_snprintf(buf, bufsize, "%.0f M", (gdouble)num / (1024UL * 1024));
-	} else if (num < 1024UL * 1024 * 10240) {
-		g_snprintf(buf, bufsize, "%.2f G", (gdouble)num / (1024UL * 1024 * 1024));
-	} else if (num < 1024UL * 1024 * 102400) {
-		g_snprintf(buf, bufsize, "%.1f G", (gdouble)num / (1024UL * 1024 * 1024));
-	} else if (num < 1024UL * 1024 * 1024 * 1024) {
-		g_snprintf(buf, bufsize, "%.0f G", (gdouble)num / (1024UL * 1024 * 1024));
-	} else if (num < 1024UL * 1024 * 1024 * 10240) {
-		g_snprintf(buf, bufsize, "%.2f T", (gdouble)num / (1024UL * 1024 * 1024 * 1024));
-	} else if (num < 1024UL * 1024 * 1024 * 102400) {
-		g_snprintf(buf, bufsize, "%.1f T", (gdouble)num / (1024UL * 1024 * 1024 * 1024));
-	} else if (num < 1024UL * 1024 * 1024 * 1024 * 1024) {
-		g_snprintf(buf, bufsize, "%.0f T", (gdouble)num / (1024UL * 1024 * 1024 * 1024));
-	} else if (num < 1024UL * 1024 * 1024 * 1024 * 10240) {
-		g_snprintf(buf, bufsize, "%.2f P", (gdouble)num / (1024UL * 1024 * 1024 * 1024 * 1024));
-	} else if (num < 1024UL * 1024 * 1024 * 1024 * 102400) {
-		g_snprintf(buf, bufsize, "%.1f P", (gdouble)num / (1024UL * 1024 * 1024 * 1024 * 1024));
-	} else if (num < 1024UL * 1024 * 1024 * 1024 * 1024 * 1024) {
-		g_snprintf(buf, bufsize, "%.0f P", (gdouble)num / (1024UL * 1024 * 1024 * 1024 * 1024));
-	}
-	buf[bufsize - 1] = '\0';
+	if (g_string_equal(this->tooltip_next, this->tooltip)) return FALSE;
 
-	return buf;
+	GString *tooltip = this->tooltip;
+	this->tooltip = this->tooltip_next;
+	this->tooltip_next = tooltip;
+	return TRUE;
 }
 
 XFCE_PANEL_PLUGIN_REGISTER(netgraph_construct);
@@ -23,7 +23,10 @@
 #include <libxfce4panel/xfce-panel-plugin.h>
 #include <libxfce4util/libxfce4util.h>
 
-#include "netdev.h"
+#include "export.h"
+#include "graph.h"
+#include "sampler.h"
+#include "traffic.h"
 
 G_BEGIN_DECLS
 
@@ -33,25 +36,40 @@ typedef struct {
 	guint size;
 	gboolean has_frame;
 	gboolean has_border;
-	GdkRGBA bg_color;
-	GdkRGBA rx_color;
-	GdkRGBA tx_color;
 	guint update_interval;
-	guint64 min_scale;
+	gboolean adaptive_interval;  /* Sample less often while idle. */
 	gchar *dev_names;  /* NULL when monitoring all interfaces. */
+	gchar *dev_colors;  /* NULL unless some interfaces have their own color. */
+	gboolean fixed_devs;  /* dev_names only has names, no patterns. */
+	gboolean persist_history;
+	gboolean count_packets;  /* Also read the packet, error and drop counters. */
+	gboolean export_metrics;  /* Serve the traffic on a Unix socket. */
+	gboolean compact_history;  /* Round the samples to save memory. */
 
 	GtkWidget *ebox;
 	GtkWidget *box;
 	GtkWidget *frame;
 	GtkWidget *draw_area;
-	guint timeout_id;
+	Sampler *sampler;
+
+	/* The tooltip is only built while it's shown. */
+	GtkWidget *tooltip_label;
+	gboolean tooltip_shown;  /* Until the pointer leaves the plugin. */
+	GString *tooltip;  /* The markup in the label. */
+	GString *tooltip_next;  /* Reused between updates. */
+	/* What the markup was formatted from, so that it's only formatted
+	 * again once the values or the scale changed. */
+	guint64 tooltip_updates;
+	guint64 tooltip_scale;
+	ScaleMode tooltip_mode;
 
 	GObject *dev_names_entry;
 	guint dev_names_timeout_id;
 
-	GPtrArray *devs;
-	gsize hist_len;
-	guint64 scale;
+	Traffic *traffic;
+	Exporter *exporter;  /* Only set while exporting. */
+	Graph *graph;  /* Also holds the settings of the graph. */
+	guint frame_id;  /* Tick callback that draws the pending updates. */
 } NetgraphPlugin;
 
 void netgraph_redraw(NetgraphPlugin *this);
@@ -61,8 +79,22 @@ void netgraph_set_size(NetgraphPlugin *this, guint size);
 void netgraph_set_has_frame(NetgraphPlugin *this, gboolean has_frame);
 void netgraph_set_has_border(NetgraphPlugin *this, gboolean has_border);
 void netgraph_set_update_interval(NetgraphPlugin *this, guint update_interval);
+void netgraph_set_adaptive_interval(NetgraphPlugin *this, gboolean adaptive_interval);
 void netgraph_set_min_scale(NetgraphPlugin *this, guint64 min_scale);
+void netgraph_set_autoscale(NetgraphPlugin *this, Autoscale autoscale);
+void netgraph_set_scale_mode(NetgraphPlugin *this, ScaleMode scale_mode);
+void netgraph_set_stacked(NetgraphPlugin *this, gboolean stacked);
+gboolean netgraph_set_dev_colors(NetgraphPlugin *this, const gchar *list);
 void netgraph_set_dev_names(NetgraphPlugin *this, const gchar *dev_names);
+void netgraph_set_graph_tier(NetgraphPlugin *this, GraphTier graph_tier);
+void netgraph_set_persist_history(NetgraphPlugin *this, gboolean persist_history);
+void netgraph_set_count_packets(NetgraphPlugin *this, gboolean count_packets);
+void netgraph_set_show_packets(NetgraphPlugin *this, gboolean show_packets);
+void netgraph_set_export_metrics(NetgraphPlugin *this, gboolean export_metrics);
+void netgraph_set_compact_history(NetgraphPlugin *this, gboolean compact_history);
+
+/* Where the traffic is exported, when it is. */
+gchar *netgraph_get_export_path(NetgraphPlugin *this);
 
 
 /* TODO: This should be moved to xfce-rc.h */
@@ -0,0 +1,113 @@
+/*
+ *  Copyright (C) 2019 David Lazar <dlazar@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "quantile.h"
+
+#include <string.h>
+#include <glib.h>
+
+static guint bucket_of(guint64 sample);
+static guint64 bucket_max(guint bucket);
+static void tree_add(QuantileSketch *this, guint bucket, gint32 delta);
+
+
+// Allow variable declarations at the first use.
+#pragma GCC diagnostic ignored "-Wdeclaration-after-statement"
+
+
+QuantileSketch *quantile_new(void)
+{
+	return g_slice_new0(QuantileSketch);
+}
+
+void quantile_free(QuantileSketch *this)
+{
+	g_slice_free(QuantileSketch, this);
+}
+
+void quantile_clear(QuantileSketch *this)
+{
+	memset(this, 0, sizeof(*this));
+}
+
+void quantile_insert(QuantileSketch *this, guint64 sample)
+{
+	tree_add(this, bucket_of(sample), 1);
+	this->count++;
+}
+
+void quantile_remove(QuantileSketch *this, guint64 sample)
+{
+	g_return_if_fail(this->count > 0);
+
+	tree_add(this, bucket_of(sample), -1);
+	this->count--;
+}
+
+guint64 quantile_get(const QuantileSketch *this, gdouble q)
+{
+	if (this->count == 0) return 0;
+
+	gdouble exact = CLAMP(q, 0.0, 1.0) * this->count;
+	guint32 rank = (guint32)exact;
+	if (rank < exact) rank++;
+	rank = CLAMP(rank, 1, this->count);
+
+	/* Find the first bucket where the running count reaches `rank`, by
+	 * descending the implicit tree from its largest power of two. */
+	guint pos = 0;
+	for (guint step = 1u << g_bit_nth_msf(QUANTILE_N_BUCKETS, -1); step; step >>= 1) {
+		if (pos + step <= QUANTILE_N_BUCKETS && this->tree[pos + step] < rank) {
+			pos += step;
+			rank -= this->tree[pos];
+		}
+	}
+
+	return bucket_max(pos);
+}
+
+/* The leading QUANTILE_SUB_BITS bits after the most significant one pick a
+ * bucket within its power of two. */
+static guint bucket_of(guint64 sample)
+{
+	if (sample < QUANTILE_SUB_BUCKETS) return sample;
+
+	guint exp = g_bit_storage(sample) - 1;
+	guint shift = exp - QUANTILE_SUB_BITS;
+	guint sub = (sample >> shift) & (QUANTILE_SUB_BUCKETS - 1);
+
+	return (shift + 1) * QUANTILE_SUB_BUCKETS + sub;
+}
+
+static guint64 bucket_max(guint bucket)
+{
+	if (bucket < QUANTILE_SUB_BUCKETS) return bucket;
+
+	guint shift = bucket / QUANTILE_SUB_BUCKETS - 1;
+	guint64 sub = bucket % QUANTILE_SUB_BUCKETS;
+	guint64 min = (QUANTILE_SUB_BUCKETS + sub) << shift;
+
+	return min + ((G_GUINT64_CONSTANT(1) << shift) - 1);
+}
+
+static void tree_add(QuantileSketch *this, guint bucket, gint32 delta)
+{
+	for (guint i = bucket + 1; i <= QUANTILE_N_BUCKETS; i += i & -i) {
+		this->tree[i] += delta;
+	}
+}
@@ -0,0 +1,58 @@
+/*
+ *  Copyright (C) 2019 David Lazar <dlazar@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __QUANTILE_H__
+#define __QUANTILE_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Every power of two is split into this many buckets, so the quantiles are
+ * within 1/QUANTILE_SUB_BUCKETS of the exact ones.  Values below that are
+ * counted exactly. */
+#define QUANTILE_SUB_BITS	4
+#define QUANTILE_SUB_BUCKETS	(1 << QUANTILE_SUB_BITS)
+#define QUANTILE_N_BUCKETS	((64 - QUANTILE_SUB_BITS + 1) * QUANTILE_SUB_BUCKETS)
+
+/* Approximate quantiles of a multiset of samples, which can be added and
+ * removed in any order, so it can follow a sliding window.  The samples are
+ * counted in logarithmic buckets, and the counts are kept in a Fenwick
+ * tree, so inserting, removing and looking up a quantile are all
+ * O(log QUANTILE_N_BUCKETS), whatever the number of samples. */
+typedef struct {
+	guint32 tree[QUANTILE_N_BUCKETS + 1];  /* 1-based. */
+	guint32 count;
+} QuantileSketch;
+
+QuantileSketch *quantile_new(void);
+void quantile_free(QuantileSketch *this);
+void quantile_clear(QuantileSketch *this);
+void quantile_insert(QuantileSketch *this, guint64 sample);
+
+/* The sample must have been inserted before. */
+void quantile_remove(QuantileSketch *this, guint64 sample);
+
+/* Returns an upper bound of the `q` quantile (0.5 is the median, 1.0 the
+ * max), which overestimates it by less than 1/QUANTILE_SUB_BUCKETS, or 0
+ * if there are no samples. */
+guint64 quantile_get(const QuantileSketch *this, gdouble q);
+
+G_END_DECLS
+
+#endif  /* __QUANTILE_H__ */
@@ -0,0 +1,236 @@
+/*
+ *  Copyright (C) 2019 David Lazar <dlazar@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "render.h"
+
+#include <glib.h>
+#include <cairo.h>
+#include <gdk/gdk.h>
+
+static guint32 over(guint32 src, guint32 dst);
+
+
+// Allow variable declarations at the first use.
+#pragma GCC diagnostic ignored "-Wdeclaration-after-statement"
+
+
+void render_style_init(RenderStyle *this, const GdkRGBA *bg_color,
+		       const GdkRGBA *rx_color, const GdkRGBA *tx_color,
+		       const GdkRGBA *drop_color)
+{
+	this->bg_color = *bg_color;
+	this->rx_color = *rx_color;
+	this->tx_color = *tx_color;
+	this->drop_color = *drop_color;
+
+	guint32 rx = render_premultiply(rx_color);
+	guint32 tx = render_premultiply(tx_color);
+	guint32 drop = render_premultiply(drop_color);
+	this->bg_pixel = render_premultiply(bg_color);
+	this->rx_pixel = over(rx, this->bg_pixel);
+	this->tx_pixel = over(tx, this->bg_pixel);
+	this->both_pixel = over(tx, this->rx_pixel);
+	this->drop_pixel = over(drop, this->bg_pixel);
+	this->drop_tx_pixel = over(tx, this->drop_pixel);
+}
+
+void render_columns_cairo(cairo_surface_t *surface, const RenderStyle *style,
+			  const guint32 *rx_seg, const guint32 *tx_seg,
+			  const guint32 *drop_seg, guint x0, guint x1)
+{
+	guint h = cairo_image_surface_get_height(surface);
+	cairo_t *cr = cairo_create(surface);
+
+	cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+	gdk_cairo_set_source_rgba(cr, &style->bg_color);
+	cairo_rectangle(cr, x0, 0, x1 - x0, h);
+	cairo_fill(cr);
+	cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
+
+	cairo_set_line_width(cr, 1.0);
+	cairo_set_line_cap(cr, CAIRO_LINE_CAP_SQUARE);
+
+	gdk_cairo_set_source_rgba(cr, &style->rx_color);
+	for (guint x = x0; x < x1; x++) {
+		guint seg = rx_seg[x - x0];
+		if (!seg) continue;
+
+		cairo_move_to(cr, x + 0.5, h - seg - 0.5);
+		cairo_line_to(cr, x + 0.5, h - 0.5);
+		cairo_stroke(cr);
+	}
+
+	/* The drops replace the bottom of the download bars, rather than
+	 * being blended over them. */
+	for (guint x = x0; drop_seg && x < x1; x++) {
+		guint seg = drop_seg[x - x0];
+		if (!seg) continue;
+
+		cairo_rectangle(cr, x, h - seg, 1, seg);
+		cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+		gdk_cairo_set_source_rgba(cr, &style->bg_color);
+		cairo_fill_preserve(cr);
+		cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
+		gdk_cairo_set_source_rgba(cr, &style->drop_color);
+		cairo_fill(cr);
+	}
+
+	gdk_cairo_set_source_rgba(cr, &style->tx_color);
+	for (guint x = x0; x < x1; x++) {
+		guint seg = tx_seg[x - x0];
+		if (!seg) continue;
+
+		cairo_move_to(cr, x + 0.5, 0.5);
+		cairo_line_to(cr, x + 0.5, seg - 0.5);
+		cairo_stroke(cr);
+	}
+
+	cairo_destroy(cr);
+}
+
+void render_columns_pixels(cairo_surface_t *surface, const RenderStyle *style,
+			   const guint32 *rx_seg, const guint32 *tx_seg,
+			   const guint32 *drop_seg, guint x0, guint x1)
+{
+	guint h = cairo_image_surface_get_height(surface);
+	int stride = cairo_image_surface_get_stride(surface);
+	guint n = x1 - x0;
+
+	cairo_surface_flush(surface);
+	guchar *data = cairo_image_surface_get_data(surface);
+
+	const guint32 bg = style->bg_pixel;
+	const guint32 rx = style->rx_pixel;
+	const guint32 tx = style->tx_pixel;
+	const guint32 both = style->both_pixel;
+	const guint32 drop = style->drop_pixel;
+	const guint32 drop_tx = style->drop_tx_pixel;
+
+	/* Go row by row, so that the inner loop writes consecutive pixels and
+	 * only uses selects, which the compiler can vectorize.  With square
+	 * line caps, the cairo renderer covers seg + 1 rows for the download
+	 * bars, and seg rows for the upload bars.  The loop without drops is
+	 * kept separate, as it's the common case. */
+	for (guint y = 0; y < h; y++) {
+		guint32 *restrict row = (guint32 *)(data + y * stride) + x0;
+		if (!drop_seg) {
+			for (guint i = 0; i < n; i++) {
+				guint32 in_rx = (rx_seg[i] != 0) & (y + rx_seg[i] + 1 >= h);
+				guint32 in_tx = (y < tx_seg[i]);
+				guint32 lower = in_rx ? rx : bg;
+				guint32 upper = in_rx ? both : tx;
+				row[i] = in_tx ? upper : lower;
+			}
+			continue;
+		}
+
+		for (guint i = 0; i < n; i++) {
+			guint32 in_rx = (rx_seg[i] != 0) & (y + rx_seg[i] + 1 >= h);
+			guint32 in_drop = (y + drop_seg[i] >= h);
+			guint32 in_tx = (y < tx_seg[i]);
+			guint32 lower = in_drop ? drop : (in_rx ? rx : bg);
+			guint32 upper = in_drop ? drop_tx : (in_rx ? both : tx);
+			row[i] = in_tx ? upper : lower;
+		}
+	}
+
+	cairo_surface_mark_dirty_rectangle(surface, x0, 0, n, h);
+}
+
+void render_stacked_pixels(cairo_surface_t *surface, const RenderStyle *style,
+			   const guint32 *colors, guint n_bands,
+			   const guint32 *rx_bounds, const guint32 *tx_bounds,
+			   guint x0, guint x1)
+{
+	guint h = cairo_image_surface_get_height(surface);
+	int stride = cairo_image_surface_get_stride(surface);
+	guint n = x1 - x0;
+
+	cairo_surface_flush(surface);
+	guchar *data = cairo_image_surface_get_data(surface);
+
+	/* The colors over the background, for the rows where the bands don't
+	 * overlap. */
+	g_autofree guint32 *pixels = g_new(guint32, n_bands);
+	for (guint k = 0; k < n_bands; k++) {
+		pixels[k] = over(colors[k], style->bg_pixel);
+	}
+
+	/* Go column by column, as every column has its own bands. */
+	for (guint i = 0; i < n; i++) {
+		guchar *column = data + (x0 + i) * 4;
+		const guint32 *rx = rx_bounds + i * n_bands;
+		const guint32 *tx = tx_bounds + i * n_bands;
+#define PIXEL(y)	(*(guint32 *)(column + (y) * stride))
+
+		for (guint y = 0; y < h; y++) PIXEL(y) = style->bg_pixel;
+
+		/* Like a single bar, the download bands cover one more row
+		 * than their height. */
+		guint bottom = 0;
+		for (guint k = 0; k < n_bands; k++) {
+			guint top = rx[k] ? MIN(rx[k] + 1, h) : 0;
+			for (guint row = bottom; row < top; row++) {
+				PIXEL(h - 1 - row) = pixels[k];
+			}
+			bottom = MAX(bottom, top);
+		}
+
+		guint rx_start = h - bottom;  /* First row of the download bands. */
+		guint start = 0;
+		for (guint k = 0; k < n_bands; k++) {
+			guint end = MIN(tx[k], h);
+			for (guint y = start; y < end; y++) {
+				PIXEL(y) = (y >= rx_start) ? over(colors[k], PIXEL(y)) : pixels[k];
+			}
+			start = MAX(start, end);
+		}
+#undef PIXEL
+	}
+
+	cairo_surface_mark_dirty_rectangle(surface, x0, 0, n, h);
+}
+
+/* Premultiplies in 16 bits per channel, then truncates to 8 bits. */
+guint32 render_premultiply(const GdkRGBA *color)
+{
+	gdouble alpha = CLAMP(color->alpha, 0.0, 1.0);
+	guint32 a = (guint16)(alpha * 65535.0 + 0.5) >> 8;
+	guint32 r = (guint16)(CLAMP(color->red, 0.0, 1.0) * alpha * 65535.0 + 0.5) >> 8;
+	guint32 g = (guint16)(CLAMP(color->green, 0.0, 1.0) * alpha * 65535.0 + 0.5) >> 8;
+	guint32 b = (guint16)(CLAMP(color->blue, 0.0, 1.0) * alpha * 65535.0 + 0.5) >> 8;
+
+	return (a << 24) | (r << 16) | (g << 8) | b;
+}
+
+/* The OVER operator on premultiplied pixels, with pixman's rounding. */
+static guint32 over(guint32 src, guint32 dst)
+{
+	guint32 ialpha = 255 - (src >> 24);
+	guint32 result = 0;
+
+	for (guint shift = 0; shift < 32; shift += 8) {
+		guint32 t = ((dst >> shift) & 0xff) * ialpha + 0x80;
+		t = ((t >> 8) + t) >> 8;
+		t += (src >> shift) & 0xff;
+		if (t > 0xff) t = 0xff;
+		result |= t << shift;
+	}
+
+	return result;
+}
@@ -0,0 +1,79 @@
+/*
+ *  Copyright (C) 2019 David Lazar <dlazar@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __RENDER_H__
+#define __RENDER_H__
+
+#include <glib.h>
+#include <cairo.h>
+#include <gdk/gdk.h>
+
+G_BEGIN_DECLS
+
+typedef struct {
+	GdkRGBA bg_color;
+	GdkRGBA rx_color;
+	GdkRGBA tx_color;
+	GdkRGBA drop_color;
+
+	/* The same colors as premultiplied ARGB32 pixels, already composited
+	 * in the order they are drawn. */
+	guint32 bg_pixel;
+	guint32 rx_pixel;    /* rx over bg */
+	guint32 tx_pixel;    /* tx over bg */
+	guint32 both_pixel;  /* tx over rx over bg */
+	guint32 drop_pixel;     /* drop over bg */
+	guint32 drop_tx_pixel;  /* tx over drop over bg */
+} RenderStyle;
+
+void render_style_init(RenderStyle *this, const GdkRGBA *bg_color,
+		       const GdkRGBA *rx_color, const GdkRGBA *tx_color,
+		       const GdkRGBA *drop_color);
+
+/* Converts a color to a premultiplied ARGB32 pixel, the same way cairo
+ * does. */
+guint32 render_premultiply(const GdkRGBA *color);
+
+/* Both renderers paint the columns [x0, x1) of an ARGB32 image surface.
+ * The download bar of column x0 + i is rx_seg[i] pixels tall and grows up
+ * from the bottom, the upload bar is tx_seg[i] pixels tall and grows down
+ * from the top.  Unless `drop_seg` is NULL, the bottom drop_seg[i] pixels
+ * are painted in the drop color instead of the download color, under the
+ * upload bar.  Their output is identical. */
+void render_columns_cairo(cairo_surface_t *surface, const RenderStyle *style,
+			  const guint32 *rx_seg, const guint32 *tx_seg,
+			  const guint32 *drop_seg, guint x0, guint x1);
+void render_columns_pixels(cairo_surface_t *surface, const RenderStyle *style,
+			   const guint32 *rx_seg, const guint32 *tx_seg,
+			   const guint32 *drop_seg, guint x0, guint x1);
+
+/* Paints the columns [x0, x1) with a band for each of `n_bands` devices,
+ * in the premultiplied `colors`, over the background of `style`.  The
+ * download bands are stacked up from the bottom, and the upload bands down
+ * from the top, over them.  For column x0 + i, rx_bounds[i * n_bands + k]
+ * is how far up band k reaches, and tx_bounds[i * n_bands + k] how far
+ * down, in pixels, so both must not decrease with k.  The tops of the
+ * download bars are the same as with render_columns_pixels(). */
+void render_stacked_pixels(cairo_surface_t *surface, const RenderStyle *style,
+			   const guint32 *colors, guint n_bands,
+			   const guint32 *rx_bounds, const guint32 *tx_bounds,
+			   guint x0, guint x1);
+
+G_END_DECLS
+
+#endif  /* __RENDER_H__ */
@@ -0,0 +1,337 @@
+/*
+ *  Copyright (C) 2019 David Lazar <dlazar@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "rrd.h"
+
+#include <string.h>
+#include <glib.h>
+
+/* Milliseconds consolidated into the points of each tier. */
+static const guint64 tier_periods[RRD_N_TIERS] = {
+	[RRD_TIER_MINUTE] = 60 * 1000,
+	[RRD_TIER_HOUR] = 60 * 60 * 1000,
+};
+
+static void tier_resize(RrdTier *this, gsize newlen);
+static void tier_set_compact(RrdTier *this, gboolean compact);
+static void tier_set_at(RrdTier *this, gsize pos, const RrdPoint *point);
+static void tier_push(RrdTier *this, guint64 now, guint64 sample, guint interval);
+static void tier_consolidate(RrdTier *this);
+static void tier_append(RrdTier *this, const RrdPoint *point);
+static void tier_add_pending(RrdTier *this, const RrdTier *other);
+static void tier_subtract_pending(RrdTier *this, const RrdTier *other);
+static guint64 subtract(guint64 a, guint64 b);
+static void tier_update_peak(RrdTier *this);
+
+
+// Allow variable declarations at the first use.
+#pragma GCC diagnostic ignored "-Wdeclaration-after-statement"
+
+
+Rrd *rrd_new(gsize len)
+{
+	Rrd *this = g_slice_new0(Rrd);
+
+	for (gint i = 0; i < RRD_N_TIERS; i++) {
+		RrdTier *tier = &this->tiers[i];
+		tier->points = g_new0(RrdPoint, len);
+		tier->len = len;
+		tier->period = tier_periods[i];
+	}
+
+	return this;
+}
+
+void rrd_free(Rrd *this)
+{
+	for (gint i = 0; i < RRD_N_TIERS; i++) {
+		g_free(this->tiers[i].points);
+		g_free(this->tiers[i].codes);
+	}
+
+	g_slice_free(Rrd, this);
+}
+
+void rrd_resize(Rrd *this, gsize newlen)
+{
+	for (gint i = 0; i < RRD_N_TIERS; i++) {
+		tier_resize(&this->tiers[i], newlen);
+	}
+}
+
+void rrd_clear(Rrd *this)
+{
+	for (gint i = 0; i < RRD_N_TIERS; i++) {
+		RrdTier *tier = &this->tiers[i];
+		if (tier->codes) {
+			memset(tier->codes, 0, tier->len * sizeof(RrdCode));
+		} else {
+			memset(tier->points, 0, tier->len * sizeof(RrdPoint));
+		}
+		tier->peak = 0;
+		tier->acc_time = 0;
+	}
+}
+
+void rrd_set_compact(Rrd *this, gboolean compact)
+{
+	for (gint i = 0; i < RRD_N_TIERS; i++) {
+		tier_set_compact(&this->tiers[i], compact);
+	}
+}
+
+void rrd_push(Rrd *this, guint64 now, guint64 sample, guint interval)
+{
+	for (gint i = 0; i < RRD_N_TIERS; i++) {
+		tier_push(&this->tiers[i], now, sample, interval);
+	}
+}
+
+void rrd_add(Rrd *this, const Rrd *other)
+{
+	for (gint i = 0; i < RRD_N_TIERS; i++) {
+		RrdTier *tier = &this->tiers[i];
+		const RrdTier *other_tier = &other->tiers[i];
+		g_return_if_fail(tier->len == other_tier->len);
+
+		for (gsize age = 0; age < tier->len; age++) {
+			gsize pos = (tier->head >= age) ? tier->head - age
+							: tier->head + tier->len - age;
+			RrdPoint point = rrd_tier_at(tier, pos);
+			RrdPoint other_point = rrd_get(other, i, age);
+			point.min += other_point.min;
+			point.avg += other_point.avg;
+			point.max += other_point.max;
+			tier_set_at(tier, pos, &point);
+		}
+		tier_update_peak(tier);
+
+		tier_add_pending(tier, other_tier);
+	}
+}
+
+gboolean rrd_subtract(Rrd *this, const Rrd *other)
+{
+	gboolean changed = FALSE;
+	for (gint i = 0; i < RRD_N_TIERS; i++) {
+		RrdTier *tier = &this->tiers[i];
+		const RrdTier *other_tier = &other->tiers[i];
+		g_return_val_if_fail(tier->len == other_tier->len, changed);
+
+		gboolean tier_changed = FALSE;
+		for (gsize age = 0; age < tier->len; age++) {
+			RrdPoint other_point = rrd_get(other, i, age);
+			if (!other_point.max) continue;
+
+			gsize pos = (tier->head >= age) ? tier->head - age
+							: tier->head + tier->len - age;
+			RrdPoint point = rrd_tier_at(tier, pos);
+			point.min = subtract(point.min, other_point.min);
+			point.avg = subtract(point.avg, other_point.avg);
+			point.max = subtract(point.max, other_point.max);
+			tier_set_at(tier, pos, &point);
+			tier_changed = TRUE;
+		}
+		if (tier_changed) tier_update_peak(tier);
+		changed |= tier_changed;
+
+		tier_subtract_pending(tier, other_tier);
+	}
+	return changed;
+}
+
+static void tier_resize(RrdTier *this, gsize newlen)
+{
+	if (newlen == this->len) return;
+
+	/* Keep the most recent points, oldest first. */
+	gsize keep = MIN(this->len, newlen);
+	if (this->codes) {
+		RrdCode *codes = g_new0(RrdCode, MAX(newlen, 1));
+		for (gsize i = 0; i < keep; i++) {
+			gsize age = keep - 1 - i;
+			gsize pos = (this->head >= age) ? this->head - age
+							: this->head + this->len - age;
+			codes[i] = this->codes[pos];
+		}
+		g_free(this->codes);
+		this->codes = codes;
+	} else {
+		RrdPoint *points = g_new0(RrdPoint, newlen);
+		for (gsize i = 0; i < keep; i++) {
+			gsize age = keep - 1 - i;
+			gsize pos = (this->head >= age) ? this->head - age
+							: this->head + this->len - age;
+			points[i] = this->points[pos];
+		}
+		g_free(this->points);
+		this->points = points;
+	}
+	this->len = newlen;
+	this->head = keep ? keep - 1 : 0;
+
+	tier_update_peak(this);
+}
+
+static void tier_set_compact(RrdTier *this, gboolean compact)
+{
+	if (compact == (this->codes != NULL)) return;
+
+	if (compact) {
+		this->codes = g_new(RrdCode, MAX(this->len, 1));
+		for (gsize pos = 0; pos < this->len; pos++) {
+			tier_set_at(this, pos, &this->points[pos]);
+		}
+		g_free(this->points);
+		this->points = NULL;
+	} else {
+		RrdPoint *points = g_new(RrdPoint, this->len);
+		for (gsize pos = 0; pos < this->len; pos++) {
+			points[pos] = rrd_tier_at(this, pos);
+		}
+		g_free(this->codes);
+		this->codes = NULL;
+		this->points = points;
+	}
+
+	/* The peak may have been rounded down. */
+	tier_update_peak(this);
+}
+
+/* Stores a point, without updating the peak. */
+static void tier_set_at(RrdTier *this, gsize pos, const RrdPoint *point)
+{
+	if (this->codes) {
+		RrdCode *code = &this->codes[pos];
+		code->min = history_encode(point->min);
+		code->avg = history_encode(point->avg);
+		code->max = history_encode(point->max);
+	} else {
+		this->points[pos] = *point;
+	}
+}
+
+static void tier_push(RrdTier *this, guint64 now, guint64 sample, guint interval)
+{
+	guint64 bucket = now / this->period;
+
+	if (this->acc_time == 0) {
+		this->bucket = bucket;
+	} else if (bucket > this->bucket) {
+		tier_consolidate(this);
+
+		/* Leave empty points for the periods without samples, e.g.
+		 * while the system was suspended, as long as the timestamps
+		 * count that time. */
+		static const RrdPoint empty;
+		guint64 missed = MIN(bucket - this->bucket - 1, this->len);
+		for (guint64 i = 0; i < missed; i++) tier_append(this, &empty);
+		this->count += bucket - this->bucket - 1 - missed;
+
+		this->bucket = bucket;
+	}
+
+	if (this->acc_time == 0) {
+		this->acc_min = sample;
+		this->acc_max = sample;
+		this->acc_sum = 0;
+	}
+	this->acc_min = MIN(this->acc_min, sample);
+	this->acc_max = MAX(this->acc_max, sample);
+	this->acc_sum += sample * interval;
+	this->acc_time += interval;
+}
+
+/* Turns the pending samples into a point. */
+static void tier_consolidate(RrdTier *this)
+{
+	RrdPoint point = {
+		.min = this->acc_min,
+		.avg = this->acc_sum / this->acc_time,
+		.max = this->acc_max,
+	};
+	tier_append(this, &point);
+
+	this->acc_time = 0;
+}
+
+static void tier_append(RrdTier *this, const RrdPoint *point)
+{
+	this->count++;
+	if (this->len == 0) return;
+
+	this->head++;
+	if (this->head == this->len) this->head = 0;
+
+	guint64 old_avg = rrd_tier_at(this, this->head).avg;
+	tier_set_at(this, this->head, point);
+
+	/* Points are only added once per period, so it's cheap enough to
+	 * rescan when the peak falls out of the window.  Compare the average
+	 * as it was stored. */
+	guint64 avg = rrd_tier_at(this, this->head).avg;
+	if (avg >= this->peak) {
+		this->peak = avg;
+	} else if (old_avg == this->peak) {
+		tier_update_peak(this);
+	}
+}
+
+static void tier_add_pending(RrdTier *this, const RrdTier *other)
+{
+	if (other->acc_time == 0) return;
+
+	if (this->acc_time == 0) {
+		this->bucket = other->bucket;
+		this->acc_min = other->acc_min;
+		this->acc_max = other->acc_max;
+		this->acc_sum = other->acc_sum;
+		this->acc_time = other->acc_time;
+		return;
+	}
+
+	/* Both archives saw the same updates, except that one of them may
+	 * have started later in the period. */
+	this->acc_min += other->acc_min;
+	this->acc_max += other->acc_max;
+	this->acc_sum += other->acc_sum;
+	this->acc_time = MAX(this->acc_time, other->acc_time);
+}
+
+static void tier_subtract_pending(RrdTier *this, const RrdTier *other)
+{
+	if (this->acc_time == 0 || other->acc_time == 0) return;
+	if (this->bucket != other->bucket) return;
+
+	this->acc_min = subtract(this->acc_min, other->acc_min);
+	this->acc_max = subtract(this->acc_max, other->acc_max);
+	this->acc_sum = subtract(this->acc_sum, other->acc_sum);
+}
+
+static guint64 subtract(guint64 a, guint64 b)
+{
+	return (a > b) ? a - b : 0;
+}
+
+static void tier_update_peak(RrdTier *this)
+{
+	this->peak = 0;
+	for (gsize i = 0; i < this->len; i++) {
+		this->peak = MAX(this->peak, rrd_tier_at(this, i).avg);
+	}
+}
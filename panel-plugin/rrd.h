@@ -0,0 +1,136 @@
+/*
+ *  Copyright (C) 2019 David Lazar <dlazar@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __RRD_H__
+#define __RRD_H__
+
+#include <glib.h>
+
+#include "history.h"
+
+G_BEGIN_DECLS
+
+/* Round-robin archive of consolidated samples, like the ones of RRDtool.
+ * Every tier consolidates the raw samples over a fixed period, and keeps a
+ * fixed number of the most recent consolidated points, so memory use does
+ * not depend on how long the plugin runs. */
+
+typedef enum {
+	RRD_TIER_MINUTE,
+	RRD_TIER_HOUR,
+	RRD_N_TIERS,
+} RrdTierId;
+
+typedef struct {
+	guint64 min;
+	guint64 avg;  /* Weighted by the interval of each sample. */
+	guint64 max;
+} RrdPoint;
+
+/* A point of a compact tier, encoded like the samples of a compact
+ * history. */
+typedef struct {
+	guint32 min;
+	guint32 avg;
+	guint32 max;
+} RrdCode;
+
+typedef struct {
+	RrdPoint *points;  /* Circular buffer, NULL when compact. */
+	/* Only set when compact, see rrd_set_compact(), even if empty. */
+	RrdCode *codes;
+	gsize len;
+	gsize head;  /* Position of the most recent point. */
+	guint64 count;  /* Number of points added so far, including gaps. */
+	guint64 peak;  /* Largest avg among the points. */
+
+	guint64 period;  /* Milliseconds consolidated into each point. */
+	guint64 bucket;  /* Timestamp of the pending point, divided by period. */
+
+	/* The pending point, empty while acc_time is 0. */
+	guint64 acc_min;
+	guint64 acc_max;
+	guint64 acc_sum;  /* Sum of sample * interval. */
+	guint64 acc_time;  /* Sum of intervals. */
+} RrdTier;
+
+typedef struct {
+	RrdTier tiers[RRD_N_TIERS];
+} Rrd;
+
+Rrd *rrd_new(gsize len);
+void rrd_free(Rrd *this);
+void rrd_resize(Rrd *this, gsize newlen);
+void rrd_clear(Rrd *this);
+
+/* Keeps the points in 32 bits, rounded like the samples of a compact
+ * history, which halves the memory of the archive. */
+void rrd_set_compact(Rrd *this, gboolean compact);
+
+/* Adds a sample that covers the `interval` milliseconds before `now`.
+ * Timestamps must come from the same clock for all the archives that are
+ * combined with rrd_add(), so that their points line up. */
+void rrd_push(Rrd *this, guint64 now, guint64 sample, guint interval);
+
+/* Adds another archive of the same length, point by point.  The averages
+ * add up exactly, while the minimums and maximums become bounds. */
+void rrd_add(Rrd *this, const Rrd *other);
+
+/* Takes back what rrd_add() added, or what was pushed as part of a sum,
+ * stopping at 0.  Returns whether any of the points changed. */
+gboolean rrd_subtract(Rrd *this, const Rrd *other);
+
+/* Returns the point at a position in `points`, or `codes`. */
+static inline RrdPoint rrd_tier_at(const RrdTier *this, gsize pos)
+{
+	if (!this->codes) return this->points[pos];
+
+	const RrdCode *code = &this->codes[pos];
+	RrdPoint point = {
+		.min = history_decode(code->min),
+		.avg = history_decode(code->avg),
+		.max = history_decode(code->max),
+	};
+	return point;
+}
+
+/* Returns the point that was added `age` points ago (0 is the newest). */
+static inline RrdPoint rrd_get(const Rrd *this, RrdTierId tier, gsize age)
+{
+	static const RrdPoint empty;
+	const RrdTier *t = &this->tiers[tier];
+
+	if (age >= t->len) return empty;
+
+	gsize pos = (t->head >= age) ? t->head - age : t->head + t->len - age;
+	return rrd_tier_at(t, pos);
+}
+
+static inline guint64 rrd_peak(const Rrd *this, RrdTierId tier)
+{
+	return this->tiers[tier].peak;
+}
+
+static inline guint64 rrd_count(const Rrd *this, RrdTierId tier)
+{
+	return this->tiers[tier].count;
+}
+
+G_END_DECLS
+
+#endif  /* __RRD_H__ */
@@ -0,0 +1,961 @@
+/*
+ *  Copyright (C) 2019 David Lazar <dlazar@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef HAVE_SYS_TIMERFD_H
+#include <sys/timerfd.h>
+#endif
+
+#include <glib.h>
+#include <glib-unix.h>
+
+#include "sampler.h"
+
+#include "filter.h"
+#include "instrument.h"
+
+/* Snapshots that can wait to be consumed.  One slot is always left empty,
+ * to tell a full ring from an empty one. */
+#define RING_SIZE	8
+
+/* Below this, the sampler ticks at the shortest interval of the views,
+ * instead of at one that divides all of them. */
+#define MIN_BASE_INTERVAL	50	/* milliseconds */
+
+/* In adaptive mode, the interval doubles after this many ticks without
+ * traffic, up to MAX_BACKOFF seconds. */
+#define IDLE_TICKS	5
+#define MAX_BACKOFF	16	/* seconds */
+
+/* What the sampler thread reads: the union of what all the views need. */
+typedef struct {
+	guint interval;  /* milliseconds */
+	gboolean adaptive;
+	gboolean count_packets;
+	gchar **dev_names;  /* Only set when sampling a fixed list of interfaces. */
+	GPtrArray *filters;  /* Of the views, NULL when sampling all interfaces. */
+	guint generation;
+} SamplerConfig;
+
+typedef struct {
+	guint generation;  /* Of the config it was taken with. */
+	SamplerSnapshot snapshot;
+} RingSlot;
+
+/* One per process, shared by all the plugins in it, so that every interface
+ * is read once per tick no matter how many graphs show it. */
+typedef struct {
+	/* Only used by the main thread. */
+	GPtrArray *views;
+	guint interval;  /* Of the latest config. */
+	guint generation;
+	guint notify_id;
+
+	/* Shared between the threads.  The ring is a single-producer,
+	 * single-consumer queue: only the sampler thread writes `head`, and
+	 * only the main thread writes `tail`. */
+	RingSlot ring[RING_SIZE];
+	gint head;
+	gint tail;
+	SamplerConfig *pending;  /* Handed over with an atomic swap. */
+	gint quit;
+	int notify_fds[2];  /* Wakes up the main thread. */
+	int wake_fds[2];  /* Wakes up the sampler thread. */
+
+	/* Only used by the sampler thread. */
+	GThread *thread;
+	GMainContext *context;
+	GMainLoop *loop;
+	SamplerConfig *config;
+	GPtrArray *probes;  /* In no particular order. */
+	/* The positions of the probes, plus 1, by name and by ifindex, so that
+	 * following the link events takes constant time. */
+	GHashTable *probe_names;
+	GHashTable *probe_ifindexes;
+	NetdevMonitor *monitor;  /* Only used when sampling all interfaces. */
+	GSource *timer;
+	int timer_fd;
+	guint backoff;  /* Seconds between ticks while idle, 0 if not idle. */
+	guint idle_ticks;  /* Since the counters last changed. */
+	guint64 last_bytes;  /* Sum of all the counters at the last tick. */
+	gint64 last_tick;  /* Monotonic time of the last snapshot. */
+	guint skipped_ticks;  /* Regular ticks dropped since then. */
+} SamplerCore;
+
+/* What one plugin asked for.  The snapshots are filtered and spaced out to
+ * match. */
+struct _Sampler {
+	SamplerFunc func;
+	gpointer user_data;
+
+	gboolean configured;
+	guint interval;  /* milliseconds */
+	gboolean adaptive;
+	gboolean count_packets;
+	gchar *dev_names;  /* As configured. */
+	gchar **names;  /* Only set for a fixed list of interfaces. */
+	Filter *filter;  /* NULL when sampling all interfaces. */
+
+	gint64 elapsed;  /* Milliseconds of samples it hasn't been given yet. */
+	SamplerSnapshot snapshot;  /* The entries that pass the filter. */
+};
+
+
+static SamplerCore *shared_core;
+
+
+static SamplerCore *core_new(void);
+static void core_free(SamplerCore *this);
+static void reconfigure(SamplerCore *this);
+static SamplerConfig *merge_views(SamplerCore *this);
+static guint gcd(guint a, guint b);
+static void config_free(SamplerConfig *config);
+static gboolean config_match(const SamplerConfig *config, const gchar *name);
+static SamplerConfig *swap_config(SamplerCore *this, SamplerConfig *config);
+static void notify(int fd);
+static void drain(int fd);
+static gboolean on_notify(gint fd, GIOCondition condition, SamplerCore *this);
+static void deliver(SamplerCore *this, const SamplerSnapshot *snapshot);
+static gpointer sampler_thread(SamplerCore *this);
+static gboolean on_wake(gint fd, GIOCondition condition, SamplerCore *this);
+static void apply_config(SamplerCore *this, SamplerConfig *config);
+static void start_timer(SamplerCore *this);
+static void stop_timer(SamplerCore *this);
+#ifdef HAVE_SYS_TIMERFD_H
+static gboolean on_timer(gint fd, GIOCondition condition, SamplerCore *this);
+#endif
+static gboolean on_tick(SamplerCore *this);
+static void take_snapshot(SamplerCore *this, SamplerSnapshot *snapshot);
+static guint count_ticks(SamplerCore *this, const SamplerSnapshot *snapshot);
+static void update_backoff(SamplerCore *this, const SamplerSnapshot *snapshot);
+static void set_backoff(SamplerCore *this, guint backoff);
+static void enumerate_probes(SamplerCore *this);
+static void sync_probes(SamplerCore *this, gchar **names, guint n_names);
+static gint find_probe(SamplerCore *this, gint ifindex, const gchar *name);
+static gint get_position(GHashTable *index, gconstpointer key);
+static void index_probe(SamplerCore *this, guint i);
+static void unindex_probe(SamplerCore *this, guint i, gint ifindex);
+static void reindex_probes(SamplerCore *this);
+static NetdevProbe *new_probe(SamplerCore *this, const gchar *name);
+static void add_probe(SamplerCore *this, NetdevProbe *probe);
+static void remove_probe(SamplerCore *this, guint i);
+static void free_probes(SamplerCore *this);
+static void on_link_event(NetdevLinkEvent event, gint ifindex, const gchar *name, gboolean is_up, SamplerCore *this);
+
+
+// Allow variable declarations at the first use.
+#pragma GCC diagnostic ignored "-Wdeclaration-after-statement"
+
+
+Sampler *sampler_new(SamplerFunc func, gpointer user_data)
+{
+	if (!shared_core) shared_core = core_new();
+
+	Sampler *this = g_slice_new0(Sampler);
+	this->func = func;
+	this->user_data = user_data;
+	g_ptr_array_add(shared_core->views, this);
+
+	return this;
+}
+
+void sampler_free(Sampler *this)
+{
+	SamplerCore *core = shared_core;
+	g_ptr_array_remove(core->views, this);
+	if (core->views->len == 0) {
+		core_free(core);
+		shared_core = NULL;
+	} else if (this->configured) {
+		/* The others may need less now. */
+		reconfigure(core);
+	}
+
+	g_free(this->dev_names);
+	g_strfreev(this->names);
+	filter_free(this->filter);
+	g_free(this->snapshot.entries);
+	g_slice_free(Sampler, this);
+}
+
+void sampler_configure(Sampler *this, guint interval, gboolean adaptive,
+		       gboolean count_packets, const gchar *dev_names)
+{
+	this->configured = TRUE;
+	this->interval = interval;
+	this->adaptive = adaptive;
+	this->count_packets = count_packets;
+
+	g_free(this->dev_names);
+	g_strfreev(this->names);
+	filter_free(this->filter);
+	this->dev_names = g_strdup(dev_names);
+	this->names = NULL;
+	this->filter = filter_new(dev_names);
+	if (this->filter && filter_is_fixed(this->filter)) {
+		this->names = g_strsplit_set(dev_names, ", \t\r\n", -1);
+	}
+
+	reconfigure(shared_core);
+}
+
+static SamplerCore *core_new(void)
+{
+	SamplerCore *this = g_slice_new0(SamplerCore);
+	this->views = g_ptr_array_new();
+	this->timer_fd = -1;
+
+	g_autoptr(GError) error = NULL;
+	if (!g_unix_open_pipe(this->notify_fds, FD_CLOEXEC, &error)
+	    || !g_unix_open_pipe(this->wake_fds, FD_CLOEXEC, &error)) {
+		g_error("Could not create a pipe: %s.", error->message);
+	}
+	for (int i = 0; i < 2; i++) {
+		g_unix_set_fd_nonblocking(this->notify_fds[i], TRUE, NULL);
+		g_unix_set_fd_nonblocking(this->wake_fds[i], TRUE, NULL);
+	}
+
+	this->notify_id = g_unix_fd_add(this->notify_fds[0], G_IO_IN,
+		(GUnixFDSourceFunc)on_notify, this);
+
+	this->context = g_main_context_new();
+	this->loop = g_main_loop_new(this->context, FALSE);
+	this->probes = g_ptr_array_new();
+	this->probe_names = g_hash_table_new(g_str_hash, g_str_equal);
+	this->probe_ifindexes = g_hash_table_new(g_direct_hash, g_direct_equal);
+	this->thread = g_thread_new("netgraph-sampler", (GThreadFunc)sampler_thread, this);
+
+	return this;
+}
+
+static void core_free(SamplerCore *this)
+{
+	/* Quitting the loop from here could get lost if the thread hasn't
+	 * started running it yet, while the pipe keeps the wakeup. */
+	g_atomic_int_set(&this->quit, TRUE);
+	notify(this->wake_fds[1]);
+	g_thread_join(this->thread);
+
+	g_source_remove(this->notify_id);
+	for (int i = 0; i < 2; i++) {
+		close(this->notify_fds[i]);
+		close(this->wake_fds[i]);
+	}
+
+	config_free(swap_config(this, NULL));
+	g_ptr_array_free(this->probes, TRUE);
+	g_hash_table_destroy(this->probe_names);
+	g_hash_table_destroy(this->probe_ifindexes);
+	for (gint i = 0; i < RING_SIZE; i++) {
+		g_free(this->ring[i].snapshot.entries);
+	}
+	g_main_loop_unref(this->loop);
+	g_main_context_unref(this->context);
+	g_ptr_array_free(this->views, TRUE);
+
+	g_slice_free(SamplerCore, this);
+}
+
+/* Hands the sampler thread a config that covers all the views. */
+static void reconfigure(SamplerCore *this)
+{
+	SamplerConfig *config = merge_views(this);
+	if (!config) return;
+
+	this->interval = config->interval;
+	config->generation = ++this->generation;
+	for (guint i = 0; i < this->views->len; i++) {
+		Sampler *view = g_ptr_array_index(this->views, i);
+		view->elapsed = 0;
+	}
+
+	/* If the sampler didn't pick up the previous config yet, it never
+	 * will, so it's ours to free. */
+	config_free(swap_config(this, config));
+	notify(this->wake_fds[1]);
+}
+
+/* Ticks at an interval that all the views' are a multiple of, reads the
+ * packet counters if any view needs them, and the interfaces that pass any
+ * of the filters.  Returns NULL if no view is configured yet. */
+static SamplerConfig *merge_views(SamplerCore *this)
+{
+	guint min_interval = 0, base_interval = 0;
+	gboolean adaptive = TRUE, count_packets = FALSE;
+	gboolean all = FALSE, fixed = TRUE;
+	GPtrArray *filters = g_ptr_array_new_with_free_func((GDestroyNotify)filter_free);
+	g_autoptr(GHashTable) names = g_hash_table_new(g_str_hash, g_str_equal);
+
+	for (guint i = 0; i < this->views->len; i++) {
+		Sampler *view = g_ptr_array_index(this->views, i);
+		if (!view->configured) continue;
+
+		min_interval = min_interval ? MIN(min_interval, view->interval) : view->interval;
+		base_interval = base_interval ? gcd(base_interval, view->interval) : view->interval;
+		adaptive = adaptive && view->adaptive;
+		count_packets = count_packets || view->count_packets;
+
+		if (!view->filter) {
+			all = TRUE;
+			continue;
+		}
+
+		/* The thread gets filters of its own, as the views can be
+		 * freed while it uses them. */
+		g_ptr_array_add(filters, filter_new(view->dev_names));
+		if (!view->names) {
+			fixed = FALSE;
+			continue;
+		}
+		for (gsize j = 0; view->names[j] != NULL; j++) {
+			if (*view->names[j]) g_hash_table_add(names, view->names[j]);
+		}
+	}
+
+	if (min_interval == 0) {
+		g_ptr_array_free(filters, TRUE);
+		return NULL;
+	}
+
+	SamplerConfig *config = g_new0(SamplerConfig, 1);
+	config->interval = (base_interval >= MIN_BASE_INTERVAL) ? base_interval : min_interval;
+	config->adaptive = adaptive;
+	config->count_packets = count_packets;
+
+	if (all) {
+		g_ptr_array_free(filters, TRUE);
+		return config;
+	}
+	config->filters = filters;
+
+	if (fixed) {
+		config->dev_names = g_new(gchar *, g_hash_table_size(names) + 1);
+		GHashTableIter iter;
+		const gchar *name;
+		gsize n = 0;
+		g_hash_table_iter_init(&iter, names);
+		while (g_hash_table_iter_next(&iter, (gpointer *)&name, NULL)) {
+			config->dev_names[n++] = g_strdup(name);
+		}
+		config->dev_names[n] = NULL;
+	}
+
+	return config;
+}
+
+static guint gcd(guint a, guint b)
+{
+	while (b) {
+		guint r = a % b;
+		a = b;
+		b = r;
+	}
+	return a;
+}
+
+static void config_free(SamplerConfig *config)
+{
+	if (!config) return;
+
+	g_strfreev(config->dev_names);
+	if (config->filters) g_ptr_array_free(config->filters, TRUE);
+	g_free(config);
+}
+
+/* Whether the thread should sample an interface. */
+static gboolean config_match(const SamplerConfig *config, const gchar *name)
+{
+	if (!config->filters) return TRUE;
+
+	for (guint i = 0; i < config->filters->len; i++) {
+		if (filter_match(g_ptr_array_index(config->filters, i), name)) return TRUE;
+	}
+	return FALSE;
+}
+
+static SamplerConfig *swap_config(SamplerCore *this, SamplerConfig *config)
+{
+	SamplerConfig *old;
+	do {
+		old = g_atomic_pointer_get(&this->pending);
+	} while (!g_atomic_pointer_compare_and_exchange(&this->pending, old, config));
+
+	return old;
+}
+
+static void notify(int fd)
+{
+	/* A full pipe already has a wakeup pending. */
+	if (write(fd, "", 1) < 0 && errno != EAGAIN) {
+		g_warning("Could not write to the sampler pipe: %s.", g_strerror(errno));
+	}
+}
+
+static void drain(int fd)
+{
+	gchar buf[64];
+	while (read(fd, buf, sizeof(buf)) > 0);
+}
+
+static gboolean on_notify(gint fd, GIOCondition condition, SamplerCore *this)
+{
+	/* Drain before looking at the ring, so that a snapshot published
+	 * afterwards comes with a wakeup of its own. */
+	drain(fd);
+
+	gint tail = this->tail;
+	while (tail != g_atomic_int_get(&this->head)) {
+		RingSlot *slot = &this->ring[tail];
+
+		/* Skip the snapshots taken before the last reconfiguration. */
+		if (slot->generation == this->generation) {
+			deliver(this, &slot->snapshot);
+		}
+
+		tail = (tail + 1) % RING_SIZE;
+		g_atomic_int_set(&this->tail, tail);
+	}
+
+	return TRUE;
+}
+
+/* Passes the snapshot on to the views that are due for one, with only the
+ * interfaces they asked for. */
+static void deliver(SamplerCore *this, const SamplerSnapshot *snapshot)
+{
+	for (guint i = 0; i < this->views->len; i++) {
+		Sampler *view = g_ptr_array_index(this->views, i);
+		if (!view->configured) continue;
+
+		/* The interval of a view is normally a multiple of the base
+		 * one, otherwise it gets the snapshot closest to when it's
+		 * due. */
+		gint64 interval = view->interval;
+		view->elapsed += (gint64)snapshot->ticks * this->interval;
+		if (view->elapsed < interval - this->interval / 2) continue;
+
+		guint ticks = MAX((view->elapsed + interval / 2) / interval, 1);
+		view->elapsed -= ticks * interval;
+
+		if (!view->filter) {
+			SamplerSnapshot all = *snapshot;
+			all.ticks = ticks;
+			view->func(&all, view->user_data);
+			continue;
+		}
+
+		SamplerSnapshot *filtered = &view->snapshot;
+		if (snapshot->n_entries > filtered->n_alloc) {
+			filtered->entries = g_renew(SamplerEntry, filtered->entries,
+						    snapshot->n_entries);
+			filtered->n_alloc = snapshot->n_entries;
+		}
+		guint n = 0;
+		for (guint j = 0; j < snapshot->n_entries; j++) {
+			const SamplerEntry *entry = &snapshot->entries[j];
+			if (filter_match(view->filter, entry->name)) {
+				filtered->entries[n++] = *entry;
+			}
+		}
+		filtered->n_entries = n;
+		filtered->time = snapshot->time;
+		filtered->ticks = ticks;
+		view->func(filtered, view->user_data);
+	}
+}
+
+static gpointer sampler_thread(SamplerCore *this)
+{
+	/* The netdev monitor attaches to the thread-default context. */
+	g_main_context_push_thread_default(this->context);
+
+	GSource *wake = g_unix_fd_source_new(this->wake_fds[0], G_IO_IN);
+	g_source_set_callback(wake, (GSourceFunc)on_wake, this, NULL);
+	g_source_attach(wake, this->context);
+
+	g_main_loop_run(this->loop);
+
+	g_source_destroy(wake);
+	g_source_unref(wake);
+	stop_timer(this);
+	if (this->monitor) netdev_monitor_free(this->monitor);
+	this->monitor = NULL;
+	free_probes(this);
+	config_free(this->config);
+	this->config = NULL;
+
+	g_main_context_pop_thread_default(this->context);
+
+	return NULL;
+}
+
+static gboolean on_wake(gint fd, GIOCondition condition, SamplerCore *this)
+{
+	drain(fd);
+
+	if (g_atomic_int_get(&this->quit)) {
+		g_main_loop_quit(this->loop);
+		return TRUE;
+	}
+
+	SamplerConfig *config = swap_config(this, NULL);
+	if (config) apply_config(this, config);
+
+	return TRUE;
+}
+
+static void apply_config(SamplerCore *this, SamplerConfig *config)
+{
+	guint old_interval = this->config ? this->config->interval : 0;
+	guint old_backoff = this->backoff;
+	config_free(this->config);
+	this->config = config;
+
+	for (guint i = 0; i < this->probes->len; i++) {
+		netdev_probe_set_counters(g_ptr_array_index(this->probes, i),
+					  config->count_packets);
+	}
+
+	if (config->dev_names) {
+		if (this->monitor) netdev_monitor_free(this->monitor);
+		this->monitor = NULL;
+
+		sync_probes(this, config->dev_names, g_strv_length(config->dev_names));
+	} else {
+		/* Subscribe to link changes before enumerating the links,
+		 * so that no change can get lost in between. */
+		if (!this->monitor) {
+			this->monitor = netdev_monitor_new(
+				(NetdevLinkFunc)on_link_event, this);
+		}
+		netdev_refresh();
+		enumerate_probes(this);
+	}
+
+	/* Start over at the configured interval, as the new config may well
+	 * bring some traffic. */
+	this->backoff = 0;
+	this->idle_ticks = 0;
+
+	if (config->interval != old_interval || old_backoff) {
+		stop_timer(this);
+		start_timer(this);
+	}
+}
+
+static void start_timer(SamplerCore *this)
+{
+	guint interval = this->config->interval;
+
+	if (this->backoff) {
+		/* Precision doesn't matter while idle, so let GLib line the
+		 * wakeups up with the other whole-second timers instead. */
+		this->timer = g_timeout_source_new_seconds(this->backoff);
+		g_source_set_callback(this->timer, (GSourceFunc)on_tick, this, NULL);
+		g_source_attach(this->timer, this->context);
+		return;
+	}
+
+#ifdef HAVE_SYS_TIMERFD_H
+	/* A timeout is scheduled relative to when it was last dispatched, so
+	 * it drifts, especially with short intervals.  A timerfd keeps a
+	 * fixed period. */
+	this->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (this->timer_fd >= 0) {
+		struct itimerspec spec;
+		spec.it_interval.tv_sec = interval / 1000;
+		spec.it_interval.tv_nsec = (interval % 1000) * 1000000;
+		spec.it_value = spec.it_interval;
+
+		if (timerfd_settime(this->timer_fd, 0, &spec, NULL) == 0) {
+			this->timer = g_unix_fd_source_new(this->timer_fd, G_IO_IN);
+			g_source_set_callback(this->timer, (GSourceFunc)on_timer, this, NULL);
+			g_source_attach(this->timer, this->context);
+			return;
+		}
+
+		close(this->timer_fd);
+		this->timer_fd = -1;
+	}
+#endif
+
+	this->timer = g_timeout_source_new(interval);
+	g_source_set_callback(this->timer, (GSourceFunc)on_tick, this, NULL);
+	g_source_attach(this->timer, this->context);
+}
+
+static void stop_timer(SamplerCore *this)
+{
+	if (this->timer) {
+		g_source_destroy(this->timer);
+		g_source_unref(this->timer);
+	}
+	this->timer = NULL;
+
+#ifdef HAVE_SYS_TIMERFD_H
+	if (this->timer_fd >= 0) close(this->timer_fd);
+	this->timer_fd = -1;
+#endif
+}
+
+#ifdef HAVE_SYS_TIMERFD_H
+static gboolean on_timer(gint fd, GIOCondition condition, SamplerCore *this)
+{
+	/* If some expirations were missed, there is still only one update,
+	 * since the rates are computed over the actual elapsed time. */
+	guint64 expirations;
+	if (read(fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN) {
+		g_warning("Could not read the update timer: %s.", g_strerror(errno));
+	}
+
+	return on_tick(this);
+}
+#endif
+
+static gboolean on_tick(SamplerCore *this)
+{
+	INSTRUMENT_TICK(g_get_monotonic_time(),
+			this->backoff ? this->backoff * 1000 : this->config->interval);
+	INSTRUMENT_BEGIN(mark);
+	netdev_refresh();
+
+	/* Without link notifications, look for new interfaces every time. */
+	if (this->config->dev_names == NULL && this->monitor == NULL) {
+		enumerate_probes(this);
+	}
+
+	gint head = g_atomic_int_get(&this->head);
+	gint next = (head + 1) % RING_SIZE;
+	if (next == g_atomic_int_get(&this->tail)) {
+		/* The main thread is falling behind.  The rates stay right
+		 * as the next snapshot covers this tick, which is counted
+		 * so that the histories keep a column for it.  The elapsed
+		 * time already counts it while backed off. */
+		if (!this->backoff) this->skipped_ticks++;
+		return TRUE;
+	}
+
+	RingSlot *slot = &this->ring[head];
+	slot->generation = this->config->generation;
+	take_snapshot(this, &slot->snapshot);
+	slot->snapshot.ticks = count_ticks(this, &slot->snapshot);
+	INSTRUMENT_END(SPAN_SAMPLE, mark);
+
+	/* Publish the slot only once it's complete. */
+	g_atomic_int_set(&this->head, next);
+	notify(this->notify_fds[1]);
+
+	/* This may replace the timer, which is fine from its own callback. */
+	update_backoff(this, &slot->snapshot);
+
+	return TRUE;  /* Keep the timer active. */
+}
+
+static void take_snapshot(SamplerCore *this, SamplerSnapshot *snapshot)
+{
+	netdev_get_time(&snapshot->time);
+
+	/* The main thread is done with the slot, so it can be grown here. */
+	guint n = this->probes->len;
+	if (n > snapshot->n_alloc) {
+		snapshot->entries = g_renew(SamplerEntry, snapshot->entries, n);
+		snapshot->n_alloc = n;
+	}
+
+	for (guint i = 0; i < n; i++) {
+		NetdevProbe *probe = g_ptr_array_index(this->probes, i);
+		SamplerEntry *entry = &snapshot->entries[i];
+
+		/* rtnetlink finds re-created links by name, with a new
+		 * ifindex. */
+		gint ifindex = probe->ifindex;
+		netdev_probe_read(probe, &entry->stats);
+		if (probe->ifindex != ifindex) {
+			unindex_probe(this, i, ifindex);
+			index_probe(this, i);
+		}
+		entry->ifindex = probe->ifindex;
+		g_strlcpy(entry->name, probe->name, sizeof(entry->name));
+	}
+	snapshot->n_entries = n;
+}
+
+/* Returns how many update intervals passed since the previous snapshot.
+ * Only the backed-off timer and a full ring skip intervals; a late tick of
+ * the regular timer still counts as one. */
+static guint count_ticks(SamplerCore *this, const SamplerSnapshot *snapshot)
+{
+	gint64 elapsed = snapshot->time.monotonic - this->last_tick;
+	gboolean first = (this->last_tick == 0);
+	this->last_tick = snapshot->time.monotonic;
+
+	guint skipped = this->skipped_ticks;
+	this->skipped_ticks = 0;
+	if (!this->backoff || first || elapsed <= 0) return 1 + skipped;
+
+	gint64 interval = (gint64)this->config->interval * 1000;
+	return MAX((elapsed + interval / 2) / interval, 1);
+}
+
+/* Backs off while the counters stay the same, and goes back to the
+ * configured interval as soon as any of them changes. */
+static void update_backoff(SamplerCore *this, const SamplerSnapshot *snapshot)
+{
+	if (!this->config->adaptive) return;
+
+	guint64 bytes = 0;
+	for (guint i = 0; i < snapshot->n_entries; i++) {
+		const NetdevStats *stats = &snapshot->entries[i].stats;
+		bytes += stats->rx_bytes + stats->tx_bytes;
+	}
+	gboolean idle = (bytes == this->last_bytes);
+	this->last_bytes = bytes;
+
+	if (!idle) {
+		this->idle_ticks = 0;
+		if (this->backoff) set_backoff(this, 0);
+		return;
+	}
+
+	if (++this->idle_ticks < IDLE_TICKS) return;
+	this->idle_ticks = 0;
+
+	guint interval = this->config->interval;
+	guint backoff = MAX(this->backoff * 2, (2 * interval + 999) / 1000);
+	backoff = MIN(backoff, MAX_BACKOFF);
+
+	/* Long configured intervals have nothing to back off to. */
+	if (backoff != this->backoff && backoff * 1000 > interval) {
+		set_backoff(this, backoff);
+	}
+}
+
+static void set_backoff(SamplerCore *this, guint backoff)
+{
+	g_debug("Sampling every %u ms.", backoff ? backoff * 1000 : this->config->interval);
+
+	this->backoff = backoff;
+	stop_timer(this);
+	start_timer(this);
+}
+
+static void enumerate_probes(SamplerCore *this)
+{
+	g_autoptr(GPtrArray) dev_names = netdev_enumerate();
+	if (!dev_names) return;
+
+	/* Move the names that pass the filter to the front, keeping their
+	 * order, and free the others. */
+	guint n = 0;
+	for (guint i = 0; i < dev_names->len; i++) {
+		gchar *name = g_ptr_array_index(dev_names, i);
+		dev_names->pdata[i] = NULL;
+		if (!config_match(this->config, name)) {
+			g_free(name);
+			continue;
+		}
+		dev_names->pdata[n++] = name;
+	}
+
+	sync_probes(this, (gchar **)dev_names->pdata, n);
+}
+
+/* Makes the probes match `names`, keeping the ones that are still needed, so
+ * that they keep their open files. */
+static void sync_probes(SamplerCore *this, gchar **names, guint n_names)
+{
+	/* Index the current probes by name, so that this takes linear time
+	 * even with thousands of interfaces. */
+	GHashTable *old = g_hash_table_new(g_str_hash, g_str_equal);
+	for (guint i = 0; i < this->probes->len; i++) {
+		NetdevProbe *probe = g_ptr_array_index(this->probes, i);
+		g_hash_table_insert(old, probe->name, probe);
+	}
+
+	GPtrArray *probes = g_ptr_array_sized_new(n_names);
+	for (guint i = 0; i < n_names; i++) {
+		if (*names[i] == '\0') continue;
+
+		NetdevProbe *probe = g_hash_table_lookup(old, names[i]);
+		if (probe) {
+			g_hash_table_remove(old, names[i]);
+		} else {
+			probe = new_probe(this, names[i]);
+		}
+		g_ptr_array_add(probes, probe);
+	}
+
+	GHashTableIter iter;
+	NetdevProbe *probe;
+	g_hash_table_iter_init(&iter, old);
+	while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&probe)) {
+		netdev_probe_free(probe);
+	}
+	g_hash_table_destroy(old);
+
+	g_ptr_array_free(this->probes, TRUE);
+	this->probes = probes;
+	reindex_probes(this);
+}
+
+/* Looks up a probe by ifindex, or by name if the link was re-created. */
+static gint find_probe(SamplerCore *this, gint ifindex, const gchar *name)
+{
+	if (ifindex > 0) {
+		gint i = get_position(this->probe_ifindexes, GINT_TO_POINTER(ifindex));
+		if (i >= 0) return i;
+	}
+	return get_position(this->probe_names, name);
+}
+
+/* Returns -1 if `key` isn't in `index`. */
+static gint get_position(GHashTable *index, gconstpointer key)
+{
+	return (gint)GPOINTER_TO_UINT(g_hash_table_lookup(index, key)) - 1;
+}
+
+static void index_probe(SamplerCore *this, guint i)
+{
+	NetdevProbe *probe = g_ptr_array_index(this->probes, i);
+	gpointer position = GUINT_TO_POINTER(i + 1);
+
+	/* Replaces the keys too, as another probe may still own the old
+	 * ones. */
+	g_hash_table_replace(this->probe_names, probe->name, position);
+	if (probe->ifindex > 0) {
+		g_hash_table_replace(this->probe_ifindexes,
+				     GINT_TO_POINTER(probe->ifindex), position);
+	}
+}
+
+/* Only removes the entries that still point to position `i`, as another
+ * probe may have taken over the name or `ifindex`. */
+static void unindex_probe(SamplerCore *this, guint i, gint ifindex)
+{
+	NetdevProbe *probe = g_ptr_array_index(this->probes, i);
+
+	if (get_position(this->probe_names, probe->name) == (gint)i) {
+		g_hash_table_remove(this->probe_names, probe->name);
+	}
+	gpointer key = GINT_TO_POINTER(ifindex);
+	if (ifindex > 0 && get_position(this->probe_ifindexes, key) == (gint)i) {
+		g_hash_table_remove(this->probe_ifindexes, key);
+	}
+}
+
+static void reindex_probes(SamplerCore *this)
+{
+	g_hash_table_remove_all(this->probe_names);
+	g_hash_table_remove_all(this->probe_ifindexes);
+	for (guint i = 0; i < this->probes->len; i++) {
+		index_probe(this, i);
+	}
+}
+
+static NetdevProbe *new_probe(SamplerCore *this, const gchar *name)
+{
+	NetdevProbe *probe = netdev_probe_new(name);
+	netdev_probe_set_counters(probe, this->config->count_packets);
+	return probe;
+}
+
+static void add_probe(SamplerCore *this, NetdevProbe *probe)
+{
+	g_ptr_array_add(this->probes, probe);
+	index_probe(this, this->probes->len - 1);
+}
+
+/* Moves the last probe into the gap, as the order doesn't matter. */
+static void remove_probe(SamplerCore *this, guint i)
+{
+	NetdevProbe *probe = g_ptr_array_index(this->probes, i);
+	guint last = this->probes->len - 1;
+
+	unindex_probe(this, i, probe->ifindex);
+	if (i != last) {
+		NetdevProbe *moved = g_ptr_array_index(this->probes, last);
+		unindex_probe(this, last, moved->ifindex);
+	}
+	netdev_probe_free(probe);
+	g_ptr_array_remove_index_fast(this->probes, i);
+	if (i != last) index_probe(this, i);
+}
+
+static void free_probes(SamplerCore *this)
+{
+	for (guint i = 0; i < this->probes->len; i++) {
+		netdev_probe_free(g_ptr_array_index(this->probes, i));
+	}
+	g_ptr_array_set_size(this->probes, 0);
+	g_hash_table_remove_all(this->probe_names);
+	g_hash_table_remove_all(this->probe_ifindexes);
+}
+
+static void on_link_event(NetdevLinkEvent event,
+			  gint ifindex,
+			  const gchar *name,
+			  gboolean is_up,
+			  SamplerCore *this)
+{
+	if (event == NETDEV_LINK_RESYNC) {
+		g_debug("Lost some link notifications, re-enumerating netdevs.");
+		netdev_refresh();
+		enumerate_probes(this);
+		return;
+	}
+
+	gint i = find_probe(this, ifindex, name);
+
+	if (event == NETDEV_LINK_DEL || !is_up) {
+		/* The main thread keeps the device around until its traffic
+		 * scrolls out of the graph, and sees it as down meanwhile. */
+		if (i >= 0) remove_probe(this, i);
+		return;
+	}
+
+	if (!config_match(this->config, name)) {
+		/* A link that was renamed out of the filter is as good as
+		 * gone. */
+		if (i >= 0) remove_probe(this, i);
+		return;
+	}
+
+	if (i >= 0) {
+		NetdevProbe *probe = g_ptr_array_index(this->probes, i);
+		unindex_probe(this, i, probe->ifindex);
+		if (g_strcmp0(probe->name, name) != 0) netdev_probe_rename(probe, name);
+		probe->ifindex = ifindex;
+		index_probe(this, i);
+		return;
+	}
+
+	if (g_strcmp0(name, "lo") == 0) return;
+
+	NetdevProbe *probe = new_probe(this, name);
+	probe->ifindex = ifindex;
+	add_probe(this, probe);
+}
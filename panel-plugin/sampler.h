@@ -0,0 +1,70 @@
+/*
+ *  Copyright (C) 2019 David Lazar <dlazar@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __SAMPLER_H__
+#define __SAMPLER_H__
+
+#include <glib.h>
+
+#include "netdev.h"
+
+G_BEGIN_DECLS
+
+#define SAMPLER_NAME_SIZE	32
+
+typedef struct {
+	gint ifindex;
+	gchar name[SAMPLER_NAME_SIZE];
+	NetdevStats stats;
+} SamplerEntry;
+
+/* The readings of all the sampled interfaces, taken at one tick. */
+typedef struct {
+	NetdevTime time;
+	guint ticks;  /* Number of update intervals it covers, at least 1. */
+	guint n_entries;
+	SamplerEntry *entries;
+	guint n_alloc;  /* Room in `entries`, which is reused. */
+} SamplerSnapshot;
+
+typedef void (*SamplerFunc)(const SamplerSnapshot *snapshot, gpointer user_data);
+
+/* Reads the interfaces from a thread of its own, so that slow reads never
+ * stall the panel, and hands the snapshots over to `func`, which is called
+ * from the main context.  All the samplers of a process share the thread,
+ * which reads every interface once per tick for all of them, and each gets
+ * only the interfaces, and the ticks, that it was configured for.  They
+ * must all be used from the same thread.  The panel runs every instance of
+ * the plugin in a process of its own, unless it was configured with
+ * --enable-internal. */
+typedef struct _Sampler Sampler;
+
+Sampler *sampler_new(SamplerFunc func, gpointer user_data);
+void sampler_free(Sampler *this);
+
+/* Takes effect asynchronously.  `dev_names` is a list of interface names,
+ * or NULL to sample all the interfaces that are up.  If `adaptive`, the
+ * sampler backs off to longer, whole-second intervals while none of the
+ * counters change, and returns to `interval` as soon as they do.  If
+ * `count_packets`, the packet, error and drop counters are read too. */
+void sampler_configure(Sampler *this, guint interval, gboolean adaptive,
+		       gboolean count_packets, const gchar *dev_names);
+
+G_END_DECLS
+
+#endif  /* __SAMPLER_H__ */
@@ -0,0 +1,222 @@
+/*
+ *  Copyright (C) 2019 David Lazar <dlazar@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "tooltip.h"
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <glib.h>
+#include <libxfce4util/libxfce4util.h>
+
+/* Indexed by the mode, and by whether packets are shown. */
+static const gchar *const scale_formats[][2] = {
+	[SCALE_LINEAR] = {
+		N_("current scale: %sB/s at the top, %sB/s halfway (linear)"),
+		N_("current scale: %spkt/s at the top, %spkt/s halfway (linear)"),
+	},
+	[SCALE_SQRT] = {
+		N_("current scale: %sB/s at the top, %sB/s halfway (square root)"),
+		N_("current scale: %spkt/s at the top, %spkt/s halfway (square root)"),
+	},
+	[SCALE_LOG] = {
+		N_("current scale: %sB/s at the top, %sB/s halfway (logarithmic, from 1)"),
+		N_("current scale: %spkt/s at the top, %spkt/s halfway (logarithmic, from 1)"),
+	},
+};
+
+static gchar *format_human_size(guint64 num, gchar *buf, gsize bufsize);
+static gchar *format_count(guint64 num, gchar *buf, gsize bufsize);
+static gchar *format_scaled(guint64 num, guint base, const gchar *prefixes,
+			    gchar *buf, gsize bufsize);
+static gchar *put_uint(gchar *p, gchar *end, guint64 n);
+
+
+// Allow variable declarations at the first use.
+#pragma GCC diagnostic ignored "-Wdeclaration-after-statement"
+
+
+void tooltip_format(GString *markup, const Graph *graph, gboolean packets)
+{
+	const Traffic *traffic = graph->traffic;
+	guint64 scale = graph->scale;
+	ScaleMode mode = graph->scale_mode;
+	g_string_truncate(markup, 0);
+
+	/* Format into stack buffers, as g_string_append_printf() would
+	 * allocate a temporary string for every line. */
+#define BUFSIZE	32
+#define LINESIZE	256
+	gchar rx_buf[BUFSIZE], tx_buf[BUFSIZE];
+	gchar line[LINESIZE];
+	for (gsize i = 0; i < traffic->devs->len; i++) {
+		NetworkDevice *dev = g_ptr_array_index(traffic->devs, i);
+		if (graph->stacked) {
+			/* A swatch of the color of its band. */
+			GdkRGBA color;
+			graph_get_dev_color(graph, i, &color);
+			g_snprintf(line, LINESIZE, "<span foreground=\"#%02x%02x%02x\">\xe2\x96\xa0</span> ",
+				   (guint)(color.red * 255 + 0.5), (guint)(color.green * 255 + 0.5),
+				   (guint)(color.blue * 255 + 0.5));
+			g_string_append(markup, line);
+		}
+
+		format_human_size(history_get(dev->hist_rx, 0), rx_buf, BUFSIZE);
+		format_human_size(history_get(dev->hist_tx, 0), tx_buf, BUFSIZE);
+		g_snprintf(line, LINESIZE,
+			   _("<b>%s</b>: %sB/s down; %sB/s up\n"),
+			   dev->name_markup, rx_buf, tx_buf);
+		g_string_append(markup, line);
+
+		if (!dev->packets || !dev->packets->valid) continue;
+		const guint64 *rates = dev->packets->rates;
+		gchar drop_buf[BUFSIZE], missed_buf[BUFSIZE];
+		gchar rx_err_buf[BUFSIZE], tx_err_buf[BUFSIZE];
+		format_count(rates[NETDEV_RX_PACKETS], rx_buf, BUFSIZE);
+		format_count(rates[NETDEV_TX_PACKETS], tx_buf, BUFSIZE);
+		format_count(rates[NETDEV_RX_DROPPED], drop_buf, BUFSIZE);
+		format_count(rates[NETDEV_RX_MISSED_ERRORS], missed_buf, BUFSIZE);
+		format_count(rates[NETDEV_RX_ERRORS], rx_err_buf, BUFSIZE);
+		format_count(rates[NETDEV_TX_ERRORS], tx_err_buf, BUFSIZE);
+		g_snprintf(line, LINESIZE,
+			   _("    %spkt/s down; %spkt/s up; dropped %s/s; missed %s/s; "
+			     "errors %s/s down, %s/s up\n"),
+			   rx_buf, tx_buf, drop_buf, missed_buf, rx_err_buf, tx_err_buf);
+		g_string_append(markup, line);
+	}
+
+	/* The distribution of the total traffic over the graph. */
+	static const gdouble quantiles[] = { 0.50, 0.95, 0.99 };
+	gchar q_bufs[G_N_ELEMENTS(quantiles)][BUFSIZE];
+	for (gint dir = 0; dir < 2; dir++) {
+		History *hist;
+		if (packets) {
+			hist = traffic->agg_packets[(dir == 0) ? NETDEV_SERIES_RX_PACKETS
+							       : NETDEV_SERIES_TX_PACKETS];
+		} else {
+			hist = (dir == 0) ? traffic->agg_rx : traffic->agg_tx;
+		}
+		for (gsize i = 0; i < G_N_ELEMENTS(quantiles); i++) {
+			guint64 q = history_quantile(hist, quantiles[i]);
+			if (packets) {
+				format_count(q, q_bufs[i], BUFSIZE);
+			} else {
+				format_human_size(q, q_bufs[i], BUFSIZE);
+			}
+		}
+		if (packets) {
+			g_snprintf(line, LINESIZE,
+				   (dir == 0) ? _("<i>down</i>: p50 %spkt/s; p95 %spkt/s; p99 %spkt/s\n")
+					      : _("<i>up</i>: p50 %spkt/s; p95 %spkt/s; p99 %spkt/s\n"),
+				   q_bufs[0], q_bufs[1], q_bufs[2]);
+		} else {
+			g_snprintf(line, LINESIZE,
+				   (dir == 0) ? _("<i>down</i>: p50 %sB/s; p95 %sB/s; p99 %sB/s\n")
+					      : _("<i>up</i>: p50 %sB/s; p95 %sB/s; p99 %sB/s\n"),
+				   q_bufs[0], q_bufs[1], q_bufs[2]);
+		}
+		g_string_append(markup, line);
+	}
+
+	guint64 halfway = graph_scale_value(mode, scale, 0.5);
+	if (packets) {
+		format_count(scale, rx_buf, BUFSIZE);
+		format_count(halfway, tx_buf, BUFSIZE);
+	} else {
+		format_human_size(scale, rx_buf, BUFSIZE);
+		format_human_size(halfway, tx_buf, BUFSIZE);
+	}
+	g_snprintf(line, LINESIZE, _(scale_formats[mode][!!packets]), rx_buf, tx_buf);
+	g_string_append(markup, line);
+#undef LINESIZE
+#undef BUFSIZE
+}
+
+static gchar *format_human_size(guint64 num, gchar *buf, gsize bufsize)
+{
+	return format_scaled(num, 1024, "KMGTPE", buf, bufsize);
+}
+
+/* Like format_human_size(), for counts, which take decimal prefixes. */
+static gchar *format_count(guint64 num, gchar *buf, gsize bufsize)
+{
+	return format_scaled(num, 1000, "kMGTPE", buf, bufsize);
+}
+
+/* Formats `num` with three significant digits and a prefix, as in "1.23 K",
+ * or in full, as in "512 ", if it's below `base`.  This runs for every
+ * number in the tooltip, so it sticks to integers and skips printf. */
+static gchar *format_scaled(guint64 num, guint base, const gchar *prefixes,
+			    gchar *buf, gsize bufsize)
+{
+	gchar *p = buf;
+	gchar *end = buf + bufsize - 1;
+
+	if (num < base) {
+		p = put_uint(p, end, num);
+		if (p < end) *p++ = ' ';
+		*p = '\0';
+		return buf;
+	}
+
+	/* Bring it below `base` squared, so that it's at least 1 and below
+	 * `base` in units of the prefix. */
+	guint64 div = 1;
+	gint prefix = 0;
+	while (num / div >= (guint64)base * base && prefixes[prefix + 1]) {
+		div *= base;
+		prefix++;
+	}
+	guint64 scaled = num / div;
+
+	guint64 hundredths = (scaled * 100 + base / 2) / base;
+	if (hundredths < 1000) {
+		p = put_uint(p, end, hundredths / 100);
+		if (p < end) *p++ = '.';
+		if (p < end) *p++ = '0' + hundredths / 10 % 10;
+		if (p < end) *p++ = '0' + hundredths % 10;
+	} else if (hundredths < 10000) {
+		guint64 tenths = (scaled * 10 + base / 2) / base;
+		p = put_uint(p, end, tenths / 10);
+		if (p < end) *p++ = '.';
+		if (p < end) *p++ = '0' + tenths % 10;
+	} else {
+		p = put_uint(p, end, (scaled + base / 2) / base);
+	}
+	if (p < end) *p++ = ' ';
+	if (p < end) *p++ = prefixes[prefix];
+	*p = '\0';
+
+	return buf;
+}
+
+/* Writes the decimal digits of `n` at `p`, up to `end`, and returns where
+ * they end. */
+static gchar *put_uint(gchar *p, gchar *end, guint64 n)
+{
+	gchar digits[20];
+	gint len = 0;
+	do {
+		digits[len++] = '0' + n % 10;
+		n /= 10;
+	} while (n);
+
+	while (len > 0 && p < end) *p++ = digits[--len];
+	return p;
+}
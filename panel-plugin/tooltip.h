@@ -0,0 +1,37 @@
+/*
+ *  Copyright (C) 2019 David Lazar <dlazar@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __TOOLTIP_H__
+#define __TOOLTIP_H__
+
+#include <glib.h>
+
+#include "graph.h"
+
+G_BEGIN_DECLS
+
+/* Replaces the contents of `markup` with the tooltip of the graph, as Pango
+ * markup: the current rate of every device, along with its packet, error
+ * and drop rates if they're counted, and its color if the graph is stacked,
+ * the distribution of the total, and the scale of the graph and how it maps
+ * to the height, in packets per second if `packets` is set. */
+void tooltip_format(GString *markup, const Graph *graph, gboolean packets);
+
+G_END_DECLS
+
+#endif  /* __TOOLTIP_H__ */
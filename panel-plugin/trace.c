@@ -0,0 +1,230 @@
+/*
+ *  Copyright (C) 2019 David Lazar <dlazar@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "trace.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+
+#define TRACE_HEADER	"# netgraph trace 1"
+
+static gboolean parse_line(Trace *this, gchar *line);
+static gboolean parse_link(Trace *this, gchar *line);
+static gboolean parse_counters(Trace *this, gchar *line);
+static void end_frame(Trace *this);
+static int link_cmp(const void *a, const void *b);
+
+
+// Allow variable declarations at the first use.
+#pragma GCC diagnostic ignored "-Wdeclaration-after-statement"
+
+
+Trace *trace_load(const gchar *path)
+{
+	g_autofree gchar *contents = NULL;
+	g_autoptr(GError) error = NULL;
+	if (!g_file_get_contents(path, &contents, NULL, &error)) {
+		g_warning("Could not read %s: %s.", path, error->message);
+		return NULL;
+	}
+
+	if (!g_str_has_prefix(contents, TRACE_HEADER "\n")) {
+		g_warning("%s is not a netgraph trace.", path);
+		return NULL;
+	}
+
+	Trace *this = g_new0(Trace, 1);
+	this->frames = g_array_new(FALSE, FALSE, sizeof(TraceFrame));
+	this->links = g_array_new(FALSE, FALSE, sizeof(TraceLink));
+	this->names = g_string_chunk_new(4096);
+
+	guint lineno = 1;
+	gchar *line = contents;
+	while (*line) {
+		gchar *end = strchr(line, '\n');
+		if (end) *end = '\0';
+
+		if (!parse_line(this, line)) {
+			g_warning("%s:%u: Malformed line.", path, lineno);
+			trace_free(this);
+			return NULL;
+		}
+
+		if (!end) break;
+		line = end + 1;
+		lineno++;
+	}
+	end_frame(this);
+
+	if (this->frames->len == 0) {
+		g_warning("%s has no samples.", path);
+		trace_free(this);
+		return NULL;
+	}
+
+	return this;
+}
+
+void trace_free(Trace *this)
+{
+	if (!this) return;
+
+	g_array_free(this->frames, TRUE);
+	g_array_free(this->links, TRUE);
+	g_string_chunk_free(this->names);
+
+	g_free(this);
+}
+
+const TraceLink *trace_find_link(const Trace *this, guint index, const gchar *name)
+{
+	const TraceFrame *frame = &g_array_index(this->frames, TraceFrame, index);
+	if (frame->n_links == 0) return NULL;
+
+	const TraceLink key = { .name = name };
+	return bsearch(&key, &g_array_index(this->links, TraceLink, frame->first_link),
+		       frame->n_links, sizeof(TraceLink), link_cmp);
+}
+
+void trace_write_header(FILE *out)
+{
+	fputs(TRACE_HEADER "\n", out);
+}
+
+void trace_write_time(FILE *out, const NetdevTime *time)
+{
+	fprintf(out, "t %" G_GINT64_FORMAT " %" G_GINT64_FORMAT "\n",
+		time->monotonic, time->suspended);
+}
+
+void trace_write_link(FILE *out, gint ifindex, const gchar *name,
+		      const NetdevStats *stats)
+{
+	fprintf(out, "%d %s %" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT " %s\n",
+		ifindex, stats->is_up ? "up" : "down",
+		stats->rx_bytes, stats->tx_bytes, name);
+
+	if (!stats->has_counters) return;
+
+	fputc('c', out);
+	for (gint i = 0; i < NETDEV_N_COUNTERS; i++) {
+		fprintf(out, " %" G_GUINT64_FORMAT, stats->counters[i]);
+	}
+	fputc('\n', out);
+}
+
+static gboolean parse_line(Trace *this, gchar *line)
+{
+	if (*line == '\0' || *line == '#') return TRUE;
+
+	if (line[0] == 'c' && line[1] == ' ')
+		return parse_counters(this, line + 2);
+	if (line[0] != 't' || line[1] != ' ')
+		return parse_link(this, line);
+
+	end_frame(this);
+
+	gchar *end;
+	TraceFrame frame = { .first_link = this->links->len };
+	frame.time.monotonic = g_ascii_strtoll(line + 2, &end, 10);
+	if (end == line + 2 || *end != ' ') return FALSE;
+	line = end + 1;
+	frame.time.suspended = g_ascii_strtoll(line, &end, 10);
+	if (end == line) return FALSE;
+
+	g_array_append_val(this->frames, frame);
+	return TRUE;
+}
+
+/* Parses `<ifindex> <up|down> <rx_bytes> <tx_bytes> <name>`. */
+static gboolean parse_link(Trace *this, gchar *line)
+{
+	if (this->frames->len == 0) return FALSE;
+	TraceFrame *frame = &g_array_index(this->frames, TraceFrame, this->frames->len - 1);
+
+	gchar **fields = g_strsplit(line, " ", 5);
+	gboolean ok = (g_strv_length(fields) == 5);
+
+	TraceLink link = { .stats.time = frame->time };
+	gchar *end;
+	if (ok) {
+		gint64 ifindex = g_ascii_strtoll(fields[0], &end, 10);
+		ok = (*end == '\0' && ifindex >= 0 && ifindex <= G_MAXINT);
+		link.ifindex = ifindex;
+	}
+	if (ok) {
+		link.stats.is_up = (g_strcmp0(fields[1], "up") == 0);
+		ok = link.stats.is_up || (g_strcmp0(fields[1], "down") == 0);
+	}
+	if (ok) {
+		link.stats.rx_bytes = g_ascii_strtoull(fields[2], &end, 10);
+		ok = (*end == '\0');
+	}
+	if (ok) {
+		link.stats.tx_bytes = g_ascii_strtoull(fields[3], &end, 10);
+		ok = (*end == '\0');
+	}
+	if (ok) {
+		ok = (fields[4][0] != '\0');
+		link.name = g_string_chunk_insert_const(this->names, fields[4]);
+	}
+
+	g_strfreev(fields);
+	if (!ok) return FALSE;
+
+	g_array_append_val(this->links, link);
+	frame->n_links++;
+	return TRUE;
+}
+
+/* Parses the counters of the link on the previous line. */
+static gboolean parse_counters(Trace *this, gchar *line)
+{
+	if (this->frames->len == 0) return FALSE;
+	const TraceFrame *frame = &g_array_index(this->frames, TraceFrame, this->frames->len - 1);
+	if (frame->n_links == 0) return FALSE;
+	TraceLink *link = &g_array_index(this->links, TraceLink, this->links->len - 1);
+
+	for (gint i = 0; i < NETDEV_N_COUNTERS; i++) {
+		gchar *end;
+		link->stats.counters[i] = g_ascii_strtoull(line, &end, 10);
+		if (end == line || (*end != ' ' && *end != '\0')) return FALSE;
+		line = end;
+	}
+	if (*line != '\0') return FALSE;
+
+	link->stats.has_counters = TRUE;
+	return TRUE;
+}
+
+/* Sorts the links of the last sample, for trace_find_link(). */
+static void end_frame(Trace *this)
+{
+	if (this->frames->len == 0) return;
+	TraceFrame *frame = &g_array_index(this->frames, TraceFrame, this->frames->len - 1);
+	if (frame->n_links == 0) return;
+
+	qsort(&g_array_index(this->links, TraceLink, frame->first_link),
+	      frame->n_links, sizeof(TraceLink), link_cmp);
+}
+
+static int link_cmp(const void *a, const void *b)
+{
+	return strcmp(((const TraceLink *)a)->name, ((const TraceLink *)b)->name);
+}
@@ -0,0 +1,77 @@
+/*
+ *  Copyright (C) 2019 David Lazar <dlazar@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <stdio.h>
+#include <glib.h>
+
+#include "netdev.h"
+
+G_BEGIN_DECLS
+
+/* A recording of the counters and link states of all the interfaces, which
+ * can be played back instead of reading the running system, so that
+ * performance runs see the same traffic every time.  The file is plain
+ * text, with one `t` line for each sample, followed by one line for each
+ * interface:
+ *
+ *	# netgraph trace 1
+ *	t <monotonic usec> <suspended usec>
+ *	<ifindex> <up|down> <rx_bytes> <tx_bytes> <name>
+ *	c <rx_packets> <tx_packets> <rx_dropped> <rx_errors> <tx_errors> <rx_missed_errors>
+ *	...
+ *
+ * where the `c` line is only there if the packet counters were read. */
+
+typedef struct {
+	gint ifindex;
+	const gchar *name;
+	NetdevStats stats;
+} TraceLink;
+
+typedef struct {
+	NetdevTime time;
+	guint first_link;  /* Index of its first link in `links`. */
+	guint n_links;  /* Sorted by name. */
+} TraceFrame;
+
+typedef struct {
+	GArray *frames;  /* TraceFrame */
+	GArray *links;  /* TraceLink */
+	GStringChunk *names;
+} Trace;
+
+/* Returns NULL if the file can't be read or parsed. */
+Trace *trace_load(const gchar *path);
+void trace_free(Trace *this);
+
+/* Returns the reading of the interface called `name` in the sample at
+ * `index`, or NULL if it wasn't recorded. */
+const TraceLink *trace_find_link(const Trace *this, guint index, const gchar *name);
+
+void trace_write_header(FILE *out);
+void trace_write_time(FILE *out, const NetdevTime *time);
+/* Also writes the packet counters, if `stats` has them. */
+void trace_write_link(FILE *out, gint ifindex, const gchar *name,
+		      const NetdevStats *stats);
+
+G_END_DECLS
+
+#endif  /* __TRACE_H__ */
@@ -0,0 +1,374 @@
+/*
+ *  Copyright (C) 2019 David Lazar <dlazar@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "traffic.h"
+
+#include <string.h>
+#include <glib.h>
+
+static void index_netdev(Traffic *this, NetworkDevice *dev);
+static void unindex_netdev(Traffic *this, NetworkDevice *dev);
+static void set_ifindex(Traffic *this, NetworkDevice *dev, gint ifindex);
+static void drop_netdev(Traffic *this, NetworkDevice *dev);
+
+
+// Allow variable declarations at the first use.
+#pragma GCC diagnostic ignored "-Wdeclaration-after-statement"
+
+
+Traffic *traffic_new(void)
+{
+	Traffic *this = g_slice_new0(Traffic);
+	this->devs = g_ptr_array_new();
+	this->by_ifindex = g_hash_table_new(g_direct_hash, g_direct_equal);
+	this->by_name = g_hash_table_new(g_str_hash, g_str_equal);
+	this->agg_rx = history_new(0);
+	this->agg_tx = history_new(0);
+	history_track_quantiles(this->agg_rx);
+	history_track_quantiles(this->agg_tx);
+	this->agg_rrd_rx = rrd_new(0);
+	this->agg_rrd_tx = rrd_new(0);
+
+	return this;
+}
+
+void traffic_free(Traffic *this)
+{
+	/* Free the devs first, as their histories may be in the file. */
+	for (gsize i = 0; i < this->devs->len; i++) {
+		netdev_free(g_ptr_array_index(this->devs, i));
+	}
+	g_ptr_array_free(this->devs, TRUE);
+	g_hash_table_destroy(this->by_ifindex);
+	g_hash_table_destroy(this->by_name);
+	if (this->histfile) histfile_close(this->histfile);
+	history_free(this->agg_rx);
+	history_free(this->agg_tx);
+	rrd_free(this->agg_rrd_rx);
+	rrd_free(this->agg_rrd_tx);
+	for (gint i = 0; i < NETDEV_N_SERIES; i++) {
+		if (this->agg_packets[i]) history_free(this->agg_packets[i]);
+		if (this->agg_rrd_packets[i]) rrd_free(this->agg_rrd_packets[i]);
+	}
+
+	g_slice_free(Traffic, this);
+}
+
+void traffic_resize(Traffic *this, gsize hist_len)
+{
+	for (gsize i = 0; i < this->devs->len; i++) {
+		NetworkDevice *dev = g_ptr_array_index(this->devs, i);
+		netdev_resize(dev, hist_len);
+	}
+	history_resize(this->agg_rx, hist_len);
+	history_resize(this->agg_tx, hist_len);
+	rrd_resize(this->agg_rrd_rx, hist_len);
+	rrd_resize(this->agg_rrd_tx, hist_len);
+	for (gint i = 0; this->agg_packets[0] && i < NETDEV_N_SERIES; i++) {
+		history_resize(this->agg_packets[i], hist_len);
+		rrd_resize(this->agg_rrd_packets[i], hist_len);
+	}
+
+	this->hist_len = hist_len;
+	this->generation++;
+}
+
+void traffic_count_packets(Traffic *this, gboolean enable)
+{
+	if (enable == (this->agg_packets[0] != NULL)) return;
+
+	for (gsize i = 0; i < this->devs->len; i++) {
+		netdev_count_packets(g_ptr_array_index(this->devs, i), enable, this->hist_len);
+	}
+
+	for (gint i = 0; i < NETDEV_N_SERIES; i++) {
+		if (enable) {
+			this->agg_packets[i] = history_new(this->hist_len);
+			this->agg_rrd_packets[i] = rrd_new(this->hist_len);
+		} else {
+			history_free(this->agg_packets[i]);
+			rrd_free(this->agg_rrd_packets[i]);
+			this->agg_packets[i] = NULL;
+			this->agg_rrd_packets[i] = NULL;
+		}
+	}
+	if (enable) {
+		history_track_quantiles(this->agg_packets[NETDEV_SERIES_RX_PACKETS]);
+		history_track_quantiles(this->agg_packets[NETDEV_SERIES_TX_PACKETS]);
+	}
+
+	this->generation++;
+}
+
+void traffic_set_compact(Traffic *this, gboolean compact)
+{
+	if (compact == this->compact) return;
+	this->compact = compact;
+
+	for (gsize i = 0; i < this->devs->len; i++) {
+		NetworkDevice *dev = g_ptr_array_index(this->devs, i);
+		if (compact && this->histfile) histfile_detach(this->histfile, dev);
+		netdev_set_compact(dev, compact);
+		if (!compact && this->histfile) {
+			histfile_attach(this->histfile, dev, this->interval);
+		}
+	}
+
+	/* The samples were rounded, or restored. */
+	traffic_recompute(this);
+}
+
+void traffic_set_histfile(Traffic *this, HistoryFile *histfile)
+{
+	if (this->histfile) {
+		for (gsize i = 0; i < this->devs->len; i++) {
+			histfile_detach(this->histfile, g_ptr_array_index(this->devs, i));
+		}
+		histfile_close(this->histfile);
+	}
+
+	this->histfile = histfile;
+	if (!histfile) return;
+
+	gboolean restored = FALSE;
+	for (gsize i = 0; i < this->devs->len; i++) {
+		NetworkDevice *dev = g_ptr_array_index(this->devs, i);
+		restored |= histfile_attach(histfile, dev, this->interval);
+	}
+	if (restored) traffic_recompute(this);
+}
+
+NetworkDevice *traffic_add(Traffic *this, const gchar *name)
+{
+	NetworkDevice *dev = netdev_new(name, this->hist_len);
+	netdev_set_compact(dev, this->compact);
+	netdev_count_packets(dev, this->agg_packets[0] != NULL, this->hist_len);
+	g_ptr_array_add(this->devs, dev);
+	index_netdev(this, dev);
+	this->devs_generation++;
+
+	if (this->histfile
+	    && histfile_attach(this->histfile, dev, this->interval)) {
+		traffic_recompute(this);
+	}
+
+	return dev;
+}
+
+void traffic_remove(Traffic *this, gsize index, gsize n)
+{
+	for (gsize i = index; i < index + n; i++) {
+		drop_netdev(this, g_ptr_array_index(this->devs, i));
+	}
+
+	g_ptr_array_remove_range(this->devs, index, n);
+}
+
+NetworkDevice *traffic_find(const Traffic *this, gint ifindex, const gchar *name)
+{
+	if (ifindex > 0) {
+		NetworkDevice *dev = g_hash_table_lookup(this->by_ifindex,
+							 GINT_TO_POINTER(ifindex));
+		if (dev) return dev;
+	}
+	return g_hash_table_lookup(this->by_name, name);
+}
+
+void traffic_recompute(Traffic *this)
+{
+	history_clear(this->agg_rx);
+	history_clear(this->agg_tx);
+	rrd_clear(this->agg_rrd_rx);
+	rrd_clear(this->agg_rrd_tx);
+	for (gint i = 0; this->agg_packets[0] && i < NETDEV_N_SERIES; i++) {
+		history_clear(this->agg_packets[i]);
+		rrd_clear(this->agg_rrd_packets[i]);
+	}
+
+	for (gsize i = 0; i < this->devs->len; i++) {
+		NetworkDevice *dev = g_ptr_array_index(this->devs, i);
+		history_add(this->agg_rx, dev->hist_rx);
+		history_add(this->agg_tx, dev->hist_tx);
+		rrd_add(this->agg_rrd_rx, dev->rrd_rx);
+		rrd_add(this->agg_rrd_tx, dev->rrd_tx);
+
+		for (gint j = 0; dev->packets && j < NETDEV_N_SERIES; j++) {
+			history_add(this->agg_packets[j], dev->packets->hist[j]);
+			rrd_add(this->agg_rrd_packets[j], dev->packets->rrd[j]);
+		}
+	}
+
+	this->generation++;
+}
+
+void traffic_update_list(Traffic *this, const SamplerSnapshot *snapshot)
+{
+	for (guint i = 0; i < snapshot->n_entries; i++) {
+		const SamplerEntry *entry = &snapshot->entries[i];
+		NetworkDevice *dev = traffic_find(this, entry->ifindex, entry->name);
+
+		if (dev) {
+			if (g_strcmp0(dev->name, entry->name) != 0) {
+				g_debug("Netdev %s was renamed to %s.", dev->name, entry->name);
+				unindex_netdev(this, dev);
+				netdev_rename(dev, entry->name);
+				index_netdev(this, dev);
+				if (this->histfile) histfile_rename(this->histfile, dev);
+			}
+			continue;
+		}
+
+		/* Devices that disappeared get cleaned up later, once they've
+		 * been down long enough, so that their traffic scrolls out of
+		 * the graph. */
+		if (!entry->stats.is_up) continue;
+
+		g_debug("Found new netdev %s.", entry->name);
+		traffic_add(this, entry->name);
+	}
+}
+
+void traffic_update_stats(Traffic *this, const SamplerSnapshot *snapshot,
+			  gboolean prune)
+{
+	/* The consolidated histories count the time spent in suspend, so
+	 * that it shows up as a gap.  The rates only count the time the
+	 * counters could change. */
+	gint64 time = snapshot->time.monotonic;
+	guint64 now = (time + snapshot->time.suspended) / 1000;
+	guint interval = this->interval;
+	if (this->last_update) interval = MAX((time - this->last_update) / 1000, 1);
+	this->last_update = time;
+
+	/* A snapshot from a backed-off sampler fills all the columns it
+	 * covers, so that the time axis of the graph stays the same. */
+	guint ticks = MIN(snapshot->ticks, MAX(this->hist_len, 1));
+
+	/* Match the readings to the devs through the indexes, and mark the
+	 * devs that got one. */
+	guint serial = ++this->serial;
+	for (guint i = 0; i < snapshot->n_entries; i++) {
+		const SamplerEntry *entry = &snapshot->entries[i];
+		NetworkDevice *dev = traffic_find(this, entry->ifindex, entry->name);
+		if (!dev || dev->serial == serial) continue;
+
+		if (entry->ifindex > 0 && dev->ifindex != entry->ifindex) {
+			set_ifindex(this, dev, entry->ifindex);
+		}
+		netdev_update(dev, &entry->stats, now, interval, ticks);
+		dev->serial = serial;
+	}
+
+	guint64 rx = 0, tx = 0;
+	guint64 packets[NETDEV_N_SERIES] = { 0 };
+	for (gsize i = 0; i < this->devs->len; i++) {
+		NetworkDevice *dev = g_ptr_array_index(this->devs, i);
+		if (dev->serial != serial) netdev_update(dev, NULL, now, interval, ticks);
+
+		rx += history_get(dev->hist_rx, 0);
+		tx += history_get(dev->hist_tx, 0);
+		for (gint j = 0; dev->packets && j < NETDEV_N_SERIES; j++) {
+			packets[j] += history_get(dev->packets->hist[j], 0);
+		}
+	}
+	for (guint i = 0; i < ticks; i++) {
+		history_push(this->agg_rx, rx);
+		history_push(this->agg_tx, tx);
+	}
+	rrd_push(this->agg_rrd_rx, now, rx, interval);
+	rrd_push(this->agg_rrd_tx, now, tx, interval);
+
+	for (gint j = 0; this->agg_packets[0] && j < NETDEV_N_SERIES; j++) {
+		for (guint i = 0; i < ticks; i++) {
+			history_push(this->agg_packets[j], packets[j]);
+		}
+		rrd_push(this->agg_rrd_packets[j], now, packets[j], interval);
+	}
+	this->updates += ticks;
+
+	if (prune) {
+		/* Close the gaps in one pass, so that removing any number of
+		 * devs costs no more than going over them once. */
+		gsize kept = 0;
+		gboolean changed = FALSE;
+		for (gsize i = 0; i < this->devs->len; i++) {
+			NetworkDevice *dev = g_ptr_array_index(this->devs, i);
+
+			if (dev->down >= this->hist_len) {
+				g_debug("Removing netdev %s, was down for %d intervals.", dev->name, dev->down);
+				/* Only zeroes are left of the dev in the window of
+				 * the raw totals, which stay as they are, but the
+				 * consolidated ones go back further than it was
+				 * down. */
+				changed |= rrd_subtract(this->agg_rrd_rx, dev->rrd_rx);
+				changed |= rrd_subtract(this->agg_rrd_tx, dev->rrd_tx);
+				for (gint j = 0; dev->packets && j < NETDEV_N_SERIES; j++) {
+					changed |= rrd_subtract(this->agg_rrd_packets[j],
+								dev->packets->rrd[j]);
+				}
+				drop_netdev(this, dev);
+				continue;
+			}
+			this->devs->pdata[kept++] = dev;
+		}
+		g_ptr_array_set_size(this->devs, kept);
+
+		/* Keep the cached graph of the raw totals, which didn't
+		 * change. */
+		if (changed) this->rrd_generation++;
+	}
+
+	if (this->histfile) histfile_touch(this->histfile);
+}
+
+static void index_netdev(Traffic *this, NetworkDevice *dev)
+{
+	g_hash_table_replace(this->by_name, dev->name, dev);
+	if (dev->ifindex > 0) {
+		g_hash_table_replace(this->by_ifindex, GINT_TO_POINTER(dev->ifindex), dev);
+	}
+}
+
+/* Only removes the entries that still point to `dev`, as another dev may
+ * have taken over its name or ifindex. */
+static void unindex_netdev(Traffic *this, NetworkDevice *dev)
+{
+	if (g_hash_table_lookup(this->by_name, dev->name) == dev) {
+		g_hash_table_remove(this->by_name, dev->name);
+	}
+	gpointer key = GINT_TO_POINTER(dev->ifindex);
+	if (dev->ifindex > 0 && g_hash_table_lookup(this->by_ifindex, key) == dev) {
+		g_hash_table_remove(this->by_ifindex, key);
+	}
+}
+
+static void set_ifindex(Traffic *this, NetworkDevice *dev, gint ifindex)
+{
+	unindex_netdev(this, dev);
+	dev->ifindex = ifindex;
+	index_netdev(this, dev);
+}
+
+/* Frees a dev, which the caller then takes out of `devs`. */
+static void drop_netdev(Traffic *this, NetworkDevice *dev)
+{
+	unindex_netdev(this, dev);
+	if (this->histfile) histfile_detach(this->histfile, dev);
+	netdev_free(dev);
+	this->devs_generation++;
+}
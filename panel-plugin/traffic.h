@@ -0,0 +1,106 @@
+/*
+ *  Copyright (C) 2019 David Lazar <dlazar@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __TRAFFIC_H__
+#define __TRAFFIC_H__
+
+#include <glib.h>
+
+#include "histfile.h"
+#include "history.h"
+#include "netdev.h"
+#include "rrd.h"
+#include "sampler.h"
+
+G_BEGIN_DECLS
+
+/* The traffic histories of the monitored devices, and of their total,
+ * updated from the snapshots of the sampler.  The devices are indexed by
+ * ifindex and by name, so that adding, finding and removing one takes
+ * constant time, even with thousands of them. */
+typedef struct {
+	GPtrArray *devs;  /* In the order they were added, for drawing. */
+	GHashTable *by_ifindex;
+	GHashTable *by_name;
+	guint serial;  /* Number of snapshots seen. */
+	gsize hist_len;
+	guint interval;  /* The configured update interval, in milliseconds. */
+
+	History *agg_rx;  /* Sum of the traffic of all devs. */
+	History *agg_tx;
+	Rrd *agg_rrd_rx;
+	Rrd *agg_rrd_tx;
+	/* Sums of the packet rates of all devs, only set when counting
+	 * packets. */
+	History *agg_packets[NETDEV_N_SERIES];
+	Rrd *agg_rrd_packets[NETDEV_N_SERIES];
+
+	guint64 updates;  /* Number of samples added to the histories. */
+	gint64 last_update;  /* Monotonic time of the last snapshot. */
+
+	/* Changes whenever past samples of the total changed, rather than
+	 * new ones being added.  `rrd_generation` only changes when just the
+	 * consolidated totals did. */
+	guint generation;
+	guint rrd_generation;
+	guint devs_generation;  /* Changes whenever devs are added or removed. */
+
+	HistoryFile *histfile;  /* Only set when persisting the histories. */
+	gboolean compact;  /* Whether the histories of the devs are compact. */
+} Traffic;
+
+Traffic *traffic_new(void);
+
+/* Frees the devs without detaching them from the history file, so that
+ * they can be restored on the next start. */
+void traffic_free(Traffic *this);
+
+void traffic_resize(Traffic *this, gsize hist_len);
+
+/* Starts or stops keeping the histories of the packet rates. */
+void traffic_count_packets(Traffic *this, gboolean enable);
+
+/* Keeps the histories of the devs compact, see history_set_compact(), which
+ * takes them out of the history file.  The totals are kept exactly. */
+void traffic_set_compact(Traffic *this, gboolean compact);
+
+/* Moves the histories of all devs into `histfile`, which the traffic owns
+ * afterwards, or back into memory if it's NULL. */
+void traffic_set_histfile(Traffic *this, HistoryFile *histfile);
+
+/* Appends a device, which takes over the name from any other one. */
+NetworkDevice *traffic_add(Traffic *this, const gchar *name);
+void traffic_remove(Traffic *this, gsize index, gsize n);
+
+/* Looks up a device by ifindex, or by name if the link was re-created. */
+NetworkDevice *traffic_find(const Traffic *this, gint ifindex, const gchar *name);
+
+/* Rebuilds the total after devs were replaced. */
+void traffic_recompute(Traffic *this);
+
+/* Adds the new interfaces of the snapshot, and follows the renamed ones. */
+void traffic_update_list(Traffic *this, const SamplerSnapshot *snapshot);
+
+/* Adds the samples of the snapshot to the histories.  If `prune`, removes
+ * the devs that were down for the whole width of the histories. */
+void traffic_update_stats(Traffic *this, const SamplerSnapshot *snapshot,
+			  gboolean prune);
+
+G_END_DECLS
+
+#endif  /* __TRAFFIC_H__ */